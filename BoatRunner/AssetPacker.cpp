@@ -0,0 +1,115 @@
+// Cooks the models and textures of a scene manifest (the same mesh and
+// texture caches the game writes on its first run) and packs them, with
+// the compiled shaders of its pipelines, into one AssetBundle:
+//   AssetPacker scene.json assets.pak
+// Build it like main.cpp (same include and library paths) and run it from
+// the project directory. The bundle must be packed again when an asset or
+// its options in the manifest change: entries are not checked against
+// their sources at load time.
+#include "MyProject.hpp"
+
+// Whole contents of a file
+bool readAll(const std::string& file, std::vector<char>& contents) {
+	MappedFile mapping;
+	if (!mapping.open(file)) {
+		return false;
+	}
+	contents.assign(mapping.data, mapping.data + mapping.size);
+	return true;
+}
+
+int main(int argc, char **argv) {
+	if (argc != 3) {
+		std::cerr << "usage: " << argv[0] << " scene.json bundle.pak\n";
+		return EXIT_FAILURE;
+	}
+
+	std::vector<std::pair<std::string, std::vector<char>>> contents;
+	std::set<std::string> packed;
+	int failed = 0;
+	// Adds the cooked form of source, read from file
+	auto add = [&](const std::string& source, const std::string& file) {
+		std::vector<char> data;
+		if (!readAll(file, data)) {
+			std::cerr << "cannot read " << file << "\n";
+			failed++;
+			return;
+		}
+		contents.emplace_back(source, std::move(data));
+		packed.insert(source);
+	};
+
+	try {
+		Scene scene;
+		scene.read(argv[1]);
+		const nlohmann::json& manifest = scene.manifest;
+
+		for (const auto& p : manifest.at("pipelines")) {
+			for (const char *stage : {"vert", "frag"}) {
+				std::string file = p.at(stage).get<std::string>();
+				if (!packed.count(file)) {
+					add(file, file);
+				}
+			}
+		}
+
+		for (const auto& m : manifest.at("models")) {
+			std::string file = m.at("file").get<std::string>();
+			if (packed.count(file)) {
+				continue;
+			}
+			try {
+				Model M;
+				M.loadModel(file);
+				add(file, file + ".mesh");
+			} catch (const std::exception& e) {
+				std::cerr << e.what() << "\n";
+				failed++;
+			}
+		}
+
+		for (const auto& t : manifest.at("textures")) {
+			std::string file = t.at("file").get<std::string>();
+			if (packed.count(file)) {
+				continue;
+			}
+			try {
+				Texture T;
+				Scene::configure(&T, t);
+				T.loadImage(file);
+				T.freePixels();
+				add(file, file + ".tex");
+			} catch (const std::exception& e) {
+				std::cerr << e.what() << "\n";
+				failed++;
+			}
+		}
+
+		AssetBundle::write(argv[2], contents);
+	} catch (const std::exception& e) {
+		std::cerr << e.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	AssetBundle bundle;
+	if (!bundle.open(argv[2])) {
+		return EXIT_FAILURE;
+	}
+	uint64_t size = 0, stored = 0;
+	for (const auto& content : contents) {
+		const BundleEntry& entry = bundle.entries.at(content.first);
+		std::cout << content.first << ": " << entry.size << " bytes";
+		if (entry.compression == BUNDLE_LZ4) {
+			std::cout << ", " << entry.storedSize << " compressed";
+		}
+		std::cout << "\n";
+		size += entry.size;
+		stored += entry.storedSize;
+	}
+	std::cout << argv[2] << ": " << contents.size() << " entries, " << size
+			  << " bytes stored in " << stored << " (file " << bundle.mapping.size << ")\n";
+	if (failed > 0) {
+		std::cerr << failed << " assets could not be packed, the game loads them from their files\n";
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,207 @@
+// Compares drawing N rocks as separate objects (a descriptor set, a
+// uniform block and an indirect draw each, like the obstacles of the
+// game) with a single instanced object (InstancedDraw, one indirect draw
+// per LOD level), for N = 10, 100 and 1000. For each case it reports the
+// CPU time of the per-frame update, the number of draws recorded and the
+// average frame time (bounded by the refresh rate with a FIFO swapchain).
+//
+// Build it like main.cpp (same include and library paths), compile the
+// shaders with shaders/compile.bat (it needs vert_instanced.spv) and run
+// it from the project directory:
+//   InstanceBenchmark
+#include "MyProject.hpp"
+
+struct GlobalUniforms {
+	alignas(16) glm::mat4 view;
+	alignas(16) glm::mat4 proj;
+	alignas(16) glm::vec3 lightDir;
+	alignas(16) glm::vec3 lightColor;
+	alignas(16) glm::vec3 AmbColor;
+	alignas(16) glm::vec3 TopColor;
+	alignas(16) glm::vec3 eyePos;
+};
+
+struct ObjectUniforms {
+	alignas(16) glm::mat4 model;
+	alignas(4) float fadeOut;
+};
+
+class InstanceBenchmark : public BaseProject {
+protected:
+	const uint32_t counts[3] = {10, 100, 1000};
+	const int warmupFrames = 30;
+	const int measuredFrames = 300;
+
+	Scene scene;
+	SceneObject *global;
+	std::vector<SceneObject *> rocks;
+	SceneObject *instancedRocks;
+
+	// Current case: counts[testCase / 2], instanced when testCase is odd
+	int testCase = 0;
+	int frame = 0;
+	double updateMs = 0.0;
+	std::chrono::high_resolution_clock::time_point runStart;
+	uint32_t draws = 0;
+	std::vector<std::string> report;
+
+	uint32_t count() { return counts[testCase / 2]; }
+	bool instanced() { return testCase % 2 == 1; }
+
+	void setWindowParameters() {
+		windowWidth = 1280;
+		windowHeight = 720;
+		windowTitle = "Instance benchmark";
+		initialBackgroundColor = {0.0f, 0.0f, 0.0f, 1.0f};
+
+		nlohmann::json manifest = {
+			{"layouts", {
+				{"global", {{{"binding", 0}, {"type", "uniform"}, {"stage", "all"}}}},
+				{"object", {{{"binding", 0}, {"type", "dynamic"}, {"stage", "vertex"}},
+							{{"binding", 1}, {"type", "texture"}, {"stage", "fragment"}}}}}},
+			{"pipelines", {
+				{{"name", "main"}, {"vert", "shaders/vert.spv"}, {"frag", "shaders/frag.spv"},
+				 {"layouts", {"global", "object"}}, {"global", "global"}},
+				{{"name", "instanced"}, {"vert", "shaders/vert_instanced.spv"},
+				 {"frag", "shaders/frag.spv"}, {"instanced", true},
+				 {"layouts", {"global", "object"}}, {"global", "global"}}}},
+			{"models", {{{"name", "rock"}, {"file", "models/Rock_1.obj"}}}},
+			{"textures", {{{"name", "rock"}, {"file", "textures/Rock_1_Base_Color.jpg"}}}},
+			{"globals", {{{"name", "global"}, {"layout", "global"},
+						  {"bindings", {{{"binding", 0}, {"uniform", "global"}}}}}}},
+			{"objects", nlohmann::json::array()}};
+		auto object = [](const std::string& name, const std::string& pipeline) {
+			return nlohmann::json{{"name", name}, {"pipeline", pipeline}, {"layout", "object"},
+				{"model", "rock"}, {"bindings", {{{"binding", 0}, {"uniform", "object"}},
+												 {{"binding", 1}, {"texture", "rock"}}}}};
+		};
+		for (uint32_t i = 0; i < counts[2]; i++) {
+			manifest["objects"].push_back(object("rock" + std::to_string(i), "main"));
+		}
+		manifest["objects"].push_back(object("instancedRocks", "instanced"));
+		manifest["objects"].back()["instances"] = counts[2];
+		scene.manifest = manifest;
+		scene.poolSizes(uniformBlocksInPool, texturesInPool, setsInPool);
+		uniformRingSize = 512 * 1024;
+	}
+
+	void localInit() {
+		scene.init(this, {{"global", sizeof(GlobalUniforms)}, {"object", sizeof(ObjectUniforms)}});
+		global = scene.object("global");
+		for (uint32_t i = 0; i < counts[2]; i++) {
+			rocks.push_back(scene.object("rock" + std::to_string(i)));
+		}
+		instancedRocks = scene.object("instancedRocks");
+	}
+
+	void localCleanup() {
+		scene.cleanup();
+	}
+
+	// Like Scene::draw, for the objects of the current case only
+	void populateCommandBuffer(VkCommandBuffer commandBuffer, int currentImage) {
+		std::vector<SceneObject *> drawn(rocks.begin(), rocks.begin() + count());
+		if (instanced()) {
+			drawn = {instancedRocks};
+		}
+		Pipeline *P = drawn[0]->pipeline;
+		Model *M = drawn[0]->model;
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, P->graphicsPipeline);
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+								P->pipelineLayout, 0, 1,
+								&global->set.descriptorSets[currentImage], 0, nullptr);
+		VkDeviceSize offset = 0;
+		vkCmdBindVertexBuffers(commandBuffer, 0, 1, &M->vertexBuffer, &offset);
+		vkCmdBindIndexBuffer(commandBuffer, M->indexBuffer, 0, M->indexType);
+		draws = 0;
+		for (SceneObject *O : drawn) {
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+									P->pipelineLayout, 1, 1,
+									&O->set.descriptorSets[currentImage],
+									static_cast<uint32_t>(O->set.dynamicOffsets.size()),
+									O->set.dynamicOffsets.data());
+			if (instanced()) {
+				O->instances.draw(commandBuffer, currentImage);
+				draws += static_cast<uint32_t>(M->lods.size());
+			} else {
+				O->lodDraw.draw(commandBuffer, currentImage);
+				draws++;
+			}
+		}
+	}
+
+	void updateUniformBuffer(uint32_t currentImage) {
+		if (frame == warmupFrames) {
+			updateMs = 0.0;
+			runStart = std::chrono::high_resolution_clock::now();
+		} else if (frame == warmupFrames + measuredFrames) {
+			double frameMs = std::chrono::duration<double, std::milli>(
+								std::chrono::high_resolution_clock::now() - runStart).count() /
+							 measuredFrames;
+			report.push_back(std::to_string(count()) + (instanced() ? " instanced: " : " separate: ") +
+							 std::to_string(draws) + " draws, update " +
+							 std::to_string(updateMs / measuredFrames) + " ms, frame " +
+							 std::to_string(frameMs) + " ms");
+			frame = 0;
+			if (++testCase == 6) {
+				for (const auto& line : report) {
+					std::cout << line << "\n";
+				}
+				glfwSetWindowShouldClose(window, GLFW_TRUE);
+				testCase = 5;
+			} else {
+				recreateCommandBuffers();
+			}
+		}
+		frame++;
+
+		float time = frame * 0.01f;
+		GlobalUniforms gubo{};
+		gubo.view = glm::lookAt(glm::vec3(0.0f, 30.0f, -20.0f), glm::vec3(0.0f, 0.0f, 40.0f),
+								glm::vec3(0.0f, 1.0f, 0.0f));
+		gubo.proj = glm::perspective(glm::radians(45.0f),
+									 swapChainExtent.width / (float)swapChainExtent.height,
+									 0.1f, 1000.0f);
+		gubo.proj[1][1] *= -1;
+		gubo.lightDir = glm::vec3(0.0f, 1.0f, -1.0f);
+		gubo.lightColor = glm::vec3(0.8f);
+		gubo.AmbColor = glm::vec3(0.9f);
+		gubo.TopColor = glm::vec3(0.3f);
+		gubo.eyePos = glm::vec3(0.0f, 30.0f, -20.0f);
+		*global->uniform<GlobalUniforms>(currentImage) = gubo;
+
+		// A grid of rocks turning on themselves, 40 per row
+		auto start = std::chrono::high_resolution_clock::now();
+		if (instanced()) {
+			instancedRocks->instances.begin();
+		}
+		for (uint32_t i = 0; i < count(); i++) {
+			glm::mat4 model = glm::translate(glm::mat4(1.0f),
+								glm::vec3((static_cast<float>(i % 40) - 19.5f) * 3.0f, 0.0f,
+										  static_cast<float>(i / 40) * 3.0f));
+			model = glm::rotate(model, time + i, glm::vec3(0.0f, 1.0f, 0.0f));
+			if (instanced()) {
+				instancedRocks->instances.add(model, gubo.view, gubo.proj);
+			} else {
+				rocks[i]->lodDraw.update(currentImage, model, gubo.view, gubo.proj);
+				*rocks[i]->uniform<ObjectUniforms>(currentImage) = {model, 0.0f};
+			}
+		}
+		if (instanced()) {
+			instancedRocks->instances.end(currentImage);
+		}
+		updateMs += std::chrono::duration<double, std::milli>(
+						std::chrono::high_resolution_clock::now() - start).count();
+	}
+};
+
+int main() {
+	InstanceBenchmark app;
+	try {
+		app.run();
+	} catch (const std::exception& e) {
+		std::cerr << e.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
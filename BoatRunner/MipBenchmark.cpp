@@ -0,0 +1,129 @@
+// Compares the mip chains built on the CPU by MipBuilder (box and Kaiser
+// filters) with the linear blit chain of BaseProject::generateMipmaps.
+// The CPU time is the filtering alone; the end to end times include the
+// upload of the image (all the levels for the CPU chains, level 0 only
+// for the blits) until the device has executed it.
+//
+// Build it like main.cpp (same include and library paths) and run it from
+// the project directory; a window opens briefly:
+//   MipBenchmark textures/sea.jpeg textures/Rock_1_Base_Color.jpg
+#include "MyProject.hpp"
+
+class MipBenchmark : public BaseProject {
+public:
+	std::vector<std::string> files;
+
+protected:
+	const int runs = 10;
+
+	void setWindowParameters() {
+		windowWidth = 320;
+		windowHeight = 240;
+		windowTitle = "Mip benchmark";
+		initialBackgroundColor = {0.0f, 0.0f, 0.0f, 1.0f};
+		uniformBlocksInPool = 1;
+		texturesInPool = 1;
+		setsInPool = 1;
+	}
+
+	// Best of runs, in ms
+	template <typename F>
+	double best(F run) {
+		double result = 0.0;
+		for (int r = 0; r < runs; r++) {
+			auto start = std::chrono::high_resolution_clock::now();
+			run();
+			double ms = std::chrono::duration<double, std::milli>(
+							std::chrono::high_resolution_clock::now() - start).count();
+			result = (r == 0) ? ms : std::min(result, ms);
+		}
+		return result;
+	}
+
+	// Uploads the texture and waits for the device
+	void upload(Texture& T) {
+		T.BP = this;
+		T.createTextureImage();
+		uploads.submit();
+		uploads.collect(true);
+		vkDestroyImage(device, T.textureImage, nullptr);
+		vkFreeMemory(device, T.textureImageMemory, nullptr);
+	}
+
+	void localInit() {
+		std::vector<std::string> report;
+		for (const auto& file : files) {
+			int width, height, channels;
+			stbi_uc *level0 = stbi_load(file.c_str(), &width, &height, &channels, STBI_rgb_alpha);
+			if (!level0) {
+				std::cerr << "cannot load " << file << "\n";
+				continue;
+			}
+			report.push_back(file + " (" + std::to_string(width) + "x" +
+							 std::to_string(height) + ")");
+
+			const char *filterNames[2] = {"box", "kaiser"};
+			for (MipFilter filter : {MIP_FILTER_BOX, MIP_FILTER_KAISER}) {
+				double cpu = best([&]() {
+					Texture T;
+					T.texWidth = width;
+					T.texHeight = height;
+					T.mipFilter = filter;
+					T.buildMips(level0);
+				});
+				double total = best([&]() {
+					Texture T;
+					T.texWidth = width;
+					T.texHeight = height;
+					T.mipFilter = filter;
+					T.buildMips(level0);
+					upload(T);
+				});
+				report.push_back(std::string("  cpu ") + filterNames[filter] + ": build " +
+								 std::to_string(cpu) + " ms, with upload " +
+								 std::to_string(total) + " ms");
+			}
+
+			if (linearBlitSupported(VK_FORMAT_R8G8B8A8_SRGB)) {
+				double total = best([&]() {
+					Texture T;
+					T.texWidth = width;
+					T.texHeight = height;
+					T.gpuMips = true;
+					T.buildMips(level0);
+					upload(T);
+				});
+				report.push_back("  gpu blit: with upload " + std::to_string(total) + " ms");
+			} else {
+				report.push_back("  gpu blit: not supported for R8G8B8A8_SRGB");
+			}
+			stbi_image_free(level0);
+		}
+
+		for (const auto& line : report) {
+			std::cout << line << "\n";
+		}
+		glfwSetWindowShouldClose(window, GLFW_TRUE);
+	}
+
+	void localCleanup() {}
+	void populateCommandBuffer(VkCommandBuffer, int) {}
+	void updateUniformBuffer(uint32_t) {}
+};
+
+int main(int argc, char **argv) {
+	if (argc < 2) {
+		std::cerr << "usage: " << argv[0] << " image...\n";
+		return EXIT_FAILURE;
+	}
+
+	MipBenchmark app;
+	app.files.assign(argv + 1, argv + argc);
+	try {
+		app.run();
+	} catch (const std::exception& e) {
+		std::cerr << e.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
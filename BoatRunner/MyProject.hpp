@@ -14,14 +14,49 @@
 #include <algorithm>
 #include <fstream>
 #include <array>
+#include <limits>
+
+// Read-only file mapping, used by the binary mesh cache
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_DEFAULT_ALIGNED_GENTYPES
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/packing.hpp>
+#include <glm/gtc/quaternion.hpp>
+#define GLM_ENABLE_EXPERIMENTAL
+#include <glm/gtx/hash.hpp>
 
 #include <chrono>
+#include <unordered_map>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <exception>
+#include <cmath>
+#include <queue>
+#include <memory>
+#include <cfloat>
+
+// SSE2 is part of every x86-64 target
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BR_SSE2
+#include <emmintrin.h>
+#endif
 
 #define TINYOBJLOADER_IMPLEMENTATION
 #include <tiny_obj_loader.h>
@@ -30,6 +65,17 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
 
+// glTF models: stb_image is already included above, and models never
+// write images
+#define TINYGLTF_IMPLEMENTATION
+#define TINYGLTF_NO_INCLUDE_STB_IMAGE
+#define TINYGLTF_NO_STB_IMAGE_WRITE
+#define TINYGLTF_NO_EXTERNAL_IMAGE
+#include <tiny_gltf.h>
+
+// Scene manifests
+#include <json.hpp>
+
 //
 
 const int MAX_FRAMES_IN_FLIGHT = 2;
@@ -81,13 +127,158 @@ struct Vertex {
 						
 		return attributeDescriptions;
 	}
+
+	// Used to weld identical face corners into a single indexed vertex
+	bool operator==(const Vertex& other) const {
+		return pos == other.pos && norm == other.norm &&
+			   texCoord == other.texCoord;
+	}
+};
+
+namespace std {
+	template<> struct hash<Vertex> {
+		size_t operator()(Vertex const& vertex) const {
+			return ((hash<glm::vec3>()(vertex.pos) ^
+					(hash<glm::vec3>()(vertex.norm) << 1)) >> 1) ^
+					(hash<glm::vec2>()(vertex.texCoord) << 1);
+		}
+	};
+}
+
+// Octahedral mapping of unit vectors to [-1, 1]^2: project on the
+// |x|+|y|+|z| = 1 octahedron and fold the lower half over the upper one
+glm::vec2 octahedralEncode(glm::vec3 n) {
+	float l1 = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+	if (l1 == 0.0f) {
+		return glm::vec2(0.0f);
+	}
+	glm::vec2 e = glm::vec2(n.x, n.y) / l1;
+	if (n.z < 0.0f) {
+		glm::vec2 folded = 1.0f - glm::abs(glm::vec2(e.y, e.x));
+		e.x = e.x >= 0.0f ? folded.x : -folded.x;
+		e.y = e.y >= 0.0f ? folded.y : -folded.y;
+	}
+	return e;
+}
+
+glm::vec3 octahedralDecode(glm::vec2 e) {
+	glm::vec3 n(e.x, e.y, 1.0f - std::abs(e.x) - std::abs(e.y));
+	float t = std::max(-n.z, 0.0f);
+	n.x += n.x >= 0.0f ? -t : t;
+	n.y += n.y >= 0.0f ? -t : t;
+	return glm::normalize(n);
+}
+
+// Compact 16 byte layout for Model::format == VERTEX_QUANTIZED:
+// positions are snorm16 relative to the mesh bounds (the vertex shader
+// maps them back with the offset and scale given by the Model), normals
+// are octahedral encoded in 2 x snorm16 and UVs are half floats.
+struct QuantizedVertex {
+	int16_t pos[4];
+	int16_t norm[2];
+	uint16_t texCoord[2];
+	
+	static VkVertexInputBindingDescription getBindingDescription() {
+		VkVertexInputBindingDescription bindingDescription{};
+		bindingDescription.binding = 0;
+		bindingDescription.stride = sizeof(QuantizedVertex);
+		bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+		
+		return bindingDescription;
+	}
+	
+	static std::array<VkVertexInputAttributeDescription, 3>
+						getAttributeDescriptions() {
+		std::array<VkVertexInputAttributeDescription, 3>
+						attributeDescriptions{};
+		
+		attributeDescriptions[0].binding = 0;
+		attributeDescriptions[0].location = 0;
+		attributeDescriptions[0].format = VK_FORMAT_R16G16B16A16_SNORM;
+		attributeDescriptions[0].offset = offsetof(QuantizedVertex, pos);
+						
+		attributeDescriptions[1].binding = 0;
+		attributeDescriptions[1].location = 1;
+		attributeDescriptions[1].format = VK_FORMAT_R16G16_SNORM;
+		attributeDescriptions[1].offset = offsetof(QuantizedVertex, norm);
+		
+		attributeDescriptions[2].binding = 0;
+		attributeDescriptions[2].location = 2;
+		attributeDescriptions[2].format = VK_FORMAT_R16G16_SFLOAT;
+		attributeDescriptions[2].offset = offsetof(QuantizedVertex, texCoord);
+						
+		return attributeDescriptions;
+	}
+	
+	static QuantizedVertex quantize(const Vertex& vertex,
+									glm::vec3 offset, glm::vec3 scale) {
+		QuantizedVertex q;
+		glm::vec3 p = glm::clamp((vertex.pos - offset) / scale, -1.0f, 1.0f);
+		for (int i = 0; i < 3; i++) {
+			q.pos[i] = static_cast<int16_t>(glm::packSnorm1x16(p[i]));
+		}
+		q.pos[3] = 0;
+		
+		glm::vec2 e = octahedralEncode(vertex.norm);
+		q.norm[0] = static_cast<int16_t>(glm::packSnorm1x16(e.x));
+		q.norm[1] = static_cast<int16_t>(glm::packSnorm1x16(e.y));
+		
+		q.texCoord[0] = glm::packHalf1x16(vertex.texCoord.x);
+		q.texCoord[1] = glm::packHalf1x16(vertex.texCoord.y);
+		return q;
+	}
+};
+static_assert(sizeof(QuantizedVertex) == 16, "quantized vertices must stay 16 bytes");
+
+enum VertexFormat {VERTEX_FLOAT, VERTEX_QUANTIZED};
+
+// Per-instance data of the instanced pipelines (Pipeline::instanced),
+// read from vertex binding 1 once per instance: the model matrix takes
+// locations 3 to 6, params location 7 (x: fadeOut, the others free for
+// variants of the object).
+struct InstanceData {
+	glm::mat4 model;
+	glm::vec4 params;
+	
+	static VkVertexInputBindingDescription getBindingDescription() {
+		VkVertexInputBindingDescription bindingDescription{};
+		bindingDescription.binding = 1;
+		bindingDescription.stride = sizeof(InstanceData);
+		bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+		
+		return bindingDescription;
+	}
+	
+	static std::array<VkVertexInputAttributeDescription, 5>
+						getAttributeDescriptions() {
+		std::array<VkVertexInputAttributeDescription, 5>
+						attributeDescriptions{};
+		
+		for (uint32_t i = 0; i < 4; i++) {
+			attributeDescriptions[i].binding = 1;
+			attributeDescriptions[i].location = 3 + i;
+			attributeDescriptions[i].format = VK_FORMAT_R32G32B32A32_SFLOAT;
+			attributeDescriptions[i].offset = offsetof(InstanceData, model) +
+											  sizeof(glm::vec4) * i;
+		}
+		attributeDescriptions[4].binding = 1;
+		attributeDescriptions[4].location = 7;
+		attributeDescriptions[4].format = VK_FORMAT_R32G32B32A32_SFLOAT;
+		attributeDescriptions[4].offset = offsetof(InstanceData, params);
+		
+		return attributeDescriptions;
+	}
 };
+static_assert(sizeof(InstanceData) == 80, "InstanceData is read as is by the vertex shader");
 
 
 // Lesson 13
 struct QueueFamilyIndices {
 	std::optional<uint32_t> graphicsFamily;
 	std::optional<uint32_t> presentFamily;
+	// Family used for uploads: a transfer-only family if the device has
+	// one, else any family other than graphics, else graphics itself
+	std::optional<uint32_t> transferFamily;
 
 	bool isComplete() {
 		return graphicsFamily.has_value() &&
@@ -175,1494 +366,6305 @@ void PrintVkError( VkResult result ) {
 	std::cout << "Error: " << result << ", " << meaning << "\n";
 }
 
-class BaseProject;
-
-struct Model {
-	BaseProject *BP;
-	std::vector<Vertex> vertices;
-	std::vector<uint32_t> indices;
-	VkBuffer vertexBuffer;
-	VkDeviceMemory vertexBufferMemory;
-	VkBuffer indexBuffer;
-	VkDeviceMemory indexBufferMemory;
-	
-	void loadModel(std::string file);
-	void createIndexBuffer();
-	void createVertexBuffer();
-
-	void init(BaseProject *bp, std::string file);
-	void cleanup();
+// Read-only memory mapping of a whole file
+struct MappedFile {
+	const char *data = nullptr;
+	size_t size = 0;
+#ifdef _WIN32
+	HANDLE fileHandle = INVALID_HANDLE_VALUE;
+	HANDLE mappingHandle = NULL;
+#endif
+
+	bool open(const std::string& file);
+	void close();
+	~MappedFile() { close(); }
 };
 
-struct Texture {
-	BaseProject *BP;
-	uint32_t mipLevels;
-	VkImage textureImage;
-	VkDeviceMemory textureImageMemory;
-	VkImageView textureImageView;
-	VkSampler textureSampler;
-	
-	void createTextureImage(std::string file);
-	void createTextureImageView();
-	void createTextureSampler();
-
-	void init(BaseProject *bp, std::string file);
-	void cleanup();
-};
+bool MappedFile::open(const std::string& file) {
+	close();
+#ifdef _WIN32
+	fileHandle = CreateFileA(file.c_str(), GENERIC_READ, FILE_SHARE_READ,
+							 nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (fileHandle == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart == 0) {
+		close();
+		return false;
+	}
+	size = static_cast<size_t>(fileSize.QuadPart);
+	mappingHandle = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY,
+									   0, 0, nullptr);
+	if (mappingHandle == NULL) {
+		close();
+		return false;
+	}
+	data = static_cast<const char *>(MapViewOfFile(mappingHandle,
+									 FILE_MAP_READ, 0, 0, 0));
+#else
+	int fd = ::open(file.c_str(), O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		::close(fd);
+		return false;
+	}
+	size = static_cast<size_t>(st.st_size);
+	void *ptr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	data = (ptr == MAP_FAILED) ? nullptr : static_cast<const char *>(ptr);
+#endif
+	if (data == nullptr) {
+		close();
+		return false;
+	}
+	return true;
+}
 
-struct DescriptorSetLayoutBinding {
-	uint32_t binding;
-	VkDescriptorType type;
-	VkShaderStageFlags flags;
-};
+void MappedFile::close() {
+#ifdef _WIN32
+	if (data != nullptr) UnmapViewOfFile(data);
+	if (mappingHandle != NULL) CloseHandle(mappingHandle);
+	if (fileHandle != INVALID_HANDLE_VALUE) CloseHandle(fileHandle);
+	mappingHandle = NULL;
+	fileHandle = INVALID_HANDLE_VALUE;
+#else
+	if (data != nullptr) munmap(const_cast<char *>(data), size);
+#endif
+	data = nullptr;
+	size = 0;
+}
 
+// 64 bit FNV-1a over 8 byte words, used to detect when a cached asset is
+// out of date
+uint64_t hashBytes(const char *data, size_t size) {
+	uint64_t hash = 14695981039346656037ull;
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8) {
+		uint64_t word;
+		memcpy(&word, data + i, sizeof(word));
+		hash ^= word;
+		hash *= 1099511628211ull;
+	}
+	for (; i < size; i++) {
+		hash ^= static_cast<uint8_t>(data[i]);
+		hash *= 1099511628211ull;
+	}
+	return hash ^ size;
+}
 
-struct DescriptorSetLayout {
-	BaseProject *BP;
- 	VkDescriptorSetLayout descriptorSetLayout;
- 	
- 	void init(BaseProject *bp, std::vector<DescriptorSetLayoutBinding> B);
-	void cleanup();
+// Single file pack of cooked assets (mesh and texture caches, compiled
+// shaders), see AssetPacker.cpp. Entries are named by the path of their
+// source, e.g. "textures/sea.jpeg" holds the cache of that image.
+// Layout: BundleHeader, then the entries, each starting on a
+// BUNDLE_ALIGNMENT boundary so that stored ones are used in place from
+// the mapping, then the table of contents: BundleEntry[entryCount]
+// followed by the names. An entry is LZ4 block compressed only when that
+// saves at least 1/8 of its size.
+const char BUNDLE_MAGIC[4] = {'B', 'R', 'P', 'K'};
+const uint32_t BUNDLE_VERSION = 1;
+const uint64_t BUNDLE_ALIGNMENT = 64 * 1024;
+
+enum BundleCompression {BUNDLE_STORED, BUNDLE_LZ4};
+
+struct BundleHeader {
+	char magic[4];
+	uint32_t version;
+	uint32_t entryCount;
+	uint32_t reserved0;
+	uint64_t tocOffset;
+	uint64_t tocSize;		// entries and names
+	uint32_t reserved[8];
 };
-
-struct Pipeline {
-	BaseProject *BP;
-	VkPipeline graphicsPipeline;
-  	VkPipelineLayout pipelineLayout;
-  	
-  	void init(BaseProject *bp, const std::string& VertShader, const std::string& FragShader,
-  			  std::vector<DescriptorSetLayout *> D);
-  	VkShaderModule createShaderModule(const std::vector<char>& code);
-  	static std::vector<char> readFile(const std::string& filename);  	
-	void cleanup();
+static_assert(sizeof(BundleHeader) == 64, "bundle header must stay 64 bytes");
+
+struct BundleEntry {
+	uint64_t offset;
+	uint64_t storedSize;
+	uint64_t size;			// once decompressed
+	uint32_t compression;	// BundleCompression
+	uint32_t nameOffset;	// in the names following the entries
+	uint32_t nameLength;
+	uint32_t reserved;
+};
+static_assert(sizeof(BundleEntry) == 40, "BundleEntry is stored as is in the bundle");
+
+// Read only once opened, so the loader threads share it
+struct AssetBundle {
+	MappedFile mapping;
+	std::unordered_map<std::string, BundleEntry> entries;
+
+	bool open(const std::string& file);
+	void close();
+	bool contains(const std::string& name) const;
+	// Contents of an entry: stored ones point into the mapping, compressed
+	// ones are decompressed into storage. False if there is no such entry.
+	bool read(const std::string& name, const char *&data, size_t& size,
+			  std::vector<char>& storage) const;
+	// Packs (name, contents) pairs into a new bundle
+	static void write(const std::string& file,
+					  const std::vector<std::pair<std::string, std::vector<char>>>& contents);
+	// LZ4 block format, greedy matching on a hash of the next 4 bytes
+	static void compress(const char *src, size_t size, std::vector<char>& dst);
+	// False if src is not a valid block of exactly dstSize bytes
+	static bool decompress(const char *src, size_t size, char *dst, size_t dstSize);
 };
 
-enum DescriptorSetElementType {UNIFORM, TEXTURE};
+bool AssetBundle::open(const std::string& file) {
+	close();
+	if (!mapping.open(file)) {
+		return false;
+	}
+	BundleHeader header;
+	bool valid = mapping.size >= sizeof(header);
+	if (valid) {
+		memcpy(&header, mapping.data, sizeof(header));
+		valid = memcmp(header.magic, BUNDLE_MAGIC, sizeof(header.magic)) == 0 &&
+				header.version == BUNDLE_VERSION &&
+				header.tocOffset <= mapping.size &&
+				header.tocSize <= mapping.size - header.tocOffset &&
+				sizeof(BundleEntry) * static_cast<uint64_t>(header.entryCount) <= header.tocSize;
+	}
+	if (valid) {
+		const char *toc = mapping.data + header.tocOffset;
+		const char *names = toc + sizeof(BundleEntry) * header.entryCount;
+		uint64_t nameBytes = header.tocSize - sizeof(BundleEntry) * header.entryCount;
+		for (uint32_t i = 0; i < header.entryCount && valid; i++) {
+			BundleEntry entry;
+			memcpy(&entry, toc + sizeof(BundleEntry) * i, sizeof(entry));
+			valid = entry.offset <= mapping.size &&
+					entry.storedSize <= mapping.size - entry.offset &&
+					static_cast<uint64_t>(entry.nameOffset) + entry.nameLength <= nameBytes &&
+					(entry.compression == BUNDLE_LZ4 ||
+					 (entry.compression == BUNDLE_STORED && entry.storedSize == entry.size));
+			if (valid) {
+				entries[std::string(names + entry.nameOffset, entry.nameLength)] = entry;
+			}
+		}
+	}
+	if (!valid) {
+		std::cout << file << " is not an asset bundle of version " << BUNDLE_VERSION << "\n";
+		close();
+		return false;
+	}
+	return true;
+}
 
-struct DescriptorSetElement {
-	int binding;
-	DescriptorSetElementType type;
-	int size;
-	Texture *tex;
-};
+void AssetBundle::close() {
+	entries.clear();
+	mapping.close();
+}
 
-struct DescriptorSet {
-	BaseProject *BP;
+bool AssetBundle::contains(const std::string& name) const {
+	return entries.count(name) > 0;
+}
 
-	std::vector<std::vector<VkBuffer>> uniformBuffers;
-	std::vector<std::vector<VkDeviceMemory>> uniformBuffersMemory;
-	std::vector<VkDescriptorSet> descriptorSets;
-	
-	std::vector<bool> toFree;
+bool AssetBundle::read(const std::string& name, const char *&data, size_t& size,
+					   std::vector<char>& storage) const {
+	auto found = entries.find(name);
+	if (found == entries.end()) {
+		return false;
+	}
+	const BundleEntry& entry = found->second;
+	const char *stored = mapping.data + entry.offset;
+	if (entry.compression == BUNDLE_STORED) {
+		data = stored;
+		size = static_cast<size_t>(entry.size);
+		return true;
+	}
+	storage.resize(static_cast<size_t>(entry.size));
+	if (!decompress(stored, static_cast<size_t>(entry.storedSize),
+					storage.data(), storage.size())) {
+		throw std::runtime_error("failed to decompress bundle entry " + name + "!");
+	}
+	data = storage.data();
+	size = storage.size();
+	return true;
+}
 
-	void init(BaseProject *bp, DescriptorSetLayout *L,
-		std::vector<DescriptorSetElement> E);
-	void cleanup();
-};
+void AssetBundle::write(const std::string& file,
+						const std::vector<std::pair<std::string, std::vector<char>>>& contents) {
+	std::ofstream out(file, std::ios::binary | std::ios::trunc);
+	if (!out.is_open()) {
+		throw std::runtime_error("failed to create asset bundle " + file + "!");
+	}
+	auto align = [](uint64_t offset) {
+		return (offset + BUNDLE_ALIGNMENT - 1) / BUNDLE_ALIGNMENT * BUNDLE_ALIGNMENT;
+	};
+
+	std::vector<BundleEntry> toc;
+	std::string names;
+	std::vector<char> packed;
+	uint64_t offset = align(sizeof(BundleHeader));
+	for (const auto& content : contents) {
+		const std::vector<char>& data = content.second;
+		BundleEntry entry{};
+		entry.offset = offset;
+		entry.size = data.size();
+		entry.nameOffset = static_cast<uint32_t>(names.size());
+		entry.nameLength = static_cast<uint32_t>(content.first.size());
+		names += content.first;
+
+		compress(data.data(), data.size(), packed);
+		const std::vector<char> *stored = &data;
+		entry.compression = BUNDLE_STORED;
+		if (packed.size() <= data.size() - data.size() / 8) {
+			stored = &packed;
+			entry.compression = BUNDLE_LZ4;
+		}
+		entry.storedSize = stored->size();
+		out.seekp(static_cast<std::streamoff>(offset));
+		out.write(stored->data(), static_cast<std::streamsize>(stored->size()));
+		offset = align(offset + entry.storedSize);
+		toc.push_back(entry);
+	}
 
+	BundleHeader header{};
+	memcpy(header.magic, BUNDLE_MAGIC, sizeof(header.magic));
+	header.version = BUNDLE_VERSION;
+	header.entryCount = static_cast<uint32_t>(toc.size());
+	header.tocOffset = offset;
+	header.tocSize = sizeof(BundleEntry) * toc.size() + names.size();
+	out.seekp(static_cast<std::streamoff>(offset));
+	out.write(reinterpret_cast<const char *>(toc.data()), sizeof(BundleEntry) * toc.size());
+	out.write(names.data(), names.size());
+	out.seekp(0);
+	out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+	out.close();
+	if (!out) {
+		throw std::runtime_error("failed to write asset bundle " + file + "!");
+	}
+}
 
-// MAIN ! 
-class BaseProject {
-	friend class Model;
-	friend class Texture;
-	friend class Pipeline;
-	friend class DescriptorSetLayout;
-	friend class DescriptorSet;
-public:
-	virtual void setWindowParameters() = 0;
-    void run() {
-    	setWindowParameters();
-        initWindow();
-        initVulkan();
-        mainLoop();
-        cleanup();
-    }
+void AssetBundle::compress(const char *src, size_t size, std::vector<char>& dst) {
+	// Limits of the LZ4 block format: the last 5 bytes are literals and
+	// the last match starts at least 12 bytes before the end
+	const size_t MIN_MATCH = 4;
+	const size_t LAST_LITERALS = 5;
+	const size_t MATCH_FIND_LIMIT = 12;
+	const size_t MAX_OFFSET = 65535;
+	const int HASH_BITS = 16;
+
+	dst.clear();
+	dst.reserve(size + size / 255 + 16);
+	auto writeLength = [&](size_t length) {
+		for (; length >= 255; length -= 255) {
+			dst.push_back(static_cast<char>(255));
+		}
+		dst.push_back(static_cast<char>(length));
+	};
+	auto writeSequence = [&](size_t anchor, size_t literals, size_t matchLength) {
+		size_t matchCode = matchLength >= MIN_MATCH ? matchLength - MIN_MATCH : 0;
+		dst.push_back(static_cast<char>((std::min<size_t>(literals, 15) << 4) |
+										std::min<size_t>(matchCode, 15)));
+		if (literals >= 15) {
+			writeLength(literals - 15);
+		}
+		dst.insert(dst.end(), src + anchor, src + anchor + literals);
+		return matchCode;
+	};
+
+	size_t anchor = 0;
+	if (size > MATCH_FIND_LIMIT) {
+		std::vector<uint32_t> table(size_t(1) << HASH_BITS, 0);
+		size_t matchLimit = size - LAST_LITERALS;
+		size_t i = 1;
+		while (i + MATCH_FIND_LIMIT <= size) {
+			uint32_t word;
+			memcpy(&word, src + i, sizeof(word));
+			uint32_t slot = (word * 2654435761u) >> (32 - HASH_BITS);
+			size_t candidate = table[slot];
+			table[slot] = static_cast<uint32_t>(i);
+			if (i - candidate > MAX_OFFSET || memcmp(src + candidate, src + i, MIN_MATCH) != 0) {
+				i++;
+				continue;
+			}
+			while (i > anchor && candidate > 0 && src[i - 1] == src[candidate - 1]) {
+				i--;
+				candidate--;
+			}
+			size_t length = MIN_MATCH;
+			while (i + length < matchLimit && src[candidate + length] == src[i + length]) {
+				length++;
+			}
 
-protected:
-	uint32_t windowWidth;
-	uint32_t windowHeight;
-	std::string windowTitle;
-	VkClearColorValue initialBackgroundColor;
-	int uniformBlocksInPool;
-	int texturesInPool;
-	int setsInPool;
+			size_t matchCode = writeSequence(anchor, i - anchor, length);
+			size_t offset = i - candidate;
+			dst.push_back(static_cast<char>(offset & 255));
+			dst.push_back(static_cast<char>(offset >> 8));
+			if (matchCode >= 15) {
+				writeLength(matchCode - 15);
+			}
+			i += length;
+			anchor = i;
+		}
+	}
+	writeSequence(anchor, size - anchor, 0);
+}
 
-	// Lesson 12
-    GLFWwindow* window;
-    VkInstance instance;
+bool AssetBundle::decompress(const char *src, size_t size, char *dst, size_t dstSize) {
+	const uint8_t *in = reinterpret_cast<const uint8_t *>(src);
+	const uint8_t *end = in + size;
+	size_t out = 0;
+	auto readLength = [&](size_t& length) {
+		uint8_t byte;
+		do {
+			if (in == end) {
+				return false;
+			}
+			byte = *in++;
+			length += byte;
+		} while (byte == 255);
+		return true;
+	};
+
+	while (in < end) {
+		uint8_t token = *in++;
+		size_t literals = token >> 4;
+		if ((literals == 15 && !readLength(literals)) ||
+			literals > static_cast<size_t>(end - in) || literals > dstSize - out) {
+			return false;
+		}
+		memcpy(dst + out, in, literals);
+		in += literals;
+		out += literals;
+		if (in == end) {
+			break;		// the last sequence has no match
+		}
 
-    // Lesson 13
-	VkSurfaceKHR surface;
-    VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
-    VkDevice device;
-    VkQueue graphicsQueue;
-    VkQueue presentQueue;
-	VkCommandPool commandPool;
-	std::vector<VkCommandBuffer> commandBuffers;
+		if (end - in < 2) {
+			return false;
+		}
+		size_t offset = in[0] | (static_cast<size_t>(in[1]) << 8);
+		in += 2;
+		size_t length = token & 15;
+		if (length == 15 && !readLength(length)) {
+			return false;
+		}
+		length += 4;
+		if (offset == 0 || offset > out || length > dstSize - out) {
+			return false;
+		}
+		if (offset >= length) {
+			memcpy(dst + out, dst + out - offset, length);
+		} else {
+			// Overlapping match, repeats the last offset bytes
+			for (size_t k = 0; k < length; k++) {
+				dst[out + k] = dst[out - offset + k];
+			}
+		}
+		out += length;
+	}
+	return out == dstSize;
+}
 
-    // Lesson 14
-    VkSwapchainKHR swapChain;
-    std::vector<VkImage> swapChainImages;
-	VkFormat swapChainImageFormat;
-	VkExtent2D swapChainExtent;
-	std::vector<VkImageView> swapChainImageViews;
+// Binary mesh cache, written next to the source model as <file>.mesh.
+// Layout: header, vertex blob (sizeof(Vertex) * vertexCount, identical to
+// the in-memory Vertex array) and index blob (uint32_t * indexCount), both
+// already reordered by MeshOptimizer, then the indices of the coarser LOD
+// levels (uint32_t * lodIndexCount) and the LodLevel table (lodCount).
+const char MESH_CACHE_MAGIC[4] = {'B', 'R', 'M', 'C'};
+const uint32_t MESH_CACHE_VERSION = 3;
+// MeshCacheHeader::flags
+const uint32_t MESH_CACHE_OVERDRAW_SORTED = 1;
+
+struct MeshCacheHeader {
+	char magic[4];
+	uint32_t version;
+	uint64_t sourceHash;
+	uint32_t vertexStride;
+	uint32_t vertexCount;
+	uint32_t indexCount;
+	uint32_t flags;
+	float boundsMin[3];
+	float boundsMax[3];
+	uint32_t lodCount;
+	uint32_t lodIndexCount;
+};
+static_assert(sizeof(MeshCacheHeader) == 64, "mesh cache header must stay 64 bytes");
+
+// Texture cache, written next to the source image as <file>.tex.
+// Layout: header, TextureMip table (mipLevels entries), then every level
+// (RGBA8 or BCn blocks) back to back, copied to the image as they are
+// with one region per level.
+const char TEXTURE_CACHE_MAGIC[4] = {'B', 'R', 'T', 'C'};
+const uint32_t TEXTURE_CACHE_VERSION = 3;
+
+struct TextureMip {
+	uint32_t width;
+	uint32_t height;
+	uint64_t offset;	// from the start of level 0
+	uint64_t size;
+};
+static_assert(sizeof(TextureMip) == 24, "TextureMip is stored as is in the texture cache");
+
+struct TextureCacheHeader {
+	char magic[4];
+	uint32_t version;
+	uint64_t sourceHash;
+	uint32_t width;
+	uint32_t height;
+	uint32_t mipLevels;
+	uint32_t format;		// VkFormat of the stored levels
+	uint64_t dataSize;
+	uint32_t sourceFormat;	// VkFormat requested by the texture
+	uint32_t compression;	// 0 none, 1 compressed, 2 high quality
+	uint32_t mipFilter;		// MipFilter
+	uint32_t wrapMips;		// 1 when the mip borders wrap around
+	uint32_t reserved[2];
+};
+static_assert(sizeof(TextureCacheHeader) == 64, "texture cache header must stay 64 bytes");
+
+// Wavefront OBJ reader used by Model. The file is memory-mapped and cut
+// into line-aligned chunks that are parsed in parallel; face corners are
+// then resolved and welded straight into the Vertex / index arrays.
+// Only v, vt, vn and f records are read (faces are fan-triangulated).
+struct ObjReader {
+	// A face corner: 0-based global index, or an index relative to the
+	// number of elements the chunk had read so far (negative OBJ indices)
+	struct Corner {
+		int32_t v, vt, vn;
+		uint8_t relative;	// bit 0: v, bit 1: vt, bit 2: vn
+		uint8_t missing;	// same bits, set when the index was omitted
+	};
 	
-	// Lesson 19
-	VkRenderPass renderPass;
+	struct Chunk {
+		const char *begin;
+		const char *end;
+		std::vector<float> positions;
+		std::vector<float> texCoords;
+		std::vector<float> normals;
+		std::vector<Corner> corners;	// three per triangle
+		uint32_t positionBase, texCoordBase, normalBase;
+	};
 	
- 	VkDescriptorPool descriptorPool;
+	// Replaces the content of vertices and indices with the welded mesh
+	static void read(const char *data, size_t size,
+					 std::vector<Vertex>& vertices, std::vector<uint32_t>& indices);
+	static void parseChunk(Chunk& chunk);
+	static const char *parseFloat(const char *p, const char *end, float& value);
+	static const char *parseIndex(const char *p, const char *end, int32_t& value);
+};
 
-	// Lesson 22
-	// L22.0 --- Debugging
-	VkDebugUtilsMessengerEXT debugMessenger;
+const char *ObjReader::parseFloat(const char *p, const char *end, float& value) {
+	static const double powersOf10[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+		1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+	};
 	
-	// L22.1 --- depth buffer allocation (Z-buffer)
-	VkImage depthImage;
-	VkDeviceMemory depthImageMemory;
-	VkImageView depthImageView;
-
-	// L22.2 --- Frame buffers
-	std::vector<VkFramebuffer> swapChainFramebuffers;
-	size_t currentFrame = 0;
-
-	// L22.3 --- Synchronization objects
-	std::vector<VkSemaphore> imageAvailableSemaphores;
-	std::vector<VkSemaphore> renderFinishedSemaphores;
-	std::vector<VkFence> inFlightFences;
-	std::vector<VkFence> imagesInFlight;
+	while (p < end && (*p == ' ' || *p == '\t')) p++;
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+')) {
+		negative = (*p == '-');
+		p++;
+	}
 	
-	// Lesson 12
-    void initWindow() {
-        glfwInit();
-
-        glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-        glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
-
-        window = glfwCreateWindow(windowWidth, windowHeight, windowTitle.c_str(), nullptr, nullptr);
-    }
-
-	virtual void localInit() = 0;
-
-	// Lesson 12
-    void initVulkan() {
-		createInstance();				// L12
-		setupDebugMessenger();			// L22.0
-		createSurface();				// L13
-		pickPhysicalDevice();			// L14
-		createLogicalDevice();			// L14
-		createSwapChain();				// L15
-		createImageViews();				// L15
-		createRenderPass();				// L19
-		createCommandPool();			// L13
-		createDepthResources();			// L22.1
-		createFramebuffers();			// L22.2
-		createDescriptorPool();			// L21
-
-		localInit();
+	uint64_t mantissa = 0;
+	int exponent = 0;
+	int digits = 0;
+	while (p < end && *p >= '0' && *p <= '9') {
+		if (digits < 19) {
+			mantissa = mantissa * 10 + (*p - '0');
+			digits += (mantissa != 0);
+		} else {
+			exponent++;
+		}
+		p++;
+	}
+	if (p < end && *p == '.') {
+		p++;
+		while (p < end && *p >= '0' && *p <= '9') {
+			if (digits < 19) {
+				mantissa = mantissa * 10 + (*p - '0');
+				digits += (mantissa != 0);
+				exponent--;
+			}
+			p++;
+		}
+	}
+	if (p < end && (*p == 'e' || *p == 'E')) {
+		p++;
+		bool negativeExponent = false;
+		if (p < end && (*p == '-' || *p == '+')) {
+			negativeExponent = (*p == '-');
+			p++;
+		}
+		int e = 0;
+		while (p < end && *p >= '0' && *p <= '9') {
+			if (e < 10000) e = e * 10 + (*p - '0');
+			p++;
+		}
+		exponent += negativeExponent ? -e : e;
+	}
+	
+	double result = static_cast<double>(mantissa);
+	if (exponent < 0) {
+		result = exponent >= -22 ? result / powersOf10[-exponent]
+								 : result * std::pow(10.0, exponent);
+	} else if (exponent > 0) {
+		result = exponent <= 22 ? result * powersOf10[exponent]
+								: result * std::pow(10.0, exponent);
+	}
+	value = static_cast<float>(negative ? -result : result);
+	return p;
+}
 
-		createCommandBuffers();			// L22.5 (13)
-		createSyncObjects();			// L22.3 
-    }
+const char *ObjReader::parseIndex(const char *p, const char *end, int32_t& value) {
+	bool negative = false;
+	if (p < end && *p == '-') {
+		negative = true;
+		p++;
+	}
+	int32_t result = 0;
+	while (p < end && *p >= '0' && *p <= '9') {
+		result = result * 10 + (*p - '0');
+		p++;
+	}
+	value = negative ? -result : result;
+	return p;
+}
 
-	// Lesson 12 and 22.0
-    void createInstance() {
-    	VkApplicationInfo appInfo{};
-       	appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
-    	appInfo.pApplicationName = windowTitle.c_str();
-    	appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
-    	appInfo.pEngineName = "No Engine";
-    	appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-		appInfo.apiVersion = VK_API_VERSION_1_0;
+void ObjReader::parseChunk(Chunk& chunk) {
+	const char *p = chunk.begin;
+	const char *end = chunk.end;
+	std::vector<Corner> face;
+	
+	while (p < end) {
+		while (p < end && (*p == ' ' || *p == '\t')) p++;
+		const char *lineEnd = static_cast<const char *>(memchr(p, '\n', end - p));
+		if (lineEnd == nullptr) lineEnd = end;
 		
-		VkInstanceCreateInfo createInfo{};
-		createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
-		createInfo.pApplicationInfo = &appInfo;
-
-		uint32_t glfwExtensionCount = 0;
-		const char** glfwExtensions;
-		glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+		if (p + 1 < lineEnd && p[0] == 'v' && (p[1] == ' ' || p[1] == '\t')) {
+			float x, y, z;
+			p = parseFloat(p + 1, lineEnd, x);
+			p = parseFloat(p, lineEnd, y);
+			p = parseFloat(p, lineEnd, z);
+			chunk.positions.insert(chunk.positions.end(), {x, y, z});
+		} else if (p + 2 < lineEnd && p[0] == 'v' && p[1] == 't' &&
+				   (p[2] == ' ' || p[2] == '\t')) {
+			float u, v;
+			p = parseFloat(p + 2, lineEnd, u);
+			p = parseFloat(p, lineEnd, v);
+			chunk.texCoords.insert(chunk.texCoords.end(), {u, v});
+		} else if (p + 2 < lineEnd && p[0] == 'v' && p[1] == 'n' &&
+				   (p[2] == ' ' || p[2] == '\t')) {
+			float x, y, z;
+			p = parseFloat(p + 2, lineEnd, x);
+			p = parseFloat(p, lineEnd, y);
+			p = parseFloat(p, lineEnd, z);
+			chunk.normals.insert(chunk.normals.end(), {x, y, z});
+		} else if (p + 1 < lineEnd && p[0] == 'f' && (p[1] == ' ' || p[1] == '\t')) {
+			face.clear();
+			p++;
+			while (true) {
+				while (p < lineEnd && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+				if (p >= lineEnd || !(*p == '-' || (*p >= '0' && *p <= '9'))) break;
 				
-		createInfo.enabledExtensionCount = glfwExtensionCount;
-		createInfo.ppEnabledExtensionNames = glfwExtensions;
-
-		createInfo.enabledLayerCount = 0;
-
-		auto extensions = getRequiredExtensions();
-		createInfo.enabledExtensionCount =
-			static_cast<uint32_t>(extensions.size());
-		createInfo.ppEnabledExtensionNames = extensions.data();		
-		
-		// For debugging [Lesson 22] - Start
-		if (!checkValidationLayerSupport()) {
-			throw std::runtime_error("validation layers requested, but not available!");
-		}
-
-		VkDebugUtilsMessengerCreateInfoEXT debugCreateInfo;
-			createInfo.enabledLayerCount =
-				static_cast<uint32_t>(validationLayers.size());
-			createInfo.ppEnabledLayerNames = validationLayers.data();
-			
-			populateDebugMessengerCreateInfo(debugCreateInfo);
-			createInfo.pNext = (VkDebugUtilsMessengerCreateInfoEXT*)
-									&debugCreateInfo;
-		// For debugging [Lesson 22] - End
-		
-		VkResult result = vkCreateInstance(&createInfo, nullptr, &instance);
-		
-		if(result != VK_SUCCESS) {
-		 	PrintVkError(result);
-			throw std::runtime_error("failed to create instance!");
+				int32_t raw[3] = {0, 0, 0};
+				p = parseIndex(p, lineEnd, raw[0]);
+				if (p < lineEnd && *p == '/') {
+					p++;
+					if (p < lineEnd && *p != '/') p = parseIndex(p, lineEnd, raw[1]);
+					if (p < lineEnd && *p == '/') p = parseIndex(p + 1, lineEnd, raw[2]);
+				}
+				
+				const size_t counts[3] = {chunk.positions.size() / 3,
+										  chunk.texCoords.size() / 2,
+										  chunk.normals.size() / 3};
+				int32_t resolved[3];
+				Corner corner{};
+				for (int k = 0; k < 3; k++) {
+					if (raw[k] > 0) {
+						resolved[k] = raw[k] - 1;
+					} else if (raw[k] < 0) {
+						resolved[k] = static_cast<int32_t>(counts[k]) + raw[k];
+						corner.relative |= (1 << k);
+					} else {
+						resolved[k] = 0;
+						corner.missing |= (1 << k);
+					}
+				}
+				corner.v = resolved[0];
+				corner.vt = resolved[1];
+				corner.vn = resolved[2];
+				face.push_back(corner);
+			}
+			for (size_t k = 2; k < face.size(); k++) {
+				chunk.corners.push_back(face[0]);
+				chunk.corners.push_back(face[k - 1]);
+				chunk.corners.push_back(face[k]);
+			}
 		}
-    }
-    
-    // Lesson 12 and L22.0
-    std::vector<const char*> getRequiredExtensions() {
-		uint32_t glfwExtensionCount = 0;
-		const char** glfwExtensions;
-		glfwExtensions =
-			glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+		p = lineEnd + 1;
+	}
+}
 
-		std::vector<const char*> extensions(glfwExtensions,
-			glfwExtensions + glfwExtensionCount);
-			extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
-		
-		return extensions;
+void ObjReader::read(const char *data, size_t size,
+					 std::vector<Vertex>& vertices, std::vector<uint32_t>& indices) {
+	// Files below one chunk are parsed on the calling thread
+	const size_t minChunkSize = 256 * 1024;
+	size_t chunkCount = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()),
+										 std::max<size_t>(1, size / minChunkSize));
+	
+	std::vector<Chunk> chunks(chunkCount);
+	const char *p = data;
+	const char *end = data + size;
+	for (size_t i = 0; i < chunkCount; i++) {
+		const char *chunkEnd = (i == chunkCount - 1) ? end : data + size * (i + 1) / chunkCount;
+		if (chunkEnd < p) chunkEnd = p;
+		const char *newline = static_cast<const char *>(memchr(chunkEnd, '\n', end - chunkEnd));
+		chunkEnd = newline ? newline + 1 : end;
+		chunks[i].begin = p;
+		chunks[i].end = chunkEnd;
+		p = chunkEnd;
 	}
 	
-	// Lesson 22.0 - debug support
-	bool checkValidationLayerSupport() {
-		uint32_t layerCount;
-		vkEnumerateInstanceLayerProperties(&layerCount, nullptr);
-
-		std::vector<VkLayerProperties> availableLayers(layerCount);
-		vkEnumerateInstanceLayerProperties(&layerCount,
-					availableLayers.data());
-
-		for (const char* layerName : validationLayers) {
-			bool layerFound = false;
-			
-			for (const auto& layerProperties : availableLayers) {
-				if (strcmp(layerName, layerProperties.layerName) == 0) {
-					layerFound = true;
-					break;
+	std::vector<std::thread> workers;
+	for (size_t i = 1; i < chunkCount; i++) {
+		workers.emplace_back(parseChunk, std::ref(chunks[i]));
+	}
+	parseChunk(chunks[0]);
+	for (auto& t : workers) {
+		t.join();
+	}
+	
+	// Gather the attributes in file order, releasing each chunk's copy as
+	// soon as it has been appended
+	std::vector<float> positions = std::move(chunks[0].positions);
+	std::vector<float> texCoords = std::move(chunks[0].texCoords);
+	std::vector<float> normals = std::move(chunks[0].normals);
+	size_t cornerCount = chunks[0].corners.size();
+	chunks[0].positionBase = chunks[0].texCoordBase = chunks[0].normalBase = 0;
+	for (size_t i = 1; i < chunkCount; i++) {
+		Chunk& chunk = chunks[i];
+		chunk.positionBase = static_cast<uint32_t>(positions.size() / 3);
+		chunk.texCoordBase = static_cast<uint32_t>(texCoords.size() / 2);
+		chunk.normalBase = static_cast<uint32_t>(normals.size() / 3);
+		positions.insert(positions.end(), chunk.positions.begin(), chunk.positions.end());
+		texCoords.insert(texCoords.end(), chunk.texCoords.begin(), chunk.texCoords.end());
+		normals.insert(normals.end(), chunk.normals.begin(), chunk.normals.end());
+		std::vector<float>().swap(chunk.positions);
+		std::vector<float>().swap(chunk.texCoords);
+		std::vector<float>().swap(chunk.normals);
+		cornerCount += chunk.corners.size();
+	}
+	const int64_t positionCount = positions.size() / 3;
+	const int64_t texCoordCount = texCoords.size() / 2;
+	const int64_t normalCount = normals.size() / 3;
+	
+	// Corners are first welded on their (v, vt, vn) index triple, which
+	// is much cheaper to hash than the vertex they expand to
+	struct CornerKeyHash {
+		size_t operator()(const std::array<int32_t, 3>& k) const {
+			uint64_t h = static_cast<uint32_t>(k[0]);
+			h = h * 0x9E3779B97F4A7C15ull ^ static_cast<uint32_t>(k[1]);
+			h = h * 0x9E3779B97F4A7C15ull ^ static_cast<uint32_t>(k[2]);
+			return static_cast<size_t>(h ^ (h >> 29));
+		}
+	};
+	std::unordered_map<std::array<int32_t, 3>, uint32_t, CornerKeyHash> uniqueCorners;
+	uniqueCorners.reserve(cornerCount / 2);
+	vertices.clear();
+	indices.clear();
+	vertices.reserve(cornerCount / 2);
+	indices.reserve(cornerCount);
+	
+	for (const auto& chunk : chunks) {
+		for (const Corner& corner : chunk.corners) {
+			std::array<int32_t, 3> key = {corner.v, corner.vt, corner.vn};
+			const uint32_t bases[3] = {chunk.positionBase, chunk.texCoordBase, chunk.normalBase};
+			const int64_t counts[3] = {positionCount, texCoordCount, normalCount};
+			for (int k = 0; k < 3; k++) {
+				if ((corner.missing >> k) & 1) {
+					key[k] = -1;
+					continue;
+				}
+				if ((corner.relative >> k) & 1) {
+					key[k] += static_cast<int32_t>(bases[k]);
+				}
+				if (key[k] < 0 || key[k] >= counts[k]) {
+					throw std::runtime_error("OBJ face references a missing vertex!");
 				}
 			}
-		
-			if (!layerFound) {
-				return false;
+			if (key[0] < 0) {
+				throw std::runtime_error("OBJ face corner without a position!");
+			}
+			
+			auto inserted = uniqueCorners.emplace(key,
+								static_cast<uint32_t>(vertices.size()));
+			if (inserted.second) {
+				Vertex vertex{};
+				vertex.pos = {positions[3 * key[0] + 0],
+							  positions[3 * key[0] + 1],
+							  positions[3 * key[0] + 2]};
+				if (key[1] >= 0) {
+					vertex.texCoord = {texCoords[2 * key[1] + 0],
+									   1 - texCoords[2 * key[1] + 1]};
+				}
+				if (key[2] >= 0) {
+					vertex.norm = {normals[3 * key[2] + 0],
+								   normals[3 * key[2] + 1],
+								   normals[3 * key[2] + 2]};
+				}
+				vertices.push_back(vertex);
 			}
+			indices.push_back(inserted.first->second);
 		}
-		
-		return true;    
 	}
+	
+	// Distinct triples can still expand to identical vertices (e.g. repeated
+	// v lines): weld those too, as the tinyobj path did. Sorting an order
+	// array is much lighter than a second hash map.
+	std::vector<uint32_t> order(vertices.size());
+	for (size_t i = 0; i < order.size(); i++) {
+		order[i] = static_cast<uint32_t>(i);
+	}
+	auto less = [&vertices](uint32_t a, uint32_t b) {
+		int c = memcmp(&vertices[a], &vertices[b], sizeof(Vertex));
+		return c < 0 || (c == 0 && a < b);
+	};
+	std::sort(order.begin(), order.end(), less);
+	
+	std::vector<uint32_t> remap(vertices.size());
+	for (size_t i = 0; i < order.size(); i++) {
+		bool duplicate = i > 0 && vertices[order[i]] == vertices[order[i - 1]];
+		remap[order[i]] = duplicate ? remap[order[i - 1]] : order[i];
+	}
+	size_t welded = 0;
+	for (size_t i = 0; i < vertices.size(); i++) {
+		if (remap[i] == i) {
+			vertices[welded] = vertices[i];
+			order[i] = static_cast<uint32_t>(welded++);
+		}
+	}
+	vertices.resize(welded);
+	for (auto& index : indices) {
+		index = order[remap[index]];
+	}
+}
 
-	// Lesson 22.0 - debug support
-    void populateDebugMessengerCreateInfo(
-    		VkDebugUtilsMessengerCreateInfoEXT& createInfo) {
-    	createInfo = {};
-		createInfo.sType =
-			VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT;
-		createInfo.messageSeverity =
-			VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT |
-			VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT |
-			VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT;
-		createInfo.messageType = VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT |
-			VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT |
-			VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT;
-		createInfo.pfnUserCallback = debugCallback;
-		createInfo.pUserData = nullptr;
-    }
+// glTF 2.0 reader used by Model, for .gltf (JSON with external or embedded
+// buffers) and .glb files. glTF vertices are already unique, so accessors
+// are copied straight into the Vertex / index arrays. All the triangle
+// primitives of the meshes of the default scene are merged, with their
+// node transforms applied; materials and images are ignored.
+struct GltfReader {
+	// Replaces the content of vertices and indices with the scene geometry
+	static void read(const char *data, size_t size, const std::string& file,
+					 std::vector<Vertex>& vertices, std::vector<uint32_t>& indices);
+	static void readNode(const tinygltf::Model& gltf, int node, glm::mat4 transform,
+						 std::vector<Vertex>& vertices, std::vector<uint32_t>& indices);
+	static void readPrimitive(const tinygltf::Model& gltf, const tinygltf::Primitive& primitive,
+							  const glm::mat4& transform,
+							  std::vector<Vertex>& vertices, std::vector<uint32_t>& indices);
+	// Element i of an accessor as floats (normalized integers are scaled)
+	static void readFloats(const tinygltf::Model& gltf, const tinygltf::Accessor& accessor,
+						   size_t i, float *out, int count);
+	static const unsigned char *element(const tinygltf::Model& gltf,
+										const tinygltf::Accessor& accessor, size_t i);
+	static bool skipImage(tinygltf::Image *, const int, std::string *, std::string *,
+						  int, int, const unsigned char *, int, void *) {
+		return true;
+	}
+	// Hash of the file and of the external buffers (uri) it references,
+	// for the mesh cache: re-exporting only a .bin changes it too
+	static uint64_t hashSources(const char *data, size_t size, const std::string& file);
+	static std::string baseDir(const std::string& file);
+};
 
-	// Lesson 22.0 - debug support
-	static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
-		VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
-		VkDebugUtilsMessageTypeFlagsEXT messageType,
-		const VkDebugUtilsMessengerCallbackDataEXT* pCallbackData, void* pUserData) {
+std::string GltfReader::baseDir(const std::string& file) {
+	size_t slash = file.find_last_of("/\\");
+	return slash == std::string::npos ? "." : file.substr(0, slash);
+}
 
-		std::cerr << "validation layer: " << pCallbackData->pMessage << std::endl;		
-		return VK_FALSE;
+uint64_t GltfReader::hashSources(const char *data, size_t size, const std::string& file) {
+	uint64_t hash = hashBytes(data, size);
+	// The JSON text, or the JSON chunk of a .glb
+	std::string text;
+	if (size >= 4 && memcmp(data, "glTF", 4) == 0) {
+		uint32_t length = 0;
+		if (size >= 20) {
+			memcpy(&length, data + 12, sizeof(length));
+			text.assign(data + 20, std::min<size_t>(length, size - 20));
+		}
+	} else {
+		text.assign(data, size);
 	}
+	nlohmann::json document = nlohmann::json::parse(text, nullptr, false);
+	if (document.is_discarded() || !document.is_object()) {
+		// GltfReader::read reports the error
+		return hash;
+	}
+	// Malformed entries only miss the cache, GltfReader::read reports them
+	auto buffers = document.find("buffers");
+	if (buffers == document.end() || !buffers->is_array()) {
+		return hash;
+	}
+	for (const auto& buffer : *buffers) {
+		auto entry = buffer.is_object() ? buffer.find("uri") : buffer.end();
+		if (entry == buffer.end() || !entry->is_string()) {
+			continue;
+		}
+		const std::string& uri = entry->get_ref<const std::string&>();
+		if (uri.empty() || uri.compare(0, 5, "data:") == 0) {
+			continue;
+		}
+		// Percent-decoded, like tinygltf does; a bad escape is kept as is
+		std::string path;
+		for (size_t i = 0; i < uri.size(); i++) {
+			if (uri[i] == '%' && i + 2 < uri.size() &&
+				isxdigit(static_cast<unsigned char>(uri[i + 1])) &&
+				isxdigit(static_cast<unsigned char>(uri[i + 2]))) {
+				path += static_cast<char>(std::stoi(uri.substr(i + 1, 2), nullptr, 16));
+				i += 2;
+			} else {
+				path += uri[i];
+			}
+		}
+		MappedFile external;
+		uint64_t bufferHash = external.open(baseDir(file) + "/" + path) ?
+							  hashBytes(external.data, external.size) : 0;
+		hash = (hash ^ bufferHash) * 1099511628211ull;
+	}
+	return hash;
+}
 
-	// Lesson 22.0 - debug support
-	void setupDebugMessenger() {
-
-		VkDebugUtilsMessengerCreateInfoEXT createInfo{};
-		populateDebugMessengerCreateInfo(createInfo);
-		
-		if (CreateDebugUtilsMessengerEXT(instance, &createInfo, nullptr,
-				&debugMessenger) != VK_SUCCESS) {
-			throw std::runtime_error("failed to set up debug messenger!");
+void GltfReader::read(const char *data, size_t size, const std::string& file,
+					  std::vector<Vertex>& vertices, std::vector<uint32_t>& indices) {
+	tinygltf::TinyGLTF loader;
+	// Textures are loaded by Texture, do not decode them twice
+	loader.SetImageLoader(skipImage, nullptr);
+	
+	tinygltf::Model gltf;
+	std::string err, warn;
+	std::string baseDir = GltfReader::baseDir(file);
+	bool binary = size >= 4 && memcmp(data, "glTF", 4) == 0;
+	bool loaded = binary ?
+		loader.LoadBinaryFromMemory(&gltf, &err, &warn,
+									reinterpret_cast<const unsigned char *>(data),
+									static_cast<unsigned int>(size), baseDir) :
+		loader.LoadASCIIFromString(&gltf, &err, &warn, data,
+								   static_cast<unsigned int>(size), baseDir);
+	if (!warn.empty()) {
+		std::cout << file << ": " << warn << "\n";
+	}
+	if (!loaded) {
+		throw std::runtime_error("failed to load glTF file " + file + ": " + err);
+	}
+	
+	vertices.clear();
+	indices.clear();
+	if (gltf.scenes.empty()) {
+		// No scene: every mesh, untransformed
+		for (const auto& mesh : gltf.meshes) {
+			for (const auto& primitive : mesh.primitives) {
+				readPrimitive(gltf, primitive, glm::mat4(1.0f), vertices, indices);
+			}
+		}
+	} else {
+		const tinygltf::Scene& scene =
+			gltf.scenes[gltf.defaultScene >= 0 ? gltf.defaultScene : 0];
+		for (int node : scene.nodes) {
+			readNode(gltf, node, glm::mat4(1.0f), vertices, indices);
 		}
 	}
+}
 
-	// Lesson 13
-    void createSurface() {
-    	if (glfwCreateWindowSurface(instance, window, nullptr, &surface)
-    			!= VK_SUCCESS) {
-			throw std::runtime_error("failed to create window surface!");
+void GltfReader::readNode(const tinygltf::Model& gltf, int node, glm::mat4 transform,
+						  std::vector<Vertex>& vertices, std::vector<uint32_t>& indices) {
+	const tinygltf::Node& n = gltf.nodes[node];
+	if (n.matrix.size() == 16) {
+		glm::mat4 matrix;
+		for (int k = 0; k < 16; k++) {
+			matrix[k / 4][k % 4] = static_cast<float>(n.matrix[k]);
 		}
-    }
+		transform = transform * matrix;
+	} else {
+		if (n.translation.size() == 3) {
+			transform = glm::translate(transform, glm::vec3(n.translation[0], n.translation[1],
+															n.translation[2]));
+		}
+		if (n.rotation.size() == 4) {
+			// glTF quaternions are x, y, z, w
+			glm::quat rotation(static_cast<float>(n.rotation[3]), static_cast<float>(n.rotation[0]),
+							   static_cast<float>(n.rotation[1]), static_cast<float>(n.rotation[2]));
+			transform = transform * glm::mat4_cast(rotation);
+		}
+		if (n.scale.size() == 3) {
+			transform = glm::scale(transform, glm::vec3(n.scale[0], n.scale[1], n.scale[2]));
+		}
+	}
+	
+	if (n.mesh >= 0) {
+		for (const auto& primitive : gltf.meshes[n.mesh].primitives) {
+			readPrimitive(gltf, primitive, transform, vertices, indices);
+		}
+	}
+	for (int child : n.children) {
+		readNode(gltf, child, transform, vertices, indices);
+	}
+}
 
-	// Lesson 13
-    void pickPhysicalDevice() {
-    	uint32_t deviceCount = 0;
-    	vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr);
-    	 
-    	if (deviceCount == 0) {
-			throw std::runtime_error("failed to find GPUs with Vulkan support!");
+void GltfReader::readPrimitive(const tinygltf::Model& gltf, const tinygltf::Primitive& primitive,
+							   const glm::mat4& transform,
+							   std::vector<Vertex>& vertices, std::vector<uint32_t>& indices) {
+	auto attribute = [&](const char *name) -> const tinygltf::Accessor * {
+		auto found = primitive.attributes.find(name);
+		return found == primitive.attributes.end() ? nullptr : &gltf.accessors[found->second];
+	};
+	const tinygltf::Accessor *position = attribute("POSITION");
+	if (primitive.mode != TINYGLTF_MODE_TRIANGLES || position == nullptr) {
+		std::cout << "glTF: skipping a primitive that is not a triangle list\n";
+		return;
+	}
+	const tinygltf::Accessor *normal = attribute("NORMAL");
+	const tinygltf::Accessor *texCoord = attribute("TEXCOORD_0");
+	
+	uint32_t base = static_cast<uint32_t>(vertices.size());
+	glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(transform)));
+	// A mirroring transform flips the winding of the triangles
+	bool mirrored = glm::determinant(glm::mat3(transform)) < 0.0f;
+	
+	vertices.resize(base + position->count);
+	for (size_t i = 0; i < position->count; i++) {
+		Vertex& vertex = vertices[base + i];
+		float p[3], n[3] = {0.0f, 0.0f, 0.0f}, t[2] = {0.0f, 0.0f};
+		readFloats(gltf, *position, i, p, 3);
+		if (normal != nullptr) {
+			readFloats(gltf, *normal, i, n, 3);
 		}
-		
-		std::vector<VkPhysicalDevice> devices(deviceCount);
-		vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data());
-		
-		std::cout << "Physical devices found: " << deviceCount << "\n";
-		
-		for (const auto& device : devices) {
-			if (isDeviceSuitable(device)) {
-				physicalDevice = device;
+		if (texCoord != nullptr) {
+			readFloats(gltf, *texCoord, i, t, 2);
+		}
+		vertex.pos = glm::vec3(transform * glm::vec4(p[0], p[1], p[2], 1.0f));
+		vertex.norm = normalMatrix * glm::vec3(n[0], n[1], n[2]);
+		float length = glm::length(vertex.norm);
+		if (length > 0.0f) {
+			vertex.norm /= length;
+		}
+		// glTF and Vulkan both put the texture origin at the top left
+		vertex.texCoord = glm::vec2(t[0], t[1]);
+	}
+	
+	size_t first = indices.size();
+	if (primitive.indices >= 0) {
+		const tinygltf::Accessor& accessor = gltf.accessors[primitive.indices];
+		indices.resize(first + accessor.count);
+		for (size_t i = 0; i < accessor.count; i++) {
+			const unsigned char *p = element(gltf, accessor, i);
+			uint32_t index;
+			switch (accessor.componentType) {
+			case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+				index = *p;
 				break;
+			case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT: {
+				uint16_t value;
+				memcpy(&value, p, sizeof(value));
+				index = value;
+				break;
+			}
+			case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
+				memcpy(&index, p, sizeof(index));
+				break;
+			default:
+				throw std::runtime_error("unsupported glTF index type!");
+			}
+			if (index >= position->count) {
+				throw std::runtime_error("glTF index out of range!");
 			}
+			indices[first + i] = base + index;
 		}
-		
-		if (physicalDevice == VK_NULL_HANDLE) {
-			throw std::runtime_error("failed to find a suitable GPU!");
+	} else {
+		indices.resize(first + position->count);
+		for (size_t i = 0; i < position->count; i++) {
+			indices[first + i] = base + static_cast<uint32_t>(i);
 		}
-    }
-
-	// Lesson 13
-    bool isDeviceSuitable(VkPhysicalDevice device) {
- 		QueueFamilyIndices indices = findQueueFamilies(device);
-
-		bool extensionsSupported = checkDeviceExtensionSupport(device);
-
-		bool swapChainAdequate = false;
-		if (extensionsSupported) {
-			SwapChainSupportDetails swapChainSupport = querySwapChainSupport(device);
-			swapChainAdequate = !swapChainSupport.formats.empty() &&
-								!swapChainSupport.presentModes.empty();
+	}
+	indices.resize(first + (indices.size() - first) / 3 * 3);
+	if (mirrored) {
+		for (size_t i = first; i < indices.size(); i += 3) {
+			std::swap(indices[i + 1], indices[i + 2]);
 		}
-		
-		VkPhysicalDeviceFeatures supportedFeatures;
-		vkGetPhysicalDeviceFeatures(device, &supportedFeatures);
-		
-		return indices.isComplete() && extensionsSupported && swapChainAdequate &&
-						supportedFeatures.samplerAnisotropy;
 	}
-    
-    // Lesson 13
-    QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device) {
-		QueueFamilyIndices indices;
-		
-		uint32_t queueFamilyCount = 0;
-		vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount,
-						nullptr);
-
-		std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
-		vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount,
-								queueFamilies.data());
-								
-		int i=0;
-		for (const auto& queueFamily : queueFamilies) {
-			if (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) {
-				indices.graphicsFamily = i;
-			}
-				
-			VkBool32 presentSupport = false;
-			vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface,
-												 &presentSupport);
-			if (presentSupport) {
-			 	indices.presentFamily = i;
+	
+	if (normal == nullptr) {
+		// Area weighted face normals, summed on the shared vertices
+		for (size_t i = first; i < indices.size(); i += 3) {
+			Vertex &a = vertices[indices[i]], &b = vertices[indices[i + 1]],
+				   &c = vertices[indices[i + 2]];
+			glm::vec3 face = glm::cross(b.pos - a.pos, c.pos - a.pos);
+			a.norm += face;
+			b.norm += face;
+			c.norm += face;
+		}
+		for (size_t i = base; i < vertices.size(); i++) {
+			float length = glm::length(vertices[i].norm);
+			if (length > 0.0f) {
+				vertices[i].norm /= length;
 			}
-
-			if (indices.isComplete()) {
-				break;
-			}			
-			i++;
 		}
+	}
+}
 
-		return indices;
+const unsigned char *GltfReader::element(const tinygltf::Model& gltf,
+										 const tinygltf::Accessor& accessor, size_t i) {
+	if (accessor.sparse.isSparse || accessor.bufferView < 0) {
+		throw std::runtime_error("sparse glTF accessors are not supported!");
+	}
+	const tinygltf::BufferView& view = gltf.bufferViews[accessor.bufferView];
+	const tinygltf::Buffer& buffer = gltf.buffers[view.buffer];
+	int stride = accessor.ByteStride(view);
+	if (stride <= 0) {
+		throw std::runtime_error("invalid glTF accessor!");
+	}
+	size_t offset = view.byteOffset + accessor.byteOffset + i * stride;
+	size_t elementSize = static_cast<size_t>(tinygltf::GetComponentSizeInBytes(accessor.componentType)) *
+						 tinygltf::GetNumComponentsInType(accessor.type);
+	if (offset + elementSize > buffer.data.size()) {
+		throw std::runtime_error("glTF accessor out of its buffer!");
 	}
+	return buffer.data.data() + offset;
+}
 
-	// Lesson 13
-	bool checkDeviceExtensionSupport(VkPhysicalDevice device) {
-		uint32_t extensionCount;
-		vkEnumerateDeviceExtensionProperties(device, nullptr,
-					&extensionCount, nullptr);
-					
-		std::vector<VkExtensionProperties> availableExtensions(extensionCount);
-		vkEnumerateDeviceExtensionProperties(device, nullptr,
-					&extensionCount, availableExtensions.data());
-					
-		std::set<std::string> requiredExtensions(deviceExtensions.begin(),
-					deviceExtensions.end());
-					
-		for (const auto& extension : availableExtensions){
-			requiredExtensions.erase(extension.extensionName);
+void GltfReader::readFloats(const tinygltf::Model& gltf, const tinygltf::Accessor& accessor,
+							size_t i, float *out, int count) {
+	const unsigned char *p = element(gltf, accessor, i);
+	count = std::min(count, tinygltf::GetNumComponentsInType(accessor.type));
+	for (int k = 0; k < count; k++) {
+		switch (accessor.componentType) {
+		case TINYGLTF_COMPONENT_TYPE_FLOAT:
+			memcpy(&out[k], p + 4 * k, sizeof(float));
+			break;
+		case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+			out[k] = p[k] / 255.0f;
+			break;
+		case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT: {
+			uint16_t value;
+			memcpy(&value, p + 2 * k, sizeof(value));
+			out[k] = value / 65535.0f;
+			break;
+		}
+		case TINYGLTF_COMPONENT_TYPE_BYTE:
+			out[k] = std::max(static_cast<int8_t>(p[k]) / 127.0f, -1.0f);
+			break;
+		case TINYGLTF_COMPONENT_TYPE_SHORT: {
+			int16_t value;
+			memcpy(&value, p + 2 * k, sizeof(value));
+			out[k] = std::max(value / 32767.0f, -1.0f);
+			break;
 		}
+		default:
+			throw std::runtime_error("unsupported glTF attribute type!");
+		}
+	}
+}
 
-		return requiredExtensions.empty();
+// Symmetric 4x4 error quadric of Garland and Heckbert, with the total
+// weight of its planes so that errors can be turned back into distances
+struct Quadric {
+	double a00, a01, a02, a03, a11, a12, a13, a22, a23, a33;
+	double weight;
+	
+	static Quadric plane(glm::dvec3 n, double d, double w) {
+		Quadric q;
+		q.a00 = w * n.x * n.x; q.a01 = w * n.x * n.y; q.a02 = w * n.x * n.z; q.a03 = w * n.x * d;
+		q.a11 = w * n.y * n.y; q.a12 = w * n.y * n.z; q.a13 = w * n.y * d;
+		q.a22 = w * n.z * n.z; q.a23 = w * n.z * d;
+		q.a33 = w * d * d;
+		q.weight = w;
+		return q;
+	}
+	
+	void add(const Quadric& q) {
+		a00 += q.a00; a01 += q.a01; a02 += q.a02; a03 += q.a03;
+		a11 += q.a11; a12 += q.a12; a13 += q.a13;
+		a22 += q.a22; a23 += q.a23;
+		a33 += q.a33;
+		weight += q.weight;
+	}
+	
+	// Weighted sum of squared distances of p from the planes
+	double error(glm::dvec3 p) const {
+		double e = a00 * p.x * p.x + a11 * p.y * p.y + a22 * p.z * p.z + a33
+				 + 2.0 * (a01 * p.x * p.y + a02 * p.x * p.z + a12 * p.y * p.z
+						  + a03 * p.x + a13 * p.y + a23 * p.z);
+		return std::max(e, 0.0);
 	}
+};
 
-	// Lesson 14
-	SwapChainSupportDetails querySwapChainSupport(VkPhysicalDevice device) {
-		SwapChainSupportDetails details;
-		
-		 vkGetPhysicalDeviceSurfaceCapabilitiesKHR(device, surface,
-		 		&details.capabilities);
+// Import-time mesh optimizations, run once before a mesh is cached.
+// optimizeVertexCache reorders triangles with Tipsify (Sander, Nehab and
+// Barczak, "Fast Triangle Reordering for Vertex Locality and Reduced
+// Overdraw"), optimizeOverdraw sorts the resulting clusters so that
+// outward facing ones are drawn first, and optimizeVertexFetch reorders
+// the vertex array in order of first use. simplify builds the index
+// lists of the LOD levels by quadric error edge collapse.
+struct MeshOptimizer {
+	// Post-transform cache size the triangle order is tuned for
+	static const uint32_t cacheSize = 16;
+
+	// ACMR: vertices transformed per triangle; ATVR: vertices transformed
+	// per unique vertex (1 is optimal). Both for a FIFO cache of cacheSize.
+	struct CacheStats {
+		float acmr;
+		float atvr;
+	};
+	
+	static CacheStats analyzeVertexCache(const std::vector<uint32_t>& indices,
+										 size_t vertexCount);
+	// Fills clusters with the first triangle of every cluster, for optimizeOverdraw
+	static void optimizeVertexCache(std::vector<uint32_t>& indices, size_t vertexCount,
+									std::vector<uint32_t> *clusters = nullptr);
+	static void optimizeOverdraw(std::vector<uint32_t>& indices,
+								 const std::vector<Vertex>& vertices,
+								 const std::vector<uint32_t>& clusters,
+								 float threshold = 1.05f);
+	static void optimizeVertexFetch(std::vector<Vertex>& vertices,
+									std::vector<uint32_t>& indices);
+	// Collapses edges until at most targetIndexCount indices are left, or
+	// no collapse is possible without flipping a triangle. The result uses
+	// the same vertices; error is the largest distance (in model units)
+	// between the simplified surface and the planes it replaces.
+	static std::vector<uint32_t> simplify(const std::vector<Vertex>& vertices,
+										  const std::vector<uint32_t>& indices,
+										  size_t targetIndexCount, float& error);
+};
 
-		uint32_t formatCount;
-		vkGetPhysicalDeviceSurfaceFormatsKHR(device, surface, &formatCount,
-				nullptr);
-				
-		if (formatCount != 0) {
-			details.formats.resize(formatCount);
-			vkGetPhysicalDeviceSurfaceFormatsKHR(device, surface,
-					&formatCount, details.formats.data());
+MeshOptimizer::CacheStats MeshOptimizer::analyzeVertexCache(
+		const std::vector<uint32_t>& indices, size_t vertexCount) {
+	// A vertex is in the FIFO if fewer than cacheSize misses happened
+	// since it was loaded
+	std::vector<uint32_t> loadedAt(vertexCount, 0);
+	uint32_t misses = 0;
+	for (uint32_t index : indices) {
+		if (misses + cacheSize - loadedAt[index] >= cacheSize) {
+			misses++;
+			loadedAt[index] = misses + cacheSize;
 		}
-		
-		uint32_t presentModeCount;
-		vkGetPhysicalDeviceSurfacePresentModesKHR(device, surface,
-			&presentModeCount, nullptr);
-		
-		if (presentModeCount != 0) {
-			details.presentModes.resize(presentModeCount);
-			vkGetPhysicalDeviceSurfacePresentModesKHR(device, surface,
-					&presentModeCount, details.presentModes.data());
-		}
-		 
-		return details;
 	}
+	
+	CacheStats stats;
+	stats.acmr = indices.empty() ? 0.0f : 3.0f * misses / indices.size();
+	stats.atvr = vertexCount == 0 ? 0.0f : static_cast<float>(misses) / vertexCount;
+	return stats;
+}
 
-	// Lesson 13
-	void createLogicalDevice() {
-		QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
-		
-		std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
-		std::set<uint32_t> uniqueQueueFamilies =
-				{indices.graphicsFamily.value(), indices.presentFamily.value()};
-		
-		float queuePriority = 1.0f;
-		for (uint32_t queueFamily : uniqueQueueFamilies) {
-			VkDeviceQueueCreateInfo queueCreateInfo{};
-			queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-			queueCreateInfo.queueFamilyIndex = queueFamily;
-			queueCreateInfo.queueCount = 1;
-			queueCreateInfo.pQueuePriorities = &queuePriority;
-			queueCreateInfos.push_back(queueCreateInfo);
-		}
-		
-		VkPhysicalDeviceFeatures deviceFeatures{};
-		deviceFeatures.samplerAnisotropy = VK_TRUE;
-		
-		VkDeviceCreateInfo createInfo{};
-		createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-		
-		createInfo.pQueueCreateInfos = queueCreateInfos.data();
-		createInfo.queueCreateInfoCount = 
-			static_cast<uint32_t>(queueCreateInfos.size());
-		
-		createInfo.pEnabledFeatures = &deviceFeatures;
-		createInfo.enabledExtensionCount =
-				static_cast<uint32_t>(deviceExtensions.size());
-		createInfo.ppEnabledExtensionNames = deviceExtensions.data();
-
-			createInfo.enabledLayerCount = 
-					static_cast<uint32_t>(validationLayers.size());
-			createInfo.ppEnabledLayerNames = validationLayers.data();
-		
-		VkResult result = vkCreateDevice(physicalDevice, &createInfo, nullptr, &device);
-		
-		if (result != VK_SUCCESS) {
-		 	PrintVkError(result);
-			throw std::runtime_error("failed to create logical device!");
-		}
-		
-		vkGetDeviceQueue(device, indices.graphicsFamily.value(), 0, &graphicsQueue);
-		vkGetDeviceQueue(device, indices.presentFamily.value(), 0, &presentQueue);
+void MeshOptimizer::optimizeVertexCache(std::vector<uint32_t>& indices, size_t vertexCount,
+										std::vector<uint32_t> *clusters) {
+	size_t triangleCount = indices.size() / 3;
+	
+	// Vertex -> triangles adjacency, and number of triangles still to emit
+	std::vector<uint32_t> live(vertexCount, 0);
+	for (uint32_t index : indices) {
+		live[index]++;
+	}
+	std::vector<uint32_t> adjacencyStart(vertexCount + 1, 0);
+	for (size_t v = 0; v < vertexCount; v++) {
+		adjacencyStart[v + 1] = adjacencyStart[v] + live[v];
+	}
+	std::vector<uint32_t> adjacency(indices.size());
+	std::vector<uint32_t> fill(adjacencyStart.begin(), adjacencyStart.end() - 1);
+	for (size_t i = 0; i < indices.size(); i++) {
+		adjacency[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
 	}
 	
-	// Lesson 14
-	void createSwapChain() {
-		SwapChainSupportDetails swapChainSupport =
-				querySwapChainSupport(physicalDevice);
-		VkSurfaceFormatKHR surfaceFormat =
-				chooseSwapSurfaceFormat(swapChainSupport.formats);
-		VkPresentModeKHR presentMode =
-				chooseSwapPresentMode(swapChainSupport.presentModes);
-		VkExtent2D extent = chooseSwapExtent(swapChainSupport.capabilities);
-		
-		uint32_t imageCount = swapChainSupport.capabilities.minImageCount + 1;
-		
-		if (swapChainSupport.capabilities.maxImageCount > 0 &&
-				imageCount > swapChainSupport.capabilities.maxImageCount) {
-			imageCount = swapChainSupport.capabilities.maxImageCount;
+	std::vector<uint32_t> cacheTime(vertexCount, 0);
+	std::vector<bool> emitted(triangleCount, false);
+	std::vector<uint32_t> deadEnd;
+	std::vector<uint32_t> candidates;
+	std::vector<uint32_t> output;
+	output.reserve(indices.size());
+	if (clusters) {
+		clusters->clear();
+	}
+	
+	uint32_t time = cacheSize + 1;
+	size_t cursor = 0;
+	int64_t fanning = vertexCount > 0 ? 0 : -1;
+	bool newCluster = true;
+	while (fanning >= 0) {
+		candidates.clear();
+		for (uint32_t a = adjacencyStart[fanning]; a < adjacencyStart[fanning + 1]; a++) {
+			uint32_t t = adjacency[a];
+			if (emitted[t]) {
+				continue;
+			}
+			if (newCluster && clusters) {
+				clusters->push_back(static_cast<uint32_t>(output.size() / 3));
+			}
+			newCluster = false;
+			for (int k = 0; k < 3; k++) {
+				uint32_t v = indices[3 * t + k];
+				output.push_back(v);
+				deadEnd.push_back(v);
+				candidates.push_back(v);
+				live[v]--;
+				if (time - cacheTime[v] > cacheSize) {
+					cacheTime[v] = time++;
+				}
+			}
+			emitted[t] = true;
 		}
 		
-		VkSwapchainCreateInfoKHR createInfo{};
-		createInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
-		createInfo.surface = surface;
-		createInfo.minImageCount = imageCount;
-		createInfo.imageFormat = surfaceFormat.format;
-		createInfo.imageColorSpace = surfaceFormat.colorSpace;
-		createInfo.imageExtent = extent;
-		createInfo.imageArrayLayers = 1;
-		createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
-		
-		QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
-		uint32_t queueFamilyIndices[] = {indices.graphicsFamily.value(),
-										 indices.presentFamily.value()};
-		if (indices.graphicsFamily != indices.presentFamily) {
-			createInfo.imageSharingMode = VK_SHARING_MODE_CONCURRENT;
-			createInfo.queueFamilyIndexCount = 2;
-			createInfo.pQueueFamilyIndices = queueFamilyIndices;
-		} else {
-			createInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
-			createInfo.queueFamilyIndexCount = 0; // Optional
-			createInfo.pQueueFamilyIndices = nullptr; // Optional
+		// Next fanning vertex: the candidate still in cache, with live
+		// triangles, that entered the cache first
+		int64_t next = -1;
+		int64_t best = -1;
+		for (uint32_t v : candidates) {
+			if (live[v] == 0) {
+				continue;
+			}
+			int64_t priority = 0;
+			if (time - cacheTime[v] + 2 * live[v] <= cacheSize) {
+				priority = time - cacheTime[v];
+			}
+			if (priority > best) {
+				best = priority;
+				next = v;
+			}
 		}
 		
-		 createInfo.preTransform = swapChainSupport.capabilities.currentTransform;
-		 createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
-		 createInfo.presentMode = presentMode;
-		 createInfo.clipped = VK_TRUE;
-		 createInfo.oldSwapchain = VK_NULL_HANDLE;
-		 
-		 VkResult result = vkCreateSwapchainKHR(device, &createInfo, nullptr, &swapChain);
-		 if (result != VK_SUCCESS) {
-		 	PrintVkError(result);
-			throw std::runtime_error("failed to create swap chain!");
+		if (next < 0) {
+			// Dead end: restart from a recently used vertex, or scan for
+			// any vertex with live triangles. This starts a new cluster.
+			while (!deadEnd.empty() && next < 0) {
+				uint32_t v = deadEnd.back();
+				deadEnd.pop_back();
+				if (live[v] > 0) {
+					next = v;
+				}
+			}
+			while (next < 0 && cursor < vertexCount) {
+				if (live[cursor] > 0) {
+					next = cursor;
+				}
+				cursor++;
+			}
+			newCluster = true;
 		}
-		
-		vkGetSwapchainImagesKHR(device, swapChain, &imageCount, nullptr);
-		swapChainImages.resize(imageCount);
-		vkGetSwapchainImagesKHR(device, swapChain, &imageCount,
-				swapChainImages.data());
-				
-		swapChainImageFormat = surfaceFormat.format;
-		swapChainExtent = extent;
+		fanning = next;
 	}
+	
+	indices.swap(output);
+}
 
-	// Lesson 14
-	VkSurfaceFormatKHR chooseSwapSurfaceFormat(
-				const std::vector<VkSurfaceFormatKHR>& availableFormats)
-	{
-		for (const auto& availableFormat : availableFormats) {
-			if (availableFormat.format == VK_FORMAT_B8G8R8A8_SRGB &&
-				availableFormat.colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR) {
-				return availableFormat;
+void MeshOptimizer::optimizeOverdraw(std::vector<uint32_t>& indices,
+									 const std::vector<Vertex>& vertices,
+									 const std::vector<uint32_t>& clusters,
+									 float threshold) {
+	size_t triangleCount = indices.size() / 3;
+	if (clusters.size() == 0 || triangleCount == 0) {
+		return;
+	}
+	
+	// Split the clusters found by Tipsify where the running ACMR of the
+	// cluster is already below threshold times the ACMR of the whole mesh
+	float targetAcmr = threshold * analyzeVertexCache(indices, vertices.size()).acmr;
+	const size_t minClusterSize = 8 * cacheSize;
+	std::vector<uint32_t> splits;
+	std::vector<uint32_t> loadedAt(vertices.size(), 0);
+	uint32_t misses = 0;
+	for (size_t c = 0; c < clusters.size(); c++) {
+		size_t first = clusters[c];
+		size_t last = (c + 1 < clusters.size()) ? clusters[c + 1] : triangleCount;
+		size_t splitStart = first;
+		splits.push_back(static_cast<uint32_t>(first));
+		// Each cluster starts with a cold cache
+		misses += cacheSize;
+		uint32_t clusterStart = misses;
+		for (size_t t = first; t < last; t++) {
+			for (int k = 0; k < 3; k++) {
+				uint32_t v = indices[3 * t + k];
+				if (misses + cacheSize - loadedAt[v] >= cacheSize) {
+					misses++;
+					loadedAt[v] = misses + cacheSize;
+				}
+			}
+			// Small clusters would pay a cold cache too often
+			size_t done = t + 1 - splitStart;
+			if (t + 1 < last && done >= minClusterSize &&
+				static_cast<float>(misses - clusterStart) / done <= targetAcmr) {
+				splits.push_back(static_cast<uint32_t>(t + 1));
+				splitStart = t + 1;
+				clusterStart = misses;
 			}
 		}
-		
-		return availableFormats[0];
 	}
-
-	// Lesson 14
-	VkPresentModeKHR chooseSwapPresentMode(
-			const std::vector<VkPresentModeKHR>& availablePresentModes) {
-		for (const auto& availablePresentMode : availablePresentModes) {
-			if (availablePresentMode == VK_PRESENT_MODE_MAILBOX_KHR) {
-				return availablePresentMode;
-			}
+	
+	glm::vec3 meshCenter(0.0f);
+	for (const auto& vertex : vertices) {
+		meshCenter += vertex.pos;
+	}
+	meshCenter /= static_cast<float>(std::max<size_t>(1, vertices.size()));
+	
+	// Clusters facing away from the center are likely to occlude the
+	// others, so they are drawn first
+	std::vector<float> score(splits.size());
+	for (size_t c = 0; c < splits.size(); c++) {
+		size_t last = (c + 1 < splits.size()) ? splits[c + 1] : triangleCount;
+		glm::vec3 center(0.0f);
+		glm::vec3 normal(0.0f);
+		for (size_t t = splits[c]; t < last; t++) {
+			const glm::vec3& p0 = vertices[indices[3 * t]].pos;
+			const glm::vec3& p1 = vertices[indices[3 * t + 1]].pos;
+			const glm::vec3& p2 = vertices[indices[3 * t + 2]].pos;
+			center += p0 + p1 + p2;
+			normal += glm::cross(p1 - p0, p2 - p0);
 		}
-		return VK_PRESENT_MODE_FIFO_KHR;
+		center /= 3.0f * (last - splits[c]);
+		float length = glm::length(normal);
+		score[c] = length > 0.0f ? glm::dot(center - meshCenter, normal / length) : 0.0f;
 	}
 	
-	// Lesson 14
-	VkExtent2D chooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilities) {
-		if (capabilities.currentExtent.width != UINT32_MAX) {
+	std::vector<uint32_t> order(splits.size());
+	for (size_t c = 0; c < order.size(); c++) {
+		order[c] = static_cast<uint32_t>(c);
+	}
+	std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+		return score[a] > score[b];
+	});
+	
+	std::vector<uint32_t> output;
+	output.reserve(indices.size());
+	for (uint32_t c : order) {
+		size_t last = (c + 1 < splits.size()) ? splits[c + 1] : triangleCount;
+		output.insert(output.end(), indices.begin() + 3 * splits[c],
+					  indices.begin() + 3 * last);
+	}
+	indices.swap(output);
+}
+
+void MeshOptimizer::optimizeVertexFetch(std::vector<Vertex>& vertices,
+										std::vector<uint32_t>& indices) {
+	// Vertices never referenced by a triangle are dropped
+	const uint32_t unused = std::numeric_limits<uint32_t>::max();
+	std::vector<uint32_t> remap(vertices.size(), unused);
+	std::vector<Vertex> output;
+	output.reserve(vertices.size());
+	for (uint32_t& index : indices) {
+		if (remap[index] == unused) {
+			remap[index] = static_cast<uint32_t>(output.size());
+			output.push_back(vertices[index]);
+		}
+		index = remap[index];
+	}
+	vertices.swap(output);
+}
+
+std::vector<uint32_t> MeshOptimizer::simplify(const std::vector<Vertex>& vertices,
+											  const std::vector<uint32_t>& indices,
+											  size_t targetIndexCount, float& error) {
+	// Collapses work on positions: vertices split by normal or UV seams
+	// share the position, and so its quadric and its collapses
+	std::vector<uint32_t> positionOf(vertices.size());
+	std::vector<glm::dvec3> positions;
+	std::vector<std::vector<uint32_t>> verticesAt;
+	std::unordered_map<glm::vec3, uint32_t> positionIds;
+	for (size_t v = 0; v < vertices.size(); v++) {
+		auto inserted = positionIds.emplace(vertices[v].pos,
+											static_cast<uint32_t>(positions.size()));
+		if (inserted.second) {
+			positions.push_back(glm::dvec3(vertices[v].pos));
+			verticesAt.emplace_back();
+		}
+		positionOf[v] = inserted.first->second;
+		verticesAt[positionOf[v]].push_back(static_cast<uint32_t>(v));
+	}
+	size_t positionCount = positions.size();
+	
+	std::vector<uint32_t> triangles(indices);
+	size_t triangleCount = triangles.size() / 3;
+	std::vector<bool> alive(triangleCount, true);
+	std::vector<std::vector<uint32_t>> trianglesAt(positionCount);
+	std::vector<Quadric> quadrics(positionCount, Quadric{});
+	std::unordered_map<uint64_t, uint32_t> edgeUses;
+	size_t liveTriangles = 0;
+	
+	auto edgeKey = [](uint32_t a, uint32_t b) {
+		return (static_cast<uint64_t>(std::min(a, b)) << 32) | std::max(a, b);
+	};
+	
+	for (size_t t = 0; t < triangleCount; t++) {
+		uint32_t p[3];
+		for (int k = 0; k < 3; k++) {
+			p[k] = positionOf[triangles[3 * t + k]];
+		}
+		if (p[0] == p[1] || p[1] == p[2] || p[0] == p[2]) {
+			alive[t] = false;
+			continue;
+		}
+		liveTriangles++;
+		
+		glm::dvec3 n = glm::cross(positions[p[1]] - positions[p[0]],
+								  positions[p[2]] - positions[p[0]]);
+		double length = glm::length(n);
+		for (int k = 0; k < 3; k++) {
+			trianglesAt[p[k]].push_back(static_cast<uint32_t>(t));
+			edgeUses[edgeKey(p[k], p[(k + 1) % 3])]++;
+			if (length > 0.0) {
+				// Area weighted plane of the triangle
+				quadrics[p[k]].add(Quadric::plane(n / length,
+						-glm::dot(n / length, positions[p[0]]), 0.5 * length));
+			}
+		}
+	}
+	
+	// Border edges get a plane perpendicular to their triangle, so that
+	// open borders (the plane meshes, holes) keep their outline
+	for (size_t t = 0; t < triangleCount; t++) {
+		if (!alive[t]) {
+			continue;
+		}
+		uint32_t p[3];
+		for (int k = 0; k < 3; k++) {
+			p[k] = positionOf[triangles[3 * t + k]];
+		}
+		glm::dvec3 n = glm::cross(positions[p[1]] - positions[p[0]],
+								  positions[p[2]] - positions[p[0]]);
+		for (int k = 0; k < 3; k++) {
+			uint32_t a = p[k], b = p[(k + 1) % 3];
+			if (edgeUses[edgeKey(a, b)] != 1) {
+				continue;
+			}
+			glm::dvec3 edge = positions[b] - positions[a];
+			glm::dvec3 side = glm::cross(edge, n);
+			double length = glm::length(side);
+			if (length > 0.0) {
+				Quadric q = Quadric::plane(side / length,
+						-glm::dot(side / length, positions[a]), 10.0 * glm::dot(edge, edge));
+				quadrics[a].add(q);
+				quadrics[b].add(q);
+			}
+		}
+	}
+	
+	struct Collapse {
+		double cost;
+		uint32_t from, to;
+		uint32_t fromVersion, toVersion;
+		bool operator<(const Collapse& other) const {
+			return cost > other.cost;
+		}
+	};
+	std::priority_queue<Collapse> queue;
+	std::vector<uint32_t> version(positionCount, 0);
+	std::vector<bool> collapsed(positionCount, false);
+	
+	auto collapseCost = [&](uint32_t from, uint32_t to) {
+		Quadric q = quadrics[from];
+		q.add(quadrics[to]);
+		return q.error(positions[to]);
+	};
+	auto pushEdges = [&](uint32_t p) {
+		std::vector<uint32_t>& around = trianglesAt[p];
+		around.erase(std::remove_if(around.begin(), around.end(),
+						[&](uint32_t t) { return !alive[t]; }), around.end());
+		for (uint32_t t : around) {
+			for (int k = 0; k < 3; k++) {
+				uint32_t q = positionOf[triangles[3 * t + k]];
+				if (q == p) {
+					continue;
+				}
+				double pq = collapseCost(p, q);
+				double qp = collapseCost(q, p);
+				if (pq <= qp) {
+					queue.push({pq, p, q, version[p], version[q]});
+				} else {
+					queue.push({qp, q, p, version[q], version[p]});
+				}
+			}
+		}
+	};
+	for (uint32_t p = 0; p < positionCount; p++) {
+		pushEdges(p);
+	}
+	
+	// Attribute vertex of the target position closest to the one it replaces
+	auto closestVertex = [&](uint32_t v, uint32_t to) {
+		uint32_t best = verticesAt[to][0];
+		float bestDistance = std::numeric_limits<float>::max();
+		for (uint32_t w : verticesAt[to]) {
+			glm::vec3 dn = vertices[w].norm - vertices[v].norm;
+			glm::vec2 dt = vertices[w].texCoord - vertices[v].texCoord;
+			float distance = glm::dot(dn, dn) + glm::dot(dt, dt);
+			if (distance < bestDistance) {
+				bestDistance = distance;
+				best = w;
+			}
+		}
+		return best;
+	};
+	
+	double maxError = 0.0;
+	while (3 * liveTriangles > targetIndexCount && !queue.empty()) {
+		Collapse c = queue.top();
+		queue.pop();
+		if (collapsed[c.from] || collapsed[c.to] ||
+			version[c.from] != c.fromVersion || version[c.to] != c.toVersion) {
+			continue;
+		}
+		
+		// Moving from onto to must not flip any remaining triangle
+		bool valid = true;
+		for (uint32_t t : trianglesAt[c.from]) {
+			if (!alive[t]) {
+				continue;
+			}
+			glm::dvec3 p[3], moved[3];
+			bool shared = false;
+			for (int k = 0; k < 3; k++) {
+				uint32_t id = positionOf[triangles[3 * t + k]];
+				shared = shared || id == c.to;
+				p[k] = positions[id];
+				moved[k] = id == c.from ? positions[c.to] : p[k];
+			}
+			if (shared) {
+				continue;
+			}
+			glm::dvec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+			glm::dvec3 after = glm::cross(moved[1] - moved[0], moved[2] - moved[0]);
+			if (glm::dot(before, after) <= 0.0) {
+				valid = false;
+				break;
+			}
+		}
+		if (!valid) {
+			continue;
+		}
+		
+		Quadric q = quadrics[c.from];
+		q.add(quadrics[c.to]);
+		if (q.weight > 0.0) {
+			maxError = std::max(maxError, c.cost / q.weight);
+		}
+		quadrics[c.to] = q;
+		collapsed[c.from] = true;
+		
+		for (uint32_t t : trianglesAt[c.from]) {
+			if (!alive[t]) {
+				continue;
+			}
+			bool shared = false;
+			for (int k = 0; k < 3; k++) {
+				shared = shared || positionOf[triangles[3 * t + k]] == c.to;
+			}
+			if (shared) {
+				alive[t] = false;
+				liveTriangles--;
+				continue;
+			}
+			for (int k = 0; k < 3; k++) {
+				uint32_t& v = triangles[3 * t + k];
+				if (positionOf[v] == c.from) {
+					v = closestVertex(v, c.to);
+				}
+			}
+			trianglesAt[c.to].push_back(t);
+		}
+		trianglesAt[c.from].clear();
+		
+		version[c.to]++;
+		pushEdges(c.to);
+	}
+	
+	error = static_cast<float>(std::sqrt(maxError));
+	
+	std::vector<uint32_t> result;
+	result.reserve(3 * liveTriangles);
+	for (size_t t = 0; t < triangleCount; t++) {
+		if (alive[t]) {
+			result.insert(result.end(), triangles.begin() + 3 * t,
+						  triangles.begin() + 3 * t + 3);
+		}
+	}
+	return result;
+}
+
+class BaseProject;
+struct Texture;
+struct DescriptorSet;
+
+// A level of detail of a Model: a range of its index buffer, and the
+// largest distance (in model units) between its surface and the full mesh
+struct LodLevel {
+	uint32_t firstIndex;
+	uint32_t indexCount;
+	float error;
+};
+static_assert(sizeof(LodLevel) == 12, "LodLevel is stored as is in the mesh cache");
+
+// Triangle ratios of the LOD levels built after the full mesh, for
+// meshes of at least LOD_MIN_TRIANGLES triangles
+const float LOD_TRIANGLE_RATIOS[] = {0.5f, 0.25f, 0.1f};
+const size_t LOD_MIN_TRIANGLES = 64;
+// Coarsest screen space error, in pixels, accepted by Model::selectLod
+const float LOD_PIXEL_ERROR = 1.0f;
+
+struct Model {
+	BaseProject *BP;
+	std::vector<Vertex> vertices;
+	std::vector<uint32_t> indices;
+	VkBuffer vertexBuffer;
+	VkDeviceMemory vertexBufferMemory;
+	VkBuffer indexBuffer;
+	VkDeviceMemory indexBufferMemory;
+	// indices is always 32 bit, the index buffer is 16 bit whenever the
+	// vertex count allows it: bind it with indexType
+	VkIndexType indexType = VK_INDEX_TYPE_UINT32;
+	// lods[0] is indices, the coarser levels index lodIndices, which
+	// follows indices in the index buffer
+	std::vector<uint32_t> lodIndices;
+	std::vector<LodLevel> lods;
+	glm::vec3 boundsMin;
+	glm::vec3 boundsMax;
+	// Hash of the source file(s), set by loadModel (see Impostor::bake)
+	uint64_t sourceHash = 0;
+	
+	// Static geometry lives in device local memory (BaseProject::geometry
+	// when it fits), filled through the upload batch. Set dynamic before
+	// init() for meshes rewritten at runtime: their buffers stay host
+	// visible and updateBuffers() copies vertices and indices into them
+	// again.
+	bool dynamic = false;
+	// Set before loadModel to also sort triangles to reduce overdraw
+	// (costs some vertex cache efficiency)
+	bool sortForOverdraw = false;
+	// Layout of the vertex buffer, set before init(). VERTEX_QUANTIZED
+	// meshes must be drawn with a pipeline of the same format, passing
+	// quantizationOffset() / quantizationScale() to the vertex shader.
+	VertexFormat format = VERTEX_FLOAT;
+	// Cooked meshes are read from the bundle first, when it has the file
+	const AssetBundle *bundle = nullptr;
+	// Set by init() when the model went into BaseProject::geometry:
+	// vertexBuffer and indexBuffer are then the pool's, shared with the
+	// other static models, and the model starts at baseVertex and
+	// baseIndex in them (the vertexOffset and firstIndex of its draws)
+	bool pooled = false;
+	int32_t baseVertex = 0;
+	uint32_t baseIndex = 0;
+	
+	void loadModel(std::string file);
+	void optimizeMesh(const std::string& file);
+	void buildLods(const std::string& file);
+	uint32_t selectLod(const glm::mat4& model, const glm::mat4& view,
+					   const glm::mat4& proj, float viewportHeight);
+	// Diameter of the bounding sphere on screen, in pixels
+	float screenSize(const glm::mat4& model, const glm::mat4& view,
+					 const glm::mat4& proj, float viewportHeight);
+	void loadObjTinyobj(std::string file);
+	bool loadMeshCache(const std::string& cacheFile, uint64_t sourceHash);
+	// sourceHash is not checked when null (meshes from the bundle)
+	bool readMeshCache(const char *data, size_t size, const uint64_t *sourceHash);
+	void saveMeshCache(const std::string& cacheFile, uint64_t sourceHash);
+	void createIndexBuffer();
+	void createVertexBuffer();
+	void createGeometryBuffer(const void *data, VkDeviceSize size,
+							  VkBufferUsageFlags usage, VkAccessFlags access,
+							  VkBuffer& buffer, VkDeviceMemory& bufferMemory);
+	void updateBuffers();
+	std::vector<QuantizedVertex> quantizeVertices();
+	std::vector<uint32_t> bufferIndices();
+	std::vector<uint16_t> shortIndices();
+	glm::vec3 quantizationOffset();
+	glm::vec3 quantizationScale();
+
+	// init(bp, file) does both steps; init(bp) only creates the Vulkan
+	// buffers of a model already read with loadModel (e.g. by AssetLoader)
+	void init(BaseProject *bp, std::string file);
+	void init(BaseProject *bp);
+	void cleanup();
+};
+
+enum MipFilter {
+	MIP_FILTER_BOX,		// 2x2 average, like the linear blit
+	MIP_FILTER_KAISER	// Kaiser windowed sinc: sharper distant detail
+};
+
+// Builds the mip chain of an RGBA8 image on the CPU. Filtering works on
+// linear values (sRGB color is converted, alpha is linear), kept as floats
+// from one level to the next, with one texel per SSE2 register. The rows
+// of large levels are split across threads; each level is filtered from
+// the previous one. Borders are clamped, or wrap around for textures
+// sampled with VK_SAMPLER_ADDRESS_MODE_REPEAT across their model.
+struct MipBuilder {
+	// levels receives every level of mips, level 0 being a copy of level0
+	static void build(const uint8_t *level0, const std::vector<TextureMip>& mips,
+					  bool srgb, MipFilter filter, bool wrap, uint8_t *levels);
+	
+	static void boxLevel(const float *src, uint32_t srcWidth, uint32_t srcHeight,
+						 float *dst, uint32_t dstWidth, uint32_t dstHeight, bool wrap);
+	static void kaiserLevel(const float *src, uint32_t srcWidth, uint32_t srcHeight,
+							float *dst, uint32_t dstWidth, uint32_t dstHeight, bool wrap,
+							std::vector<float>& scratch);
+	static void kaiserTaps(uint32_t srcSize, uint32_t dstSize, bool wrap,
+						   std::vector<uint32_t>& indices, std::vector<float>& weights);
+	// Source texel i of a row or column of size texels
+	static uint32_t border(int i, uint32_t size, bool wrap);
+	static void store(const float *linear, uint32_t width, uint32_t height,
+					  bool srgb, uint8_t *out);
+	// Calls work(firstRow, endRow) on as many threads as the texels are worth
+	static void parallelRows(uint32_t rows, uint32_t width,
+							 const std::function<void(uint32_t, uint32_t)>& work);
+	static const float *linearTable();
+	static const uint8_t *srgbTable();
+};
+
+// Levels at most this large are always resident: a streamed texture is
+// usable as soon as they are uploaded
+const uint32_t STREAM_TAIL_SIZE = 64;
+// Seconds between two residency changes: each one records the command
+// buffers again as their images are acquired
+const float STREAM_INTERVAL = 0.1f;
+
+// Streams the mip levels of the textures with Texture::stream in and out
+// of device memory. The image of such a texture only holds its levels
+// from residentLevel on: it starts with the levels up to STREAM_TAIL_SIZE,
+// then gets one more level at a time while the objects using it request
+// more detail (Texture::request, from their size on screen), as long as
+// the streamed textures fit BaseProject::textureBudget. Under pressure,
+// the levels of the textures requesting less than they hold are evicted.
+// A worker thread, started by the first add(), reads the levels (mapped
+// from the texture cache) before they are uploaded. Each change replaces
+// the image of a texture (Texture::replaceImage): only the new level is
+// staged, the resident ones are copied on the GPU. The descriptor sets of
+// each swapchain image switch to the new image when that image is next
+// acquired, and the old image is freed once no image uses it, so nothing
+// waits for the device.
+struct TextureStreamer {
+	// T is to be recreated with its levels from level on
+	struct Job {
+		Texture *T;
+		uint32_t level;
+	};
+	// Image replaced in T, still used by the swapchain images not switched
+	struct Retired {
+		Texture *T;
+		VkImage image;
+		VkDeviceMemory memory;
+		VkImageView view;
+		std::vector<bool> switched;
+	};
+	
+	BaseProject *BP;
+	std::vector<Texture *> textures;
+	std::thread worker;
+	std::mutex mutex;
+	std::condition_variable wake;
+	// Jobs waiting for the worker, being read, and read
+	std::vector<Job> queued, reading, ready;
+	bool stopping = false;
+	std::chrono::steady_clock::time_point lastChange;
+	std::vector<Retired> retired;
+	
+	// Joins the worker when cleanup() was not reached, e.g. after an error
+	~TextureStreamer();
+	void init(BaseProject *bp);
+	void add(Texture *T);
+	void remove(Texture *T);
+	VkDeviceSize residentBytes();
+	// Once per frame, after the requests of the frame, when the previous
+	// frame of currentImage has completed
+	void update(uint32_t currentImage);
+	void apply(const std::vector<Job>& jobs);
+	// Points the sets of currentImage to the new images
+	void switchImages(uint32_t currentImage);
+	void destroy(const Retired& R);
+	void work();
+	// Joins the worker
+	void stop();
+	void cleanup();
+};
+
+// Block compression of texture mips (BCn, 4x4 texel blocks), done once
+// when a texture is cached. The format follows the channel content:
+// - color: BC1 when opaque, BC3 with alpha, BC7 (mode 6) for either when
+//   the texture asks for quality
+// - data (UNORM): BC4 when grayscale (the view replicates red), BC5 when
+//   blue is 0, like color otherwise
+// Index fitting, the inner loop of every encoder, uses SSE2 when available.
+struct BlockCompressor {
+	static VkFormat choose(const uint8_t *rgba, size_t texels, VkFormat format,
+						   bool highQuality);
+	static bool isCompressed(VkFormat format);
+	static VkDeviceSize blockBytes(VkFormat format);
+	static VkDeviceSize levelBytes(VkFormat format, uint32_t width, uint32_t height);
+	// The RGBA8 format a compressed format decodes to
+	static VkFormat decodedFormat(VkFormat format);
+	static VkComponentMapping components(VkFormat format);
+	
+	static void encode(VkFormat format, const uint8_t *rgba,
+					   uint32_t width, uint32_t height, uint8_t *blocks);
+	// Returns what the texture samples as (BC4 gray in RGB), for CPU use
+	// and for devices without BC support. BC7 only in mode 6.
+	static void decode(VkFormat format, const uint8_t *blocks,
+					   uint32_t width, uint32_t height, uint8_t *rgba);
+	
+	// Texels of a block, by channel
+	typedef float Block[4][16];
+	
+	static float fitIndices(const Block& texels, int channels,
+							const float palette[][4], int entries, uint8_t indices[16]);
+	static void fitEndpoints(const Block& texels, int channels, const float weights[],
+							 const uint8_t indices[16], float e0[4], float e1[4]);
+	static void principalRange(const Block& texels, int channels, float e0[4], float e1[4]);
+	static void encodeBC1(const Block& texels, uint8_t *out);
+	static void encodeBC4(const float values[16], uint8_t *out);
+	static void encodeBC7(const Block& texels, uint8_t *out);
+	static void decodeBC1(const uint8_t *in, uint8_t texels[16][4]);
+	static void decodeBC4(const uint8_t *in, uint8_t texels[16][4], int channel);
+	static void decodeBC7(const uint8_t *in, uint8_t texels[16][4]);
+};
+
+struct Texture {
+	BaseProject *BP;
+	uint32_t mipLevels;
+	VkImage textureImage;
+	VkDeviceMemory textureImageMemory;
+	VkImageView textureImageView;
+	VkSampler textureSampler;
+	
+	// Decoded RGBA8 mip chain, kept only until the image is created:
+	// level i starts at pixels + mips[i].offset. It is either mapped from
+	// the texture cache, or built at load time (and then cached).
+	const stbi_uc *pixels = nullptr;
+	std::vector<TextureMip> mips;
+	std::vector<stbi_uc> mipStorage;
+	MappedFile cacheMapping;
+	// Cache decompressed from the bundle (stored ones are used in place)
+	std::vector<char> bundleStorage;
+	int texWidth, texHeight;
+	// Hash of the source file, set by loadImage (see Impostor::bake)
+	uint64_t sourceHash = 0;
+	// Color textures are sRGB, data textures (e.g. normals) UNORM. Set
+	// before loading: mips are filtered accordingly. Images loaded from
+	// files are then block compressed (see BlockCompressor), and format
+	// becomes the BCn format they are stored in.
+	VkFormat format = VK_FORMAT_R8G8B8A8_SRGB;
+	bool compress = true;
+	// BC7 instead of BC1 / BC3, e.g. for text and sharp edges
+	bool highQuality = false;
+	// Filter of the mips built on the CPU (see MipBuilder)
+	MipFilter mipFilter = MIP_FILTER_BOX;
+	// Set for textures tiled across their model (e.g. the sea): the mip
+	// filters wrap around the borders, like the sampler, instead of
+	// clamping them
+	bool wrapMips = false;
+	// Only level 0 is kept, the mips are blitted on the GPU at upload, or
+	// built on the CPU when the format cannot be blitted linearly. Such
+	// textures are neither cached nor compressed.
+	bool gpuMips = false;
+	// Streamed by BaseProject::streamer: the image only holds the levels
+	// from residentLevel on, and the levels read from the file are kept
+	bool stream = false;
+	uint32_t residentLevel = 0;
+	// Finest level requested since the last TextureStreamer::update
+	uint32_t wantedLevel = 0;
+	// Sets sampling the texture, updated when its image is replaced
+	std::vector<DescriptorSet *> sets;
+	// Cooked textures are read from the bundle first, when it has the file
+	const AssetBundle *bundle = nullptr;
+	
+	void loadImage(std::string file);
+	// Takes a copy of RGBA pixels generated by the application (never
+	// compressed)
+	void loadPixels(const uint8_t *rgba, int width, int height);
+	void buildMips(const stbi_uc *level0);
+	void compressMips();
+	void decompressMips();
+	// RGBA8 copy of level 0, whatever format it is stored in
+	std::vector<stbi_uc> level0() const;
+	bool loadTextureCache(const std::string& cacheFile, uint64_t sourceHash);
+	// Points pixels into data, which must outlive them; sourceHash is not
+	// checked when null (textures from the bundle)
+	bool readTextureCache(const char *data, size_t size, const uint64_t *sourceHash);
+	void saveTextureCache(const std::string& cacheFile, uint64_t sourceHash,
+						  VkFormat sourceFormat);
+	void freePixels();
+	// Asks for the detail of an object screenSize pixels wide
+	void request(float screenSize);
+	uint32_t tailLevel();
+	VkDeviceSize levelBytes(uint32_t firstLevel);
+	// Image with the levels from firstLevel on
+	void createTextureImage(uint32_t firstLevel = 0);
+	// Creates a new image with the levels from firstLevel on, in the
+	// upload batch: the levels the current image holds are copied from
+	// it, the others staged. The caller keeps the current image and view,
+	// and frees them once the GPU no longer uses them.
+	void replaceImage(uint32_t firstLevel);
+	void createTextureImageView();
+	void createTextureSampler();
+
+	// init(bp, file) does both steps; init(bp) only creates the Vulkan
+	// objects of an image already decoded with loadImage
+	void init(BaseProject *bp, std::string file);
+	void init(BaseProject *bp);
+	void cleanup();
+};
+
+// Octahedral impostor of a Model: the textured mesh is rasterized on the
+// CPU, at load time (or read from the cache), from frames x frames
+// directions spread over the sphere (octahedral mapping, as for
+// QuantizedVertex normals) into an albedo and an object space normal
+// atlas. Distant objects are then drawn as a quad facing the closest
+// baked direction (shaders/impostor.vert), crossfading with the mesh as
+// their size on screen grows.
+struct Impostor {
+	static const int frames = 8;
+	static const int frameSize = 128;
+	
+	BaseProject *BP;
+	Texture albedo;
+	Texture normals;
+	// Bounding sphere of the model (object space), the quad half size
+	glm::vec3 center;
+	float radius;
+	// Set before bake() to keep the atlases between runs, in the texture
+	// cache format, as <cacheName>.albedo.imp and <cacheName>.normals.imp
+	std::string cacheName;
+	
+	// Needs the CPU data of both: call before T->init()
+	void bake(const Model *M, const Texture *T);
+	void init(BaseProject *bp);
+	void cleanup();
+	
+	// 0: draw the mesh only, 1: draw the impostor only, in between both
+	// with complementary dithering
+	float fade(const glm::mat4& model, const glm::mat4& view,
+			   const glm::mat4& proj, float viewportHeight);
+	// Camera facing quad drawn with shaders/impostor.vert
+	static void buildQuad(Model *M);
+	static void frameBasis(glm::vec3 dir, glm::vec3& right, glm::vec3& up);
+};
+
+// Projected diameters, in pixels, between which impostors fade in
+const float IMPOSTOR_FULL_SIZE = 0.75f * Impostor::frameSize;
+const float IMPOSTOR_FADE_SIZE = 1.0f * Impostor::frameSize;
+
+// Reads and decodes model and texture files on a pool of worker threads.
+// Only the CPU side is done here: once loadAll() returns, call init(bp)
+// on every object from the render thread to create its Vulkan resources.
+struct AssetLoader {
+	std::vector<std::function<void()>> jobs;
+	
+	void add(Model *M, std::string file);
+	void add(Texture *T, std::string file);
+	// Bakes I once M and T have been loaded by a previous loadAll()
+	void add(Impostor *I, const Model *M, const Texture *T);
+	void loadAll();
+};
+
+// Models and textures shared by file path. The first model() / texture()
+// call for a file creates the asset and queues it; later calls return the
+// same object and only take a reference. loadAll() reads the queued files
+// in parallel and initAll() creates their Vulkan objects: in between the
+// decoded data is still available (e.g. for Impostor::bake). Each asset
+// is freed when its last reference is released.
+struct AssetRegistry {
+	template <class T>
+	struct Entry {
+		std::unique_ptr<T> asset;
+		int references = 0;
+		bool loaded = false;
+		bool created = false;
+	};
+	
+	BaseProject *BP;
+	std::unordered_map<std::string, Entry<Model>> models;
+	std::unordered_map<std::string, Entry<Texture>> textures;
+	
+	void init(BaseProject *bp);
+	Model *model(const std::string& file);
+	Texture *texture(const std::string& file);
+	// Adds the files not loaded yet to loader, to run before initAll()
+	void queue(AssetLoader& loader);
+	void loadAll();
+	void initAll();
+	// The GPU must no longer use the asset when its last reference goes
+	void release(Model *M);
+	void release(Texture *T);
+	// Frees the assets that are still referenced
+	void cleanup();
+	
+	template <class T>
+	T *acquire(std::unordered_map<std::string, Entry<T>>& entries, const std::string& file);
+	template <class T>
+	void release(std::unordered_map<std::string, Entry<T>>& entries, T *asset);
+	template <class T>
+	void destroy(Entry<T>& entry);
+};
+
+// Records the transfers of many resources (staging copies, layout
+// transitions, mip blits) into a single batch, submitted once with a
+// fence. Staging buffers are released by collect() only after the fence
+// of the submission that reads them has signaled.
+// When the device has a separate transfer queue family, copies are
+// recorded with beginTransfer() and run on the transfer queue; handOff
+// moves the ownership of each resource to the graphics queue, whose part
+// of the batch (begin(), e.g. mip blits) waits on a semaphore signaled
+// by the transfer part. Otherwise both parts share one command buffer.
+struct UploadBatch {
+	struct Submission {
+		VkCommandBuffer commandBuffer;
+		VkCommandBuffer transferCommandBuffer;
+		VkSemaphore transferDone;
+		VkFence fence;
+		std::vector<VkBuffer> stagingBuffers;
+		std::vector<VkDeviceMemory> stagingBuffersMemory;
+	};
+
+	BaseProject *BP;
+	VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+	VkCommandBuffer transferCommandBuffer = VK_NULL_HANDLE;
+	std::vector<VkBuffer> stagingBuffers;
+	std::vector<VkDeviceMemory> stagingBuffersMemory;
+	std::vector<Submission> pending;
+
+	void init(BaseProject *bp);
+	bool separateTransfer();
+	// Return the command buffer being recorded for the graphics or the
+	// transfer queue, starting a new one if needed
+	VkCommandBuffer begin();
+	VkCommandBuffer beginTransfer();
+	// Creates a host visible buffer filled with data, owned by the batch
+	VkBuffer stage(const void *data, VkDeviceSize size);
+	// Makes the transfer writes to a resource visible to dstAccess on the
+	// graphics queue, transferring its queue family ownership if needed.
+	// Images are also moved from oldLayout to newLayout.
+	void handOff(VkBuffer buffer, VkDeviceSize size,
+				 VkAccessFlags dstAccess, VkPipelineStageFlags dstStage);
+	void handOff(VkImage image, uint32_t mipLevels,
+				 VkImageLayout oldLayout, VkImageLayout newLayout,
+				 VkAccessFlags dstAccess, VkPipelineStageFlags dstStage);
+	void submit();
+	// Frees the submissions whose fence has signaled (all of them if wait)
+	void collect(bool wait);
+	void cleanup();
+	
+	VkCommandBuffer allocate(VkCommandPool pool);
+};
+
+struct DescriptorSetLayoutBinding {
+	uint32_t binding;
+	VkDescriptorType type;
+	VkShaderStageFlags flags;
+};
+
+
+struct DescriptorSetLayout {
+	BaseProject *BP;
+ 	VkDescriptorSetLayout descriptorSetLayout;
+ 	std::vector<DescriptorSetLayoutBinding> layoutBindings;
+ 	
+ 	void init(BaseProject *bp, std::vector<DescriptorSetLayoutBinding> B);
+	void cleanup();
+};
+
+struct Pipeline {
+	BaseProject *BP;
+	VkPipeline graphicsPipeline;
+  	VkPipelineLayout pipelineLayout;
+  	// Set before init(): push constant ranges of the layout (at most
+  	// maxPushConstantsSize bytes, 128 on every device)
+  	std::vector<VkPushConstantRange> pushConstantRanges;
+  	// Set before init() to also read InstanceData from vertex binding 1
+  	bool instanced = false;
+  	
+  	void init(BaseProject *bp, const std::string& VertShader, const std::string& FragShader,
+  			  std::vector<DescriptorSetLayout *> D, VertexFormat format = VERTEX_FLOAT);
+  	VkShaderModule createShaderModule(const std::vector<char>& code);
+  	// From the bundle when given and it has the file
+  	static std::vector<char> readFile(const std::string& filename,
+  									  const AssetBundle *bundle = nullptr);
+	// Records push constants for the following draws, into every range
+	// that overlaps [offset, offset + size)
+	void push(VkCommandBuffer commandBuffer, const void *data, uint32_t size,
+			  uint32_t offset = 0);
+	template <class T>
+	void push(VkCommandBuffer commandBuffer, const T& value, uint32_t offset = 0) {
+		push(commandBuffer, &value, sizeof(T), offset);
+	}
+	void cleanup();
+};
+
+// DYNAMIC_UNIFORM blocks live in BaseProject::uniformRing, for bindings
+// of type VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC
+enum DescriptorSetElementType {UNIFORM, TEXTURE, DYNAMIC_UNIFORM};
+
+struct DescriptorSetElement {
+	int binding;
+	DescriptorSetElementType type;
+	int size;
+	Texture *tex;
+};
+
+// Uniform blocks of many objects in one host visible buffer, bound as
+// VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC. The buffer has a region per
+// swapchain image, used in turn by the frames; each block keeps a slot at
+// the same offset in every region, so the dynamic offset recorded in the
+// command buffers never changes. Mapped once, like the uniform buffers.
+struct UniformRing {
+	BaseProject *BP;
+	VkBuffer buffer = VK_NULL_HANDLE;
+	VkDeviceMemory bufferMemory;
+	char *mapped = nullptr;
+	// minUniformBufferOffsetAlignment of the device
+	VkDeviceSize alignment = 1;
+	VkDeviceSize regionSize = 0;
+	VkDeviceSize used = 0;
+	// Released slots (size, offset), reused by blocks of the same size
+	std::vector<std::pair<VkDeviceSize, uint32_t>> freeSlots;
+	
+	// capacity bytes of blocks per swapchain image
+	void init(BaseProject *bp, VkDeviceSize capacity);
+	// Offset of a slot of size bytes in every region
+	uint32_t allocate(VkDeviceSize size);
+	void release(uint32_t offset, VkDeviceSize size);
+	void *slot(int currentImage, uint32_t offset) {
+		return mapped + regionSize * currentImage + offset;
+	}
+	void cleanup();
+};
+
+// First fit suballocation of the bytes of a buffer
+struct RangeAllocator {
+	VkDeviceSize capacity = 0;
+	// Free ranges (offset, size), sorted by offset
+	std::vector<std::pair<VkDeviceSize, VkDeviceSize>> freeRanges;
+	
+	void init(VkDeviceSize size);
+	// False when no free range fits; the offset is a multiple of alignment
+	bool allocate(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset);
+	void release(VkDeviceSize offset, VkDeviceSize size);
+};
+
+// One device local vertex buffer and one index buffer holding the static
+// models, so that draws of different models bind them once and differ by
+// the vertexOffset and firstIndex of their commands (see Model::pooled).
+// Vertex ranges are aligned to the stride of the model's format and index
+// ranges to its index size: models of both formats and index types share
+// the buffers, their draws only rebind with another index type. Dynamic
+// models, and models that no longer fit, keep buffers of their own.
+struct GeometryPool {
+	BaseProject *BP;
+	VkBuffer vertexBuffer = VK_NULL_HANDLE;
+	VkDeviceMemory vertexBufferMemory;
+	VkBuffer indexBuffer = VK_NULL_HANDLE;
+	VkDeviceMemory indexBufferMemory;
+	RangeAllocator vertexRanges;
+	RangeAllocator indexRanges;
+	
+	// A size of 0 disables the pool
+	void init(BaseProject *bp, VkDeviceSize vertexBytes, VkDeviceSize indexBytes);
+	// Uploads the vertices and indices of M (with its format and
+	// indexType already set) and makes it pooled; false when they do not fit
+	bool add(Model *M);
+	void remove(Model *M);
+	void cleanup();
+	
+	void upload(VkBuffer buffer, VkDeviceSize offset, const void *data,
+				VkDeviceSize size, VkAccessFlags access);
+	static VkDeviceSize stride(const Model *M);
+	static VkDeviceSize indexSize(const Model *M);
+};
+
+struct DescriptorSet {
+	BaseProject *BP;
+
+	std::vector<std::vector<VkBuffer>> uniformBuffers;
+	std::vector<std::vector<VkDeviceMemory>> uniformBuffersMemory;
+	// Uniform buffers stay mapped for the lifetime of the set: the memory
+	// is host coherent, so updates are plain stores
+	std::vector<std::vector<void *>> uniformBuffersMapped;
+	// Slots of the DYNAMIC_UNIFORM elements in BaseProject::uniformRing,
+	// by element, and the dynamic offsets to bind the set with (ordered
+	// by binding)
+	std::vector<uint32_t> ringOffsets;
+	std::vector<uint32_t> dynamicOffsets;
+	std::vector<VkDescriptorSet> descriptorSets;
+	std::vector<DescriptorSetElement> elements;
+	
+	std::vector<bool> toFree;
+
+	void init(BaseProject *bp, DescriptorSetLayout *L,
+		std::vector<DescriptorSetElement> E);
+	// Uniform block at binding for currentImage; throws if the binding is
+	// not a uniform block of at least sizeof(T) bytes. Write it, do not
+	// read it back: the memory may be uncached.
+	template <class T>
+	T *uniform(int currentImage, int binding = 0) {
+		int j = uniformElement(binding, sizeof(T));
+		if (j < 0) {
+			throw std::runtime_error("no uniform block of " + std::to_string(sizeof(T)) +
+									 " bytes at binding " + std::to_string(binding) + "!");
+		}
+		return static_cast<T *>(uniformBuffersMapped[j][currentImage]);
+	}
+	// Element of the uniform block at binding of at least size bytes, -1
+	// if there is none
+	int uniformElement(int binding, size_t size);
+	// Writes the current image view of T in the set of currentImage, e.g.
+	// after streaming: the frame last using that set must have completed
+	void update(Texture *T, int currentImage);
+	void cleanup();
+};
+
+// Indirect draw of an object using a Model with LOD levels. The command
+// buffers are recorded once, so the draw parameters live in one host
+// visible buffer per swapchain image: update() selects the level for the
+// current frame, like the uniform buffers are updated.
+struct LodDraw {
+	BaseProject *BP;
+	Model *M;
+	std::vector<VkBuffer> drawBuffers;
+	std::vector<VkDeviceMemory> drawBuffersMemory;
+	// Mapped once, like the uniform buffers
+	std::vector<VkDrawIndexedIndirectCommand *> drawCommands;
+	// Streamed textures of the object, requested at its size on screen
+	std::vector<Texture *> textures;
+	
+	void init(BaseProject *bp, Model *m, bool visible = true);
+	// Records the draw: the model buffers must already be bound
+	void draw(VkCommandBuffer commandBuffer, int currentImage);
+	// An invisible object is drawn with no instances
+	uint32_t update(int currentImage, const glm::mat4& model,
+					const glm::mat4& view, const glm::mat4& proj,
+					bool visible = true);
+	void setLevel(int currentImage, uint32_t level, bool visible = true);
+	void cleanup();
+};
+
+// Many copies of a Model drawn with an instanced pipeline, at the cost of
+// one indirect draw per LOD level. Each frame the instances are added
+// between begin() and end(), which sorts them by level into the
+// InstanceData buffer of the swapchain image and writes the
+// instanceCount of every level into its draw buffer, so the command
+// buffers are recorded once, like with LodDraw. Each level has a region
+// of capacity instances, bound at its own offset: firstInstance stays 0,
+// as drawIndirectFirstInstance is not enabled.
+struct InstancedDraw {
+	BaseProject *BP;
+	Model *M;
+	uint32_t capacity = 0;
+	std::vector<VkBuffer> instanceBuffers;
+	std::vector<VkDeviceMemory> instanceBuffersMemory;
+	std::vector<InstanceData *> instanceData;
+	// One command per LOD level
+	std::vector<VkBuffer> drawBuffers;
+	std::vector<VkDeviceMemory> drawBuffersMemory;
+	std::vector<VkDrawIndexedIndirectCommand *> drawCommands;
+	// Streamed textures, requested at the size of the largest instance
+	std::vector<Texture *> textures;
+	// Instances added since begin(), and their levels
+	std::vector<InstanceData> pending;
+	std::vector<uint32_t> pendingLevels;
+	
+	void init(BaseProject *bp, Model *m, uint32_t maxInstances);
+	void begin();
+	// Instances beyond capacity are dropped
+	void add(const glm::mat4& model, const glm::mat4& view, const glm::mat4& proj,
+			 float fadeOut = 0.0f);
+	// Returns the number of instances drawn
+	uint32_t end(int currentImage);
+	// Records the draws: the model buffers must already be bound
+	void draw(VkCommandBuffer commandBuffer, int currentImage);
+	void cleanup();
+};
+
+// An object of a Scene: a model drawn with a pipeline and a descriptor
+// set (set 1), or, without a model, a set shared by the pipelines (set 0,
+// e.g. the view and projection matrices). Its LodDraw keeps it hidden
+// until the application shows it, and selects its level of detail.
+struct SceneObject {
+	std::string name;
+	Pipeline *pipeline = nullptr;
+	DescriptorSetLayout *layout = nullptr;
+	Model *model = nullptr;
+	// Set for the quads of impostors, baked from impostorModel/Texture
+	Impostor *impostor = nullptr;
+	Model *impostorModel = nullptr;
+	Texture *impostorTexture = nullptr;
+	// Binding number, and uniform size or texture of each element
+	std::vector<DescriptorSetElement> elements;
+	// Registry paths, acquired when the object is created
+	std::string modelFile;
+	std::vector<std::string> textureFiles;
+	bool lazy = false;
+	bool ready = false;
+	DescriptorSet set;
+	LodDraw lodDraw;
+	// "instances": N in the manifest: drawn by instances instead of
+	// lodDraw, with an instanced pipeline
+	uint32_t instanceCapacity = 0;
+	InstancedDraw instances;
+	// Pushed before its draw when the pipeline declares push constants,
+	// e.g. the model matrix for shaders compiled with -DPUSH_MODEL
+	glm::mat4 transform = glm::mat4(1.0f);
+	
+	// Copies the first uniform block of the set for currentImage
+	void write(int currentImage, const void *data, size_t size);
+	// Uniform block at binding for currentImage, stored to in place.
+	// Throws until the object is created, or when the manifest gives the
+	// binding no uniform block of sizeof(T) bytes.
+	template <class T>
+	T *uniform(int currentImage, int binding = 0) {
+		if (!ready) {
+			throw std::runtime_error("scene: " + name + " is used before it is created!");
+		}
+		int j = set.uniformElement(binding, sizeof(T));
+		if (j < 0) {
+			throw std::runtime_error("scene: " + name + " has no uniform block of " +
+									 std::to_string(sizeof(T)) + " bytes at binding " +
+									 std::to_string(binding) + "!");
+		}
+		return static_cast<T *>(set.uniformBuffersMapped[j][currentImage]);
+	}
+	void show(int currentImage, bool visible);
+};
+
+// Scene described by a JSON manifest (see scene.json): descriptor set
+// layouts, pipelines, models, textures and the objects drawing them, in
+// drawing order. The manifest is read before Vulkan starts, to size the
+// descriptor pool. Objects using a model or texture marked "lazy" are
+// only created, and their files loaded, the first time they are required;
+// prefetch() loads their files in the background beforehand.
+struct Scene {
+	BaseProject *BP;
+	nlohmann::json manifest;
+	// Sizes of the uniform blocks named in the manifest
+	std::unordered_map<std::string, size_t> uniformSizes;
+	std::unordered_map<std::string, std::unique_ptr<DescriptorSetLayout>> layouts;
+	std::unordered_map<std::string, std::unique_ptr<Pipeline>> pipelines;
+	// Set 0 bound with each pipeline
+	std::unordered_map<Pipeline *, SceneObject *> pipelineGlobals;
+	std::vector<std::unique_ptr<SceneObject>> objects;
+	std::vector<std::unique_ptr<Impostor>> impostors;
+	// Manifest entry of each texture file, for configure()
+	std::unordered_map<std::string, nlohmann::json> textureEntries;
+	// Quad shared by the impostors
+	Model impostorQuad;
+	bool hasQuad = false;
+	// Lazy objects whose files prefetching loads, with their textures
+	std::vector<SceneObject *> prefetched;
+	std::vector<std::vector<Texture *>> prefetchedTextures;
+	std::future<void> prefetching;
+	
+	void read(const std::string& file);
+	// Descriptors needed by all the objects, lazy ones included
+	void poolSizes(int& uniformBlocks, int& textures, int& sets);
+	void init(BaseProject *bp, std::unordered_map<std::string, size_t> sizes);
+	SceneObject *object(const std::string& name);
+	// Starts loading the files of lazy objects on a worker thread, for
+	// require() to only create their Vulkan objects
+	void prefetch(std::vector<SceneObject *> lazy);
+	// Creates a lazy object between two frames, after waiting for its
+	// prefetch if any; the command buffers are recorded again as their
+	// images are acquired, without idling the device
+	void require(SceneObject *O);
+	void draw(VkCommandBuffer commandBuffer, int currentImage);
+	void cleanup();
+	
+	void create(std::vector<SceneObject *> created);
+	// The steps of create(): acquire() runs on the render thread, bake()
+	// once the files are loaded, finish() creates the Vulkan objects
+	std::vector<std::vector<Texture *>> acquire(const std::vector<SceneObject *>& created);
+	static void bake(const std::vector<SceneObject *>& created);
+	void finish(const std::vector<SceneObject *>& created,
+				const std::vector<std::vector<Texture *>>& textures);
+	// Creates the prefetched objects, waiting for their files
+	void finishPrefetch();
+	static VkShaderStageFlags stage(const std::string& name);
+	// Options of a manifest texture entry, set before it is loaded:
+	// "quality": "high" (BC7), "filter": "kaiser", "wrap": true (tiled
+	// textures), "stream": true
+	static void configure(Texture *T, const nlohmann::json& entry);
+};
+
+
+// MAIN ! 
+class BaseProject {
+	friend class Model;
+	friend class Texture;
+	friend class Pipeline;
+	friend class DescriptorSetLayout;
+	friend class DescriptorSet;
+	friend class UploadBatch;
+	friend class LodDraw;
+	friend class InstancedDraw;
+	friend class GeometryPool;
+	friend class AssetRegistry;
+	friend class Scene;
+	friend class SceneObject;
+	friend class TextureStreamer;
+	friend class UniformRing;
+public:
+	virtual void setWindowParameters() = 0;
+    void run() {
+    	setWindowParameters();
+        initWindow();
+        initVulkan();
+        mainLoop();
+        cleanup();
+    }
+
+protected:
+	uint32_t windowWidth;
+	uint32_t windowHeight;
+	std::string windowTitle;
+	VkClearColorValue initialBackgroundColor;
+	int uniformBlocksInPool;
+	int texturesInPool;
+	int setsInPool;
+	// Bytes of DYNAMIC_UNIFORM blocks per swapchain image
+	VkDeviceSize uniformRingSize = 64 * 1024;
+	UniformRing uniformRing;
+	// Bytes of vertices and indices of the static models, set before
+	// init(); 0 keeps every model in buffers of its own
+	VkDeviceSize geometryVertexBytes = 8 * 1024 * 1024;
+	VkDeviceSize geometryIndexBytes = 4 * 1024 * 1024;
+	GeometryPool geometry;
+	// The command buffers are normally recorded once. Set this when they
+	// record values of the frame, e.g. push constants: the buffer of each
+	// image is then recorded again after updateUniformBuffer().
+	bool recordEachFrame = false;
+
+	// Lesson 12
+    GLFWwindow* window;
+    VkInstance instance;
+
+    // Lesson 13
+	VkSurfaceKHR surface;
+    VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+	bool textureCompressionBC = false;
+    VkDevice device;
+    VkQueue graphicsQueue;
+    VkQueue presentQueue;
+	VkCommandPool commandPool;
+	// Uploads: transferQueue may be graphicsQueue itself, in which case
+	// transferCommandPool stays VK_NULL_HANDLE
+	VkQueue transferQueue;
+	uint32_t graphicsQueueFamily;
+	uint32_t transferQueueFamily;
+	VkCommandPool transferCommandPool = VK_NULL_HANDLE;
+	std::vector<VkCommandBuffer> commandBuffers;
+	// Set by invalidateCommandBuffers()
+	std::vector<bool> staleCommandBuffers;
+
+    // Lesson 14
+    VkSwapchainKHR swapChain;
+    std::vector<VkImage> swapChainImages;
+	VkFormat swapChainImageFormat;
+	VkExtent2D swapChainExtent;
+	std::vector<VkImageView> swapChainImageViews;
+	
+	// Lesson 19
+	VkRenderPass renderPass;
+	
+ 	VkDescriptorPool descriptorPool;
+
+	// Lesson 22
+	// L22.0 --- Debugging
+	VkDebugUtilsMessengerEXT debugMessenger;
+	
+	// L22.1 --- depth buffer allocation (Z-buffer)
+	VkImage depthImage;
+	VkDeviceMemory depthImageMemory;
+	VkImageView depthImageView;
+
+	// L22.2 --- Frame buffers
+	std::vector<VkFramebuffer> swapChainFramebuffers;
+	size_t currentFrame = 0;
+
+	// L22.3 --- Synchronization objects
+	std::vector<VkSemaphore> imageAvailableSemaphores;
+	std::vector<VkSemaphore> renderFinishedSemaphores;
+	std::vector<VkFence> inFlightFences;
+	std::vector<VkFence> imagesInFlight;
+	
+	// Transfers recorded by the assets, submitted after localInit()
+	UploadBatch uploads;
+	// Shared models and textures, the ones left are freed after localCleanup()
+	AssetRegistry assets;
+	// Mip levels of the streamed textures, within textureBudget bytes
+	TextureStreamer streamer;
+	VkDeviceSize textureBudget = 256ull * 1024 * 1024;
+	// Cooked assets packed by AssetPacker, opened before localInit() when
+	// bundleFile is set; assets it lacks are loaded from their files
+	std::string bundleFile;
+	AssetBundle bundle;
+	
+	// Lesson 12
+    void initWindow() {
+        glfwInit();
+
+        glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+        glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
+
+        window = glfwCreateWindow(windowWidth, windowHeight, windowTitle.c_str(), nullptr, nullptr);
+    }
+
+	virtual void localInit() = 0;
+
+	// Lesson 12
+    void initVulkan() {
+		createInstance();				// L12
+		setupDebugMessenger();			// L22.0
+		createSurface();				// L13
+		pickPhysicalDevice();			// L14
+		createLogicalDevice();			// L14
+		createSwapChain();				// L15
+		createImageViews();				// L15
+		createRenderPass();				// L19
+		createCommandPool();			// L13
+		createDepthResources();			// L22.1
+		createFramebuffers();			// L22.2
+		createDescriptorPool();			// L21
+
+		if (!bundleFile.empty() && !bundle.open(bundleFile)) {
+			std::cout << "No asset bundle " << bundleFile << ", loading the asset files\n";
+		}
+		uploads.init(this);
+		uniformRing.init(this, uniformRingSize);
+		geometry.init(this, geometryVertexBytes, geometryIndexBytes);
+		assets.init(this);
+		streamer.init(this);
+		localInit();
+		uploads.submit();
+
+		createCommandBuffers();			// L22.5 (13)
+		createSyncObjects();			// L22.3 
+    }
+
+	// Lesson 12 and 22.0
+    void createInstance() {
+    	VkApplicationInfo appInfo{};
+       	appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+    	appInfo.pApplicationName = windowTitle.c_str();
+    	appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
+    	appInfo.pEngineName = "No Engine";
+    	appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
+		appInfo.apiVersion = VK_API_VERSION_1_0;
+		
+		VkInstanceCreateInfo createInfo{};
+		createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+		createInfo.pApplicationInfo = &appInfo;
+
+		uint32_t glfwExtensionCount = 0;
+		const char** glfwExtensions;
+		glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+				
+		createInfo.enabledExtensionCount = glfwExtensionCount;
+		createInfo.ppEnabledExtensionNames = glfwExtensions;
+
+		createInfo.enabledLayerCount = 0;
+
+		auto extensions = getRequiredExtensions();
+		createInfo.enabledExtensionCount =
+			static_cast<uint32_t>(extensions.size());
+		createInfo.ppEnabledExtensionNames = extensions.data();		
+		
+		// For debugging [Lesson 22] - Start
+		if (!checkValidationLayerSupport()) {
+			throw std::runtime_error("validation layers requested, but not available!");
+		}
+
+		VkDebugUtilsMessengerCreateInfoEXT debugCreateInfo;
+			createInfo.enabledLayerCount =
+				static_cast<uint32_t>(validationLayers.size());
+			createInfo.ppEnabledLayerNames = validationLayers.data();
+			
+			populateDebugMessengerCreateInfo(debugCreateInfo);
+			createInfo.pNext = (VkDebugUtilsMessengerCreateInfoEXT*)
+									&debugCreateInfo;
+		// For debugging [Lesson 22] - End
+		
+		VkResult result = vkCreateInstance(&createInfo, nullptr, &instance);
+		
+		if(result != VK_SUCCESS) {
+		 	PrintVkError(result);
+			throw std::runtime_error("failed to create instance!");
+		}
+    }
+    
+    // Lesson 12 and L22.0
+    std::vector<const char*> getRequiredExtensions() {
+		uint32_t glfwExtensionCount = 0;
+		const char** glfwExtensions;
+		glfwExtensions =
+			glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+
+		std::vector<const char*> extensions(glfwExtensions,
+			glfwExtensions + glfwExtensionCount);
+			extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
+		
+		return extensions;
+	}
+	
+	// Lesson 22.0 - debug support
+	bool checkValidationLayerSupport() {
+		uint32_t layerCount;
+		vkEnumerateInstanceLayerProperties(&layerCount, nullptr);
+
+		std::vector<VkLayerProperties> availableLayers(layerCount);
+		vkEnumerateInstanceLayerProperties(&layerCount,
+					availableLayers.data());
+
+		for (const char* layerName : validationLayers) {
+			bool layerFound = false;
+			
+			for (const auto& layerProperties : availableLayers) {
+				if (strcmp(layerName, layerProperties.layerName) == 0) {
+					layerFound = true;
+					break;
+				}
+			}
+		
+			if (!layerFound) {
+				return false;
+			}
+		}
+		
+		return true;    
+	}
+
+	// Lesson 22.0 - debug support
+    void populateDebugMessengerCreateInfo(
+    		VkDebugUtilsMessengerCreateInfoEXT& createInfo) {
+    	createInfo = {};
+		createInfo.sType =
+			VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT;
+		createInfo.messageSeverity =
+			VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT |
+			VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT |
+			VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT;
+		createInfo.messageType = VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT |
+			VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT |
+			VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT;
+		createInfo.pfnUserCallback = debugCallback;
+		createInfo.pUserData = nullptr;
+    }
+
+	// Lesson 22.0 - debug support
+	static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
+		VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
+		VkDebugUtilsMessageTypeFlagsEXT messageType,
+		const VkDebugUtilsMessengerCallbackDataEXT* pCallbackData, void* pUserData) {
+
+		std::cerr << "validation layer: " << pCallbackData->pMessage << std::endl;		
+		return VK_FALSE;
+	}
+
+	// Lesson 22.0 - debug support
+	void setupDebugMessenger() {
+
+		VkDebugUtilsMessengerCreateInfoEXT createInfo{};
+		populateDebugMessengerCreateInfo(createInfo);
+		
+		if (CreateDebugUtilsMessengerEXT(instance, &createInfo, nullptr,
+				&debugMessenger) != VK_SUCCESS) {
+			throw std::runtime_error("failed to set up debug messenger!");
+		}
+	}
+
+	// Lesson 13
+    void createSurface() {
+    	if (glfwCreateWindowSurface(instance, window, nullptr, &surface)
+    			!= VK_SUCCESS) {
+			throw std::runtime_error("failed to create window surface!");
+		}
+    }
+
+	// Lesson 13
+    void pickPhysicalDevice() {
+    	uint32_t deviceCount = 0;
+    	vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr);
+    	 
+    	if (deviceCount == 0) {
+			throw std::runtime_error("failed to find GPUs with Vulkan support!");
+		}
+		
+		std::vector<VkPhysicalDevice> devices(deviceCount);
+		vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data());
+		
+		std::cout << "Physical devices found: " << deviceCount << "\n";
+		
+		for (const auto& device : devices) {
+			if (isDeviceSuitable(device)) {
+				physicalDevice = device;
+				break;
+			}
+		}
+		
+		if (physicalDevice == VK_NULL_HANDLE) {
+			throw std::runtime_error("failed to find a suitable GPU!");
+		}
+    }
+
+	// Lesson 13
+    bool isDeviceSuitable(VkPhysicalDevice device) {
+ 		QueueFamilyIndices indices = findQueueFamilies(device);
+
+		bool extensionsSupported = checkDeviceExtensionSupport(device);
+
+		bool swapChainAdequate = false;
+		if (extensionsSupported) {
+			SwapChainSupportDetails swapChainSupport = querySwapChainSupport(device);
+			swapChainAdequate = !swapChainSupport.formats.empty() &&
+								!swapChainSupport.presentModes.empty();
+		}
+		
+		VkPhysicalDeviceFeatures supportedFeatures;
+		vkGetPhysicalDeviceFeatures(device, &supportedFeatures);
+		
+		return indices.isComplete() && extensionsSupported && swapChainAdequate &&
+						supportedFeatures.samplerAnisotropy;
+	}
+    
+    // Lesson 13
+    QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device) {
+		QueueFamilyIndices indices;
+		
+		uint32_t queueFamilyCount = 0;
+		vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount,
+						nullptr);
+
+		std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+		vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount,
+								queueFamilies.data());
+								
+		int i=0;
+		for (const auto& queueFamily : queueFamilies) {
+			if (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) {
+				indices.graphicsFamily = i;
+			}
+				
+			VkBool32 presentSupport = false;
+			vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface,
+												 &presentSupport);
+			if (presentSupport) {
+			 	indices.presentFamily = i;
+			}
+
+			if (indices.isComplete()) {
+				break;
+			}			
+			i++;
+		}
+		
+		int transferScore = -1;
+		for (uint32_t j = 0; j < queueFamilyCount; j++) {
+			VkQueueFlags flags = queueFamilies[j].queueFlags;
+			if (!(flags & (VK_QUEUE_TRANSFER_BIT | VK_QUEUE_GRAPHICS_BIT |
+						   VK_QUEUE_COMPUTE_BIT))) {
+				continue;
+			}
+			int score = (j == indices.graphicsFamily) ? 0 :
+						(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)) ? 1 : 2;
+			if (score > transferScore) {
+				transferScore = score;
+				indices.transferFamily = j;
+			}
+		}
+
+		return indices;
+	}
+
+	// Lesson 13
+	bool checkDeviceExtensionSupport(VkPhysicalDevice device) {
+		uint32_t extensionCount;
+		vkEnumerateDeviceExtensionProperties(device, nullptr,
+					&extensionCount, nullptr);
+					
+		std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+		vkEnumerateDeviceExtensionProperties(device, nullptr,
+					&extensionCount, availableExtensions.data());
+					
+		std::set<std::string> requiredExtensions(deviceExtensions.begin(),
+					deviceExtensions.end());
+					
+		for (const auto& extension : availableExtensions){
+			requiredExtensions.erase(extension.extensionName);
+		}
+
+		return requiredExtensions.empty();
+	}
+
+	// Lesson 14
+	SwapChainSupportDetails querySwapChainSupport(VkPhysicalDevice device) {
+		SwapChainSupportDetails details;
+		
+		 vkGetPhysicalDeviceSurfaceCapabilitiesKHR(device, surface,
+		 		&details.capabilities);
+
+		uint32_t formatCount;
+		vkGetPhysicalDeviceSurfaceFormatsKHR(device, surface, &formatCount,
+				nullptr);
+				
+		if (formatCount != 0) {
+			details.formats.resize(formatCount);
+			vkGetPhysicalDeviceSurfaceFormatsKHR(device, surface,
+					&formatCount, details.formats.data());
+		}
+		
+		uint32_t presentModeCount;
+		vkGetPhysicalDeviceSurfacePresentModesKHR(device, surface,
+			&presentModeCount, nullptr);
+		
+		if (presentModeCount != 0) {
+			details.presentModes.resize(presentModeCount);
+			vkGetPhysicalDeviceSurfacePresentModesKHR(device, surface,
+					&presentModeCount, details.presentModes.data());
+		}
+		 
+		return details;
+	}
+
+	// Lesson 13
+	void createLogicalDevice() {
+		QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
+		
+		std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
+		std::set<uint32_t> uniqueQueueFamilies =
+				{indices.graphicsFamily.value(), indices.presentFamily.value(),
+				 indices.transferFamily.value()};
+		
+		float queuePriority = 1.0f;
+		for (uint32_t queueFamily : uniqueQueueFamilies) {
+			VkDeviceQueueCreateInfo queueCreateInfo{};
+			queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+			queueCreateInfo.queueFamilyIndex = queueFamily;
+			queueCreateInfo.queueCount = 1;
+			queueCreateInfo.pQueuePriorities = &queuePriority;
+			queueCreateInfos.push_back(queueCreateInfo);
+		}
+		
+		VkPhysicalDeviceFeatures supportedFeatures;
+		vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+		textureCompressionBC = supportedFeatures.textureCompressionBC == VK_TRUE;
+		
+		VkPhysicalDeviceFeatures deviceFeatures{};
+		deviceFeatures.samplerAnisotropy = VK_TRUE;
+		// Optional: BC textures are decompressed at upload without it
+		deviceFeatures.textureCompressionBC = supportedFeatures.textureCompressionBC;
+		
+		VkDeviceCreateInfo createInfo{};
+		createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+		
+		createInfo.pQueueCreateInfos = queueCreateInfos.data();
+		createInfo.queueCreateInfoCount = 
+			static_cast<uint32_t>(queueCreateInfos.size());
+		
+		createInfo.pEnabledFeatures = &deviceFeatures;
+		createInfo.enabledExtensionCount =
+				static_cast<uint32_t>(deviceExtensions.size());
+		createInfo.ppEnabledExtensionNames = deviceExtensions.data();
+
+			createInfo.enabledLayerCount = 
+					static_cast<uint32_t>(validationLayers.size());
+			createInfo.ppEnabledLayerNames = validationLayers.data();
+		
+		VkResult result = vkCreateDevice(physicalDevice, &createInfo, nullptr, &device);
+		
+		if (result != VK_SUCCESS) {
+		 	PrintVkError(result);
+			throw std::runtime_error("failed to create logical device!");
+		}
+		
+		vkGetDeviceQueue(device, indices.graphicsFamily.value(), 0, &graphicsQueue);
+		vkGetDeviceQueue(device, indices.presentFamily.value(), 0, &presentQueue);
+		vkGetDeviceQueue(device, indices.transferFamily.value(), 0, &transferQueue);
+		graphicsQueueFamily = indices.graphicsFamily.value();
+		transferQueueFamily = indices.transferFamily.value();
+	}
+	
+	// Lesson 14
+	void createSwapChain() {
+		SwapChainSupportDetails swapChainSupport =
+				querySwapChainSupport(physicalDevice);
+		VkSurfaceFormatKHR surfaceFormat =
+				chooseSwapSurfaceFormat(swapChainSupport.formats);
+		VkPresentModeKHR presentMode =
+				chooseSwapPresentMode(swapChainSupport.presentModes);
+		VkExtent2D extent = chooseSwapExtent(swapChainSupport.capabilities);
+		
+		uint32_t imageCount = swapChainSupport.capabilities.minImageCount + 1;
+		
+		if (swapChainSupport.capabilities.maxImageCount > 0 &&
+				imageCount > swapChainSupport.capabilities.maxImageCount) {
+			imageCount = swapChainSupport.capabilities.maxImageCount;
+		}
+		
+		VkSwapchainCreateInfoKHR createInfo{};
+		createInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
+		createInfo.surface = surface;
+		createInfo.minImageCount = imageCount;
+		createInfo.imageFormat = surfaceFormat.format;
+		createInfo.imageColorSpace = surfaceFormat.colorSpace;
+		createInfo.imageExtent = extent;
+		createInfo.imageArrayLayers = 1;
+		createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+		
+		QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
+		uint32_t queueFamilyIndices[] = {indices.graphicsFamily.value(),
+										 indices.presentFamily.value()};
+		if (indices.graphicsFamily != indices.presentFamily) {
+			createInfo.imageSharingMode = VK_SHARING_MODE_CONCURRENT;
+			createInfo.queueFamilyIndexCount = 2;
+			createInfo.pQueueFamilyIndices = queueFamilyIndices;
+		} else {
+			createInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
+			createInfo.queueFamilyIndexCount = 0; // Optional
+			createInfo.pQueueFamilyIndices = nullptr; // Optional
+		}
+		
+		 createInfo.preTransform = swapChainSupport.capabilities.currentTransform;
+		 createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
+		 createInfo.presentMode = presentMode;
+		 createInfo.clipped = VK_TRUE;
+		 createInfo.oldSwapchain = VK_NULL_HANDLE;
+		 
+		 VkResult result = vkCreateSwapchainKHR(device, &createInfo, nullptr, &swapChain);
+		 if (result != VK_SUCCESS) {
+		 	PrintVkError(result);
+			throw std::runtime_error("failed to create swap chain!");
+		}
+		
+		vkGetSwapchainImagesKHR(device, swapChain, &imageCount, nullptr);
+		swapChainImages.resize(imageCount);
+		vkGetSwapchainImagesKHR(device, swapChain, &imageCount,
+				swapChainImages.data());
+				
+		swapChainImageFormat = surfaceFormat.format;
+		swapChainExtent = extent;
+	}
+
+	// Lesson 14
+	VkSurfaceFormatKHR chooseSwapSurfaceFormat(
+				const std::vector<VkSurfaceFormatKHR>& availableFormats)
+	{
+		for (const auto& availableFormat : availableFormats) {
+			if (availableFormat.format == VK_FORMAT_B8G8R8A8_SRGB &&
+				availableFormat.colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR) {
+				return availableFormat;
+			}
+		}
+		
+		return availableFormats[0];
+	}
+
+	// Lesson 14
+	VkPresentModeKHR chooseSwapPresentMode(
+			const std::vector<VkPresentModeKHR>& availablePresentModes) {
+		for (const auto& availablePresentMode : availablePresentModes) {
+			if (availablePresentMode == VK_PRESENT_MODE_MAILBOX_KHR) {
+				return availablePresentMode;
+			}
+		}
+		return VK_PRESENT_MODE_FIFO_KHR;
+	}
+	
+	// Lesson 14
+	VkExtent2D chooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilities) {
+		if (capabilities.currentExtent.width != UINT32_MAX) {
 			return capabilities.currentExtent;
 		} else {
 			int width, height;
 			glfwGetFramebufferSize(window, &width, &height);
 			
-			VkExtent2D actualExtent = {
-				static_cast<uint32_t>(width),
-				static_cast<uint32_t>(height)
+			VkExtent2D actualExtent = {
+				static_cast<uint32_t>(width),
+				static_cast<uint32_t>(height)
+			};
+			actualExtent.width = std::max(capabilities.minImageExtent.width,
+					std::min(capabilities.maxImageExtent.width, actualExtent.width));
+			actualExtent.height = std::max(capabilities.minImageExtent.height,
+					std::min(capabilities.maxImageExtent.height, actualExtent.height));
+			return actualExtent;
+		}
+	}
+
+	// Lesson 14
+	void createImageViews() {
+		swapChainImageViews.resize(swapChainImages.size());
+		
+		for (size_t i = 0; i < swapChainImages.size(); i++) {
+			swapChainImageViews[i] = createImageView(swapChainImages[i],
+													 swapChainImageFormat,
+													 VK_IMAGE_ASPECT_COLOR_BIT, 1);
+		}
+	}
+	
+	// Lesson 14
+	VkImageView createImageView(VkImage image, VkFormat format,
+								VkImageAspectFlags aspectFlags,
+								uint32_t mipLevels, // New in Lesson 23
+								VkComponentMapping components = {}
+								) {
+		VkImageViewCreateInfo viewInfo{};
+		viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+		viewInfo.image = image;
+		viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		viewInfo.format = format;
+		viewInfo.components = components;
+		viewInfo.subresourceRange.aspectMask = aspectFlags;
+		viewInfo.subresourceRange.baseMipLevel = 0;
+		viewInfo.subresourceRange.levelCount = mipLevels;
+		viewInfo.subresourceRange.baseArrayLayer = 0;
+		viewInfo.subresourceRange.layerCount = 1;
+		VkImageView imageView;
+
+		VkResult result = vkCreateImageView(device, &viewInfo, nullptr,
+				&imageView);
+		if (result != VK_SUCCESS) {
+		 	PrintVkError(result);
+			throw std::runtime_error("failed to create image view!");
+		}
+		return imageView;
+	}
+	
+	// Lesson 19
+    void createRenderPass() {
+		VkAttachmentDescription depthAttachment{};
+		depthAttachment.format = VK_FORMAT_D32_SFLOAT;
+		depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+		depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+		depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+		depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		depthAttachment.finalLayout =
+						VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+		VkAttachmentReference depthAttachmentRef{};
+		depthAttachmentRef.attachment = 1;
+		depthAttachmentRef.layout = 
+						VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+    	VkAttachmentDescription colorAttachment{};
+		colorAttachment.format = swapChainImageFormat;
+		colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+		colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+		colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+		colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+		colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+		
+		VkAttachmentReference colorAttachmentRef{};
+		colorAttachmentRef.attachment = 0;
+		colorAttachmentRef.layout =
+				VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+		
+		VkSubpassDescription subpass{};
+		subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+		subpass.colorAttachmentCount = 1;
+		subpass.pColorAttachments = &colorAttachmentRef;
+		subpass.pDepthStencilAttachment = &depthAttachmentRef;
+		
+		VkSubpassDependency dependency{};
+		dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+		dependency.dstSubpass = 0;
+		dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+		dependency.srcAccessMask = 0;
+		dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+		dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+
+		std::array<VkAttachmentDescription, 2> attachments =
+								{colorAttachment, depthAttachment};
+
+		VkRenderPassCreateInfo renderPassInfo{};
+		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+		renderPassInfo.attachmentCount = static_cast<uint32_t>(attachments.size());;
+		renderPassInfo.pAttachments = attachments.data();
+		renderPassInfo.subpassCount = 1;
+		renderPassInfo.pSubpasses = &subpass;
+		renderPassInfo.dependencyCount = 1;
+		renderPassInfo.pDependencies = &dependency;
+
+		VkResult result = vkCreateRenderPass(device, &renderPassInfo, nullptr,
+					&renderPass);
+		if (result != VK_SUCCESS) {
+		 	PrintVkError(result);
+			throw std::runtime_error("failed to create render pass!");
+		}		
+	}
+
+	// Lesson 22.2 
+    void createFramebuffers() {
+		swapChainFramebuffers.resize(swapChainImageViews.size());
+		for (size_t i = 0; i < swapChainImageViews.size(); i++) {
+			std::array<VkImageView, 2> attachments = {
+				swapChainImageViews[i],
+				depthImageView
+			};
+
+			VkFramebufferCreateInfo framebufferInfo{};
+			framebufferInfo.sType =
+				VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+			framebufferInfo.renderPass = renderPass;
+			framebufferInfo.attachmentCount =
+							static_cast<uint32_t>(attachments.size());;
+			framebufferInfo.pAttachments = attachments.data();
+			framebufferInfo.width = swapChainExtent.width; 
+			framebufferInfo.height = swapChainExtent.height;
+			framebufferInfo.layers = 1;
+			
+			VkResult result = vkCreateFramebuffer(device, &framebufferInfo, nullptr,
+						&swapChainFramebuffers[i]);
+			if (result != VK_SUCCESS) {
+			 	PrintVkError(result);
+				throw std::runtime_error("failed to create framebuffer!");
+			}
+		}
+	}
+
+	// Lesson 13
+    void createCommandPool() {
+    	QueueFamilyIndices queueFamilyIndices = 
+    			findQueueFamilies(physicalDevice);
+    			
+		VkCommandPoolCreateInfo poolInfo{};
+		poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+		poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
+		// The command buffer of an image is recorded again when
+		// recordEachFrame is set
+		poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+		
+		VkResult result = vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool);
+		if (result != VK_SUCCESS) {
+		 	PrintVkError(result);
+			throw std::runtime_error("failed to create command pool!");
+		}
+		
+		if (transferQueueFamily != graphicsQueueFamily) {
+			poolInfo.queueFamilyIndex = transferQueueFamily;
+			result = vkCreateCommandPool(device, &poolInfo, nullptr,
+										 &transferCommandPool);
+			if (result != VK_SUCCESS) {
+			 	PrintVkError(result);
+				throw std::runtime_error("failed to create transfer command pool!");
+			}
+		}
+	}
+
+	// Lesson 22.1
+	void createDepthResources() {
+		VkFormat depthFormat = VK_FORMAT_D32_SFLOAT;
+		
+		createImage(swapChainExtent.width, swapChainExtent.height, 1, depthFormat,
+					VK_IMAGE_TILING_OPTIMAL,
+					VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
+					VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+					depthImage, depthImageMemory);
+		depthImageView = createImageView(depthImage, depthFormat,
+										 VK_IMAGE_ASPECT_DEPTH_BIT, 1);
+	}
+
+	// Lesson 22.1
+	void createImage(uint32_t width, uint32_t height,
+					 uint32_t mipLevels, // New in Lesson 23
+					 VkFormat format,
+				 	 VkImageTiling tiling, VkImageUsageFlags usage,
+				 	 VkMemoryPropertyFlags properties, VkImage& image,
+				 	 VkDeviceMemory& imageMemory) {		
+		VkImageCreateInfo imageInfo{};
+		imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+		imageInfo.imageType = VK_IMAGE_TYPE_2D;
+		imageInfo.extent.width = width;
+		imageInfo.extent.height = height;
+		imageInfo.extent.depth = 1;
+		imageInfo.mipLevels = mipLevels;
+		imageInfo.arrayLayers = 1;
+		imageInfo.format = format;
+		imageInfo.tiling = tiling;
+		imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		imageInfo.usage = usage;
+		imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+		imageInfo.flags = 0; // Optional
+		
+		VkResult result = vkCreateImage(device, &imageInfo, nullptr, &image);
+		if (result != VK_SUCCESS) {
+		 	PrintVkError(result);
+		 	throw std::runtime_error("failed to create image!");
+		}
+		
+		VkMemoryRequirements memRequirements;
+		vkGetImageMemoryRequirements(device, image, &memRequirements);
+
+		VkMemoryAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+		allocInfo.allocationSize = memRequirements.size;
+		allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits,
+											properties);
+		if (vkAllocateMemory(device, &allocInfo, nullptr, &imageMemory) !=
+								VK_SUCCESS) {
+			throw std::runtime_error("failed to allocate image memory!");
+		}
+
+		vkBindImageMemory(device, image, imageMemory, 0);
+	}
+
+	// Textures whose format fails this get their mips from MipBuilder
+	bool linearBlitSupported(VkFormat imageFormat) {
+		VkFormatProperties formatProperties;
+		vkGetPhysicalDeviceFormatProperties(physicalDevice, imageFormat,
+							&formatProperties);
+		return (formatProperties.optimalTilingFeatures &
+					VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT) != 0;
+	}
+	
+	// New - Lesson 23
+	void generateMipmaps(VkCommandBuffer commandBuffer,
+						 VkImage image, VkFormat imageFormat,
+						 int32_t texWidth, int32_t texHeight,
+						 uint32_t mipLevels) {
+		if (!linearBlitSupported(imageFormat)) {
+			throw std::runtime_error("texture image format does not support linear blitting!");
+		}
+
+		VkImageMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.image = image;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		barrier.subresourceRange.baseArrayLayer = 0;
+		barrier.subresourceRange.layerCount = 1;
+		barrier.subresourceRange.levelCount = 1;
+
+		int32_t mipWidth = texWidth;
+		int32_t mipHeight = texHeight;
+
+		for (uint32_t i = 1; i < mipLevels; i++) { 
+			barrier.subresourceRange.baseMipLevel = i - 1;
+			barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+			barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+			barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+			
+			vkCmdPipelineBarrier(commandBuffer,
+								 VK_PIPELINE_STAGE_TRANSFER_BIT,
+								 VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+								 0, nullptr, 0, nullptr,
+								 1, &barrier);
+
+			VkImageBlit blit{};
+			blit.srcOffsets[0] = { 0, 0, 0 };
+			blit.srcOffsets[1] = { mipWidth, mipHeight, 1 };
+			blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			blit.srcSubresource.mipLevel = i - 1;
+			blit.srcSubresource.baseArrayLayer = 0;
+			blit.srcSubresource.layerCount = 1;
+			blit.dstOffsets[0] = { 0, 0, 0 };
+			blit.dstOffsets[1] = { mipWidth > 1 ? mipWidth / 2 : 1,
+								   mipHeight > 1 ? mipHeight/2:1, 1};
+			blit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			blit.dstSubresource.mipLevel = i;
+			blit.dstSubresource.baseArrayLayer = 0;
+			blit.dstSubresource.layerCount = 1;
+			
+			vkCmdBlitImage(commandBuffer, image,
+						   VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+						   image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1,
+						   &blit, VK_FILTER_LINEAR);
+
+			barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+			barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+			barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+			barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+			
+			vkCmdPipelineBarrier(commandBuffer,
+								 VK_PIPELINE_STAGE_TRANSFER_BIT,
+								 VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+								 0, nullptr, 0, nullptr,
+								 1, &barrier);
+			if (mipWidth > 1) mipWidth /= 2;
+			if (mipHeight > 1) mipHeight /= 2;
+		}
+
+		barrier.subresourceRange.baseMipLevel = mipLevels - 1;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		vkCmdPipelineBarrier(commandBuffer,
+							 VK_PIPELINE_STAGE_TRANSFER_BIT,
+							 VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+							 0, nullptr, 0, nullptr,
+							 1, &barrier);
+	}
+	
+	// New - Lesson 23
+	void transitionImageLayout(VkCommandBuffer commandBuffer,
+					VkImage image, VkFormat format,
+					VkImageLayout oldLayout, VkImageLayout newLayout,
+					uint32_t mipLevels) {
+		VkImageMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.oldLayout = oldLayout;
+		barrier.newLayout = newLayout;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.image = image;
+		
+		barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		barrier.subresourceRange.baseMipLevel = 0;
+		barrier.subresourceRange.levelCount = mipLevels;
+		barrier.subresourceRange.baseArrayLayer = 0;
+		barrier.subresourceRange.layerCount = 1;
+
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+		vkCmdPipelineBarrier(commandBuffer,
+								VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+								VK_ACCESS_TRANSFER_WRITE_BIT, 0,
+								0, nullptr, 0, nullptr, 1, &barrier);
+	}
+	
+	// New - Lesson 23
+	void copyBufferToImage(VkCommandBuffer commandBuffer,
+						   VkBuffer buffer, VkImage image, uint32_t
+						   width, uint32_t height) {
+		VkBufferImageCopy region{};
+		region.bufferOffset = 0;
+		region.bufferRowLength = 0;
+		region.bufferImageHeight = 0;
+		region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		region.imageSubresource.mipLevel = 0;
+		region.imageSubresource.baseArrayLayer = 0;
+		region.imageSubresource.layerCount = 1;
+		region.imageOffset = {0, 0, 0};
+		region.imageExtent = {width, height, 1};
+		
+		vkCmdCopyBufferToImage(commandBuffer, buffer, image,
+				VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+	}
+	
+	void copyBuffer(VkCommandBuffer commandBuffer, VkBuffer srcBuffer,
+					VkBuffer dstBuffer, VkDeviceSize size) {
+		VkBufferCopy copyRegion{};
+		copyRegion.srcOffset = 0;
+		copyRegion.dstOffset = 0;
+		copyRegion.size = size;
+		vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
+	}
+
+	// Lesson 22.4
+	
+	// Lesson 21
+	void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage,
+					  VkMemoryPropertyFlags properties,
+					  VkBuffer& buffer, VkDeviceMemory& bufferMemory) {
+		VkBufferCreateInfo bufferInfo{};
+		bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+		bufferInfo.size = size;
+		bufferInfo.usage = usage;
+		bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		
+		VkResult result =
+				vkCreateBuffer(device, &bufferInfo, nullptr, &buffer);
+		if (result != VK_SUCCESS) {
+		 	PrintVkError(result);
+			throw std::runtime_error("failed to create vertex buffer!");
+		}
+		
+		VkMemoryRequirements memRequirements;
+		vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
+		
+		VkMemoryAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+		allocInfo.allocationSize = memRequirements.size;
+		allocInfo.memoryTypeIndex =
+				findMemoryType(memRequirements.memoryTypeBits, properties);
+
+		result = vkAllocateMemory(device, &allocInfo, nullptr,
+				&bufferMemory);
+		if (result != VK_SUCCESS) {
+		 	PrintVkError(result);
+			throw std::runtime_error("failed to allocate vertex buffer memory!");
+		}
+		
+		vkBindBufferMemory(device, buffer, bufferMemory, 0);	
+	}
+	
+	// Lesson 21
+	uint32_t findMemoryType(uint32_t typeFilter,
+							VkMemoryPropertyFlags properties) {
+		 VkPhysicalDeviceMemoryProperties memProperties;
+		 vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+		 
+		 for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
+		 	if ((typeFilter & (1 << i)) && 
+		 		(memProperties.memoryTypes[i].propertyFlags & properties) ==
+		 				properties) {
+				return i;
+			}
+		}
+		
+		throw std::runtime_error("failed to find suitable memory type!");
+	}
+    
+    // Lesson 21
+	void createDescriptorPool() {
+		std::array<VkDescriptorPoolSize, 3> poolSizes{};
+		poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+		poolSizes[0].descriptorCount = static_cast<uint32_t>(uniformBlocksInPool *
+															 swapChainImages.size());
+		// New - Lesson 23
+		poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		poolSizes[1].descriptorCount = static_cast<uint32_t>(texturesInPool *
+															 swapChainImages.size());
+		//
+		// Uniform blocks may be of either kind
+		poolSizes[2].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+		poolSizes[2].descriptorCount = poolSizes[0].descriptorCount;
+
+		VkDescriptorPoolCreateInfo poolInfo{};
+		poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+		poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());;
+		poolInfo.pPoolSizes = poolSizes.data();
+		poolInfo.maxSets = static_cast<uint32_t>(setsInPool * swapChainImages.size());
+		
+		VkResult result = vkCreateDescriptorPool(device, &poolInfo, nullptr,
+									&descriptorPool);
+		if (result != VK_SUCCESS) {
+		 	PrintVkError(result);
+			throw std::runtime_error("failed to create descriptor pool!");
+		}
+	}
+	
+	virtual void populateCommandBuffer(VkCommandBuffer commandBuffer, int i) = 0;
+
+	// Lesson 22.5 (and 13)
+    void createCommandBuffers() {
+    	// Lesson 13
+    	commandBuffers.resize(swapChainFramebuffers.size());
+    	
+    	VkCommandBufferAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocInfo.commandPool = commandPool;
+		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		allocInfo.commandBufferCount = (uint32_t) commandBuffers.size();
+		
+		VkResult result = vkAllocateCommandBuffers(device, &allocInfo,
+				commandBuffers.data());
+		if (result != VK_SUCCESS) {
+		 	PrintVkError(result);
+			throw std::runtime_error("failed to allocate command buffers!");
+		}
+		
+		// Lesson 22.5 --- Draw calls
+		// This is where the commands that actually draw something on screen are!
+		for (size_t i = 0; i < commandBuffers.size(); i++) {
+			recordCommandBuffer(static_cast<uint32_t>(i));
+		}
+		staleCommandBuffers.assign(commandBuffers.size(), false);
+	}
+	
+	void recordCommandBuffer(uint32_t i) {
+		VkCommandBufferBeginInfo beginInfo{};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = 0; // Optional
+		beginInfo.pInheritanceInfo = nullptr; // Optional
+
+		if (vkBeginCommandBuffer(commandBuffers[i], &beginInfo) !=
+					VK_SUCCESS) {
+			throw std::runtime_error("failed to begin recording command buffer!");
+		}
+		
+		VkRenderPassBeginInfo renderPassInfo{};
+		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+		renderPassInfo.renderPass = renderPass; 
+		renderPassInfo.framebuffer = swapChainFramebuffers[i];
+		renderPassInfo.renderArea.offset = {0, 0};
+		renderPassInfo.renderArea.extent = swapChainExtent;
+
+		std::array<VkClearValue, 2> clearValues{};
+		clearValues[0].color = initialBackgroundColor;
+		clearValues[1].depthStencil = {1.0f, 0};
+
+		renderPassInfo.clearValueCount =
+						static_cast<uint32_t>(clearValues.size());
+		renderPassInfo.pClearValues = clearValues.data();
+		
+		vkCmdBeginRenderPass(commandBuffers[i], &renderPassInfo,
+				VK_SUBPASS_CONTENTS_INLINE);			
+
+
+		populateCommandBuffer(commandBuffers[i], i);
+		
+
+		vkCmdEndRenderPass(commandBuffers[i]);
+
+		if (vkEndCommandBuffer(commandBuffers[i]) != VK_SUCCESS) {
+			throw std::runtime_error("failed to record command buffer!");
+		}
+	}
+    
+    // Records the command buffers again, e.g. after Scene::require()
+    // created new objects: drawFrame() records each one again once its
+    // image is acquired, when the GPU no longer uses it
+    void invalidateCommandBuffers() {
+		std::fill(staleCommandBuffers.begin(), staleCommandBuffers.end(), true);
+	}
+    
+    // Same, at once, waiting for the device to be idle
+    void recreateCommandBuffers() {
+		vkDeviceWaitIdle(device);
+		vkFreeCommandBuffers(device, commandPool,
+				static_cast<uint32_t>(commandBuffers.size()), commandBuffers.data());
+		createCommandBuffers();
+	}
+    
+    // Lesson 22.5
+    void createSyncObjects() {
+    	imageAvailableSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
+    	renderFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
+    	inFlightFences.resize(MAX_FRAMES_IN_FLIGHT);
+    	imagesInFlight.resize(swapChainImages.size(), VK_NULL_HANDLE);
+    	    	
+    	VkSemaphoreCreateInfo semaphoreInfo{};
+		semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+		
+		VkFenceCreateInfo fenceInfo{};
+		fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+		fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+		
+		for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+			VkResult result1 = vkCreateSemaphore(device, &semaphoreInfo, nullptr,
+								&imageAvailableSemaphores[i]);
+			VkResult result2 = vkCreateSemaphore(device, &semaphoreInfo, nullptr,
+								&renderFinishedSemaphores[i]);
+			VkResult result3 = vkCreateFence(device, &fenceInfo, nullptr,
+								&inFlightFences[i]);
+			if (result1 != VK_SUCCESS ||
+				result2 != VK_SUCCESS ||
+				result3 != VK_SUCCESS) {
+			 	PrintVkError(result1);
+			 	PrintVkError(result2);
+			 	PrintVkError(result3);
+				throw std::runtime_error("failed to create synchronization objects for a frame!!");
+			}
+		}
+	}
+    
+    // Lesson 22.6 --- Main Rendering Loop
+    void mainLoop() {
+        while (!glfwWindowShouldClose(window)) {
+            glfwPollEvents();
+            drawFrame();
+        }
+        
+        vkDeviceWaitIdle(device);
+    }
+    
+    // Lesson 22.6
+    void drawFrame() {
+		vkWaitForFences(device, 1, &inFlightFences[currentFrame],
+						VK_TRUE, UINT64_MAX);
+		uploads.collect(false);
+		
+		uint32_t imageIndex;
+		
+		VkResult result = vkAcquireNextImageKHR(device, swapChain, UINT64_MAX,
+				imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
+
+		if (imagesInFlight[imageIndex] != VK_NULL_HANDLE) {
+			vkWaitForFences(device, 1, &imagesInFlight[imageIndex],
+							VK_TRUE, UINT64_MAX);
+		}
+		imagesInFlight[imageIndex] = inFlightFences[currentFrame];
+		
+		updateUniformBuffer(imageIndex);
+		streamer.update(imageIndex);
+		if (recordEachFrame || staleCommandBuffers[imageIndex]) {
+			// The previous submission of this image has completed
+			vkResetCommandBuffer(commandBuffers[imageIndex], 0);
+			recordCommandBuffer(imageIndex);
+			staleCommandBuffers[imageIndex] = false;
+		}
+		
+		VkSubmitInfo submitInfo{};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		VkSemaphore waitSemaphores[] = {imageAvailableSemaphores[currentFrame]};
+		VkPipelineStageFlags waitStages[] =
+			{VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
+		submitInfo.waitSemaphoreCount = 1;
+		submitInfo.pWaitSemaphores = waitSemaphores;
+		submitInfo.pWaitDstStageMask = waitStages;
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &commandBuffers[imageIndex];
+		VkSemaphore signalSemaphores[] = {renderFinishedSemaphores[currentFrame]};
+		submitInfo.signalSemaphoreCount = 1;
+		submitInfo.pSignalSemaphores = signalSemaphores;
+		
+		vkResetFences(device, 1, &inFlightFences[currentFrame]);
+
+		if (vkQueueSubmit(graphicsQueue, 1, &submitInfo,
+				inFlightFences[currentFrame]) != VK_SUCCESS) {
+			throw std::runtime_error("failed to submit draw command buffer!");
+		}
+		
+		VkPresentInfoKHR presentInfo{};
+		presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+		presentInfo.waitSemaphoreCount = 1;
+		presentInfo.pWaitSemaphores = signalSemaphores;
+		
+		VkSwapchainKHR swapChains[] = {swapChain};
+		presentInfo.swapchainCount = 1;
+		presentInfo.pSwapchains = swapChains;
+		presentInfo.pImageIndices = &imageIndex;
+		presentInfo.pResults = nullptr; // Optional
+		
+		result = vkQueuePresentKHR(presentQueue, &presentInfo);
+
+		currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+    }
+
+	virtual void updateUniformBuffer(uint32_t currentImage) = 0;
+
+	virtual void localCleanup() = 0;
+	
+	// All lessons
+	
+    void cleanup() {
+		uploads.cleanup();
+
+		vkDestroyImageView(device, depthImageView, nullptr);
+		vkDestroyImage(device, depthImage, nullptr);
+		vkFreeMemory(device, depthImageMemory, nullptr);
+
+		for (size_t i = 0; i < swapChainFramebuffers.size(); i++) {
+			vkDestroyFramebuffer(device, swapChainFramebuffers[i], nullptr);
+		}
+		
+		vkFreeCommandBuffers(device, commandPool,
+				static_cast<uint32_t>(commandBuffers.size()), commandBuffers.data());
+
+		vkDestroyRenderPass(device, renderPass, nullptr);
+
+		for (size_t i = 0; i < swapChainImageViews.size(); i++){
+			vkDestroyImageView(device, swapChainImageViews[i], nullptr);
+		}
+		
+		vkDestroySwapchainKHR(device, swapChain, nullptr);
+		
+		vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+    	
+    	
+		localCleanup();
+		assets.cleanup();
+		streamer.cleanup();
+		uniformRing.cleanup();
+		geometry.cleanup();
+		bundle.close();
+    	
+    	for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+			vkDestroySemaphore(device, renderFinishedSemaphores[i], nullptr);
+			vkDestroySemaphore(device, imageAvailableSemaphores[i], nullptr);
+			vkDestroyFence(device, inFlightFences[i], nullptr);
+    	}
+    	
+    	vkDestroyCommandPool(device, commandPool, nullptr);
+    	if (transferCommandPool != VK_NULL_HANDLE) {
+    		vkDestroyCommandPool(device, transferCommandPool, nullptr);
+    	}
+    	
+ 		vkDestroyDevice(device, nullptr);
+		
+		DestroyDebugUtilsMessengerEXT(instance, debugMessenger, nullptr);
+		
+		vkDestroySurfaceKHR(instance, surface, nullptr);
+    	vkDestroyInstance(instance, nullptr);
+
+        glfwDestroyWindow(window);
+
+        glfwTerminate();
+    }
+	
+};
+
+
+
+
+void Model::loadModel(std::string file) {
+	const char *cooked;
+	size_t cookedSize;
+	std::vector<char> storage;
+	if (bundle != nullptr && bundle->read(file, cooked, cookedSize, storage)) {
+		if (readMeshCache(cooked, cookedSize, nullptr)) {
+			std::cout << file << ": " << vertices.size() << " vertices, "
+					  << indices.size() << " indices (from the bundle)\n";
+			return;
+		}
+		std::cout << file << ": bundled mesh was cooked with other settings, loading the file\n";
+	}
+
+	MappedFile source;
+	if (!source.open(file)) {
+		throw std::runtime_error("failed to open model file " + file + "!");
+	}
+	std::string extension = file.substr(file.find_last_of('.') + 1);
+	std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+	bool gltf = extension == "gltf" || extension == "glb";
+	sourceHash = gltf ? GltfReader::hashSources(source.data, source.size, file) :
+						hashBytes(source.data, source.size);
+
+	std::string cacheFile = file + ".mesh";
+	if (loadMeshCache(cacheFile, sourceHash)) {
+		std::cout << file << ": " << vertices.size() << " vertices, "
+				  << indices.size() << " indices (from " << cacheFile << ")\n";
+		return;
+	}
+
+	if (gltf) {
+		GltfReader::read(source.data, source.size, file, vertices, indices);
+		source.close();
+		std::cout << file << ": " << vertices.size() << " vertices, "
+				  << indices.size() << " indices\n";
+	} else {
+		ObjReader::read(source.data, source.size, vertices, indices);
+		source.close();
+		std::cout << file << ": " << vertices.size() << " unique vertices out of "
+				  << indices.size() << " face corners ("
+				  << (indices.size() > 0 ? 100 * vertices.size() / indices.size() : 0)
+				  << "%)\n";
+	}
+	optimizeMesh(file);
+	buildLods(file);
+
+	boundsMin = glm::vec3(std::numeric_limits<float>::max());
+	boundsMax = glm::vec3(std::numeric_limits<float>::lowest());
+	for (const auto& vertex : vertices) {
+		boundsMin = glm::min(boundsMin, vertex.pos);
+		boundsMax = glm::max(boundsMax, vertex.pos);
+	}
+
+	saveMeshCache(cacheFile, sourceHash);
+}
+
+void Model::optimizeMesh(const std::string& file) {
+	MeshOptimizer::CacheStats before =
+		MeshOptimizer::analyzeVertexCache(indices, vertices.size());
+
+	std::vector<uint32_t> clusters;
+	MeshOptimizer::optimizeVertexCache(indices, vertices.size(), &clusters);
+	if (sortForOverdraw) {
+		MeshOptimizer::optimizeOverdraw(indices, vertices, clusters);
+	}
+	MeshOptimizer::optimizeVertexFetch(vertices, indices);
+
+	MeshOptimizer::CacheStats after =
+		MeshOptimizer::analyzeVertexCache(indices, vertices.size());
+	std::cout << file << ": ACMR " << before.acmr << " -> " << after.acmr
+			  << ", ATVR " << before.atvr << " -> " << after.atvr << "\n";
+}
+
+void Model::buildLods(const std::string& file) {
+	lodIndices.clear();
+	lods.assign(1, LodLevel{0, static_cast<uint32_t>(indices.size()), 0.0f});
+	if (indices.size() / 3 < LOD_MIN_TRIANGLES) {
+		return;
+	}
+	
+	for (float ratio : LOD_TRIANGLE_RATIOS) {
+		size_t target = 3 * static_cast<size_t>(ratio * indices.size() / 3);
+		float error;
+		std::vector<uint32_t> level =
+			MeshOptimizer::simplify(vertices, indices, target, error);
+		// Stop when the simplification got stuck well above the target
+		if (4 * level.size() > 3 * lods.back().indexCount) {
+			break;
+		}
+		MeshOptimizer::optimizeVertexCache(level, vertices.size());
+		
+		LodLevel L;
+		L.firstIndex = static_cast<uint32_t>(indices.size() + lodIndices.size());
+		L.indexCount = static_cast<uint32_t>(level.size());
+		L.error = error;
+		lods.push_back(L);
+		lodIndices.insert(lodIndices.end(), level.begin(), level.end());
+		std::cout << file << ": LOD " << lods.size() - 1 << " " << level.size() / 3
+				  << " triangles, error " << error << "\n";
+	}
+}
+
+// Picks the coarsest level whose error, projected on a viewport of the
+// given height, stays below LOD_PIXEL_ERROR
+uint32_t Model::selectLod(const glm::mat4& model, const glm::mat4& view,
+						  const glm::mat4& proj, float viewportHeight) {
+	glm::vec3 center = 0.5f * (boundsMin + boundsMax);
+	float radius = 0.5f * glm::length(boundsMax - boundsMin);
+	float scale = std::max(glm::length(glm::vec3(model[0])),
+				  std::max(glm::length(glm::vec3(model[1])),
+						   glm::length(glm::vec3(model[2]))));
+	
+	glm::vec4 viewCenter = view * model * glm::vec4(center, 1.0f);
+	float distance = glm::length(glm::vec3(viewCenter)) - radius * scale;
+	if (distance <= 0.0f) {
+		return 0;
+	}
+	float pixelsPerUnit = std::abs(proj[1][1]) * 0.5f * viewportHeight / distance;
+	
+	for (size_t i = lods.size() - 1; i > 0; i--) {
+		if (lods[i].error * scale * pixelsPerUnit <= LOD_PIXEL_ERROR) {
+			return static_cast<uint32_t>(i);
+		}
+	}
+	return 0;
+}
+
+float Model::screenSize(const glm::mat4& model, const glm::mat4& view,
+						const glm::mat4& proj, float viewportHeight) {
+	glm::vec3 center = 0.5f * (boundsMin + boundsMax);
+	float radius = 0.5f * glm::length(boundsMax - boundsMin);
+	float scale = std::max(glm::length(glm::vec3(model[0])),
+				  std::max(glm::length(glm::vec3(model[1])),
+						   glm::length(glm::vec3(model[2]))));
+	
+	glm::vec4 viewCenter = view * model * glm::vec4(center, 1.0f);
+	float distance = glm::length(glm::vec3(viewCenter)) - radius * scale;
+	if (distance <= 0.0f) {
+		return std::numeric_limits<float>::max();
+	}
+	return 2.0f * radius * scale * std::abs(proj[1][1]) * 0.5f * viewportHeight / distance;
+}
+
+bool Model::loadMeshCache(const std::string& cacheFile, uint64_t sourceHash) {
+	MappedFile cache;
+	return cache.open(cacheFile) && readMeshCache(cache.data, cache.size, &sourceHash);
+}
+
+bool Model::readMeshCache(const char *data, size_t size, const uint64_t *sourceHash) {
+	if (size < sizeof(MeshCacheHeader)) {
+		return false;
+	}
+	
+	MeshCacheHeader header;
+	memcpy(&header, data, sizeof(header));
+	if (memcmp(header.magic, MESH_CACHE_MAGIC, sizeof(header.magic)) != 0 ||
+		header.version != MESH_CACHE_VERSION ||
+		(sourceHash != nullptr && header.sourceHash != *sourceHash) ||
+		header.vertexStride != sizeof(Vertex) ||
+		((header.flags & MESH_CACHE_OVERDRAW_SORTED) != 0) != sortForOverdraw) {
+		return false;
+	}
+	
+	size_t vertexBytes = sizeof(Vertex) * static_cast<size_t>(header.vertexCount);
+	size_t indexBytes = sizeof(uint32_t) * static_cast<size_t>(header.indexCount);
+	size_t lodIndexBytes = sizeof(uint32_t) * static_cast<size_t>(header.lodIndexCount);
+	size_t lodBytes = sizeof(LodLevel) * static_cast<size_t>(header.lodCount);
+	if (header.lodCount == 0 ||
+		size != sizeof(header) + vertexBytes + indexBytes + lodIndexBytes + lodBytes) {
+		return false;
+	}
+	
+	const char *blob = data + sizeof(header);
+	vertices.resize(header.vertexCount);
+	indices.resize(header.indexCount);
+	lodIndices.resize(header.lodIndexCount);
+	lods.resize(header.lodCount);
+	memcpy(vertices.data(), blob, vertexBytes);
+	blob += vertexBytes;
+	memcpy(indices.data(), blob, indexBytes);
+	blob += indexBytes;
+	memcpy(lodIndices.data(), blob, lodIndexBytes);
+	blob += lodIndexBytes;
+	memcpy(lods.data(), blob, lodBytes);
+	boundsMin = glm::vec3(header.boundsMin[0], header.boundsMin[1], header.boundsMin[2]);
+	boundsMax = glm::vec3(header.boundsMax[0], header.boundsMax[1], header.boundsMax[2]);
+	this->sourceHash = header.sourceHash;
+	return true;
+}
+
+void Model::saveMeshCache(const std::string& cacheFile, uint64_t sourceHash) {
+	MeshCacheHeader header{};
+	memcpy(header.magic, MESH_CACHE_MAGIC, sizeof(header.magic));
+	header.version = MESH_CACHE_VERSION;
+	header.sourceHash = sourceHash;
+	header.vertexStride = sizeof(Vertex);
+	header.vertexCount = static_cast<uint32_t>(vertices.size());
+	header.indexCount = static_cast<uint32_t>(indices.size());
+	header.flags = sortForOverdraw ? MESH_CACHE_OVERDRAW_SORTED : 0;
+	header.lodCount = static_cast<uint32_t>(lods.size());
+	header.lodIndexCount = static_cast<uint32_t>(lodIndices.size());
+	for (int i = 0; i < 3; i++) {
+		header.boundsMin[i] = boundsMin[i];
+		header.boundsMax[i] = boundsMax[i];
+	}
+	
+	// Written under a unique name and renamed, since several models may
+	// load (and cache) the same file concurrently
+	std::string tmpFile = cacheFile + "." +
+		std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+	std::ofstream out(tmpFile, std::ios::binary | std::ios::trunc);
+	if (!out.is_open()) {
+		std::cout << "Could not write mesh cache " << cacheFile << "\n";
+		return;
+	}
+	out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+	out.write(reinterpret_cast<const char *>(vertices.data()),
+			  sizeof(Vertex) * vertices.size());
+	out.write(reinterpret_cast<const char *>(indices.data()),
+			  sizeof(uint32_t) * indices.size());
+	out.write(reinterpret_cast<const char *>(lodIndices.data()),
+			  sizeof(uint32_t) * lodIndices.size());
+	out.write(reinterpret_cast<const char *>(lods.data()),
+			  sizeof(LodLevel) * lods.size());
+	out.close();
+	
+	std::remove(cacheFile.c_str());
+	if (std::rename(tmpFile.c_str(), cacheFile.c_str()) != 0) {
+		std::remove(tmpFile.c_str());
+	}
+}
+
+// Reference tinyobj loader, kept to validate and benchmark ObjReader
+void Model::loadObjTinyobj(std::string file) {
+	tinyobj::attrib_t attrib;
+	std::vector<tinyobj::shape_t> shapes;
+	std::vector<tinyobj::material_t> materials;
+	std::string warn, err;
+	
+	if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err,
+						  file.c_str())) {
+		throw std::runtime_error(warn + err);
+	}
+	
+	// Face corners sharing position, normal and UV are welded into a single
+	// vertex, so the index buffer actually references shared vertices
+	std::unordered_map<Vertex, uint32_t> uniqueVertices{};
+	size_t rawVertices = 0;
+	for (const auto& shape : shapes) {
+		rawVertices += shape.mesh.indices.size();
+	}
+	uniqueVertices.reserve(rawVertices);
+	indices.reserve(rawVertices);
+
+	for (const auto& shape : shapes) {
+		for (const auto& index : shape.mesh.indices) {
+			Vertex vertex{};
+			
+			vertex.pos = {
+				attrib.vertices[3 * index.vertex_index + 0],
+				attrib.vertices[3 * index.vertex_index + 1],
+				attrib.vertices[3 * index.vertex_index + 2]
 			};
-			actualExtent.width = std::max(capabilities.minImageExtent.width,
-					std::min(capabilities.maxImageExtent.width, actualExtent.width));
-			actualExtent.height = std::max(capabilities.minImageExtent.height,
-					std::min(capabilities.maxImageExtent.height, actualExtent.height));
-			return actualExtent;
+			
+			vertex.texCoord = {
+				attrib.texcoords[2 * index.texcoord_index + 0],
+				1 - attrib.texcoords[2 * index.texcoord_index + 1] 
+			};
+
+			vertex.norm = {
+				attrib.normals[3 * index.normal_index + 0],
+				attrib.normals[3 * index.normal_index + 1],
+				attrib.normals[3 * index.normal_index + 2]
+			};
+			
+			auto inserted = uniqueVertices.emplace(vertex,
+								static_cast<uint32_t>(vertices.size()));
+			if (inserted.second) {
+				vertices.push_back(vertex);
+			}
+			indices.push_back(inserted.first->second);
+		}
+	}
+	
+	std::cout << file << ": " << vertices.size() << " unique vertices out of "
+			  << rawVertices << " face corners ("
+			  << (rawVertices > 0 ? 100 * vertices.size() / rawVertices : 0)
+			  << "%)\n";
+}
+
+// Lesson 21
+void Model::createVertexBuffer() {
+	if (format == VERTEX_QUANTIZED) {
+		std::vector<QuantizedVertex> quantized = quantizeVertices();
+		createGeometryBuffer(quantized.data(), sizeof(quantized[0]) * quantized.size(),
+							 VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+							 VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT,
+							 vertexBuffer, vertexBufferMemory);
+		return;
+	}
+	createGeometryBuffer(vertices.data(), sizeof(vertices[0]) * vertices.size(),
+						 VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+						 VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT,
+						 vertexBuffer, vertexBufferMemory);
+}
+
+// Contents of the index buffer: indices followed by lodIndices
+std::vector<uint32_t> Model::bufferIndices() {
+	std::vector<uint32_t> all;
+	all.reserve(indices.size() + lodIndices.size());
+	all.insert(all.end(), indices.begin(), indices.end());
+	all.insert(all.end(), lodIndices.begin(), lodIndices.end());
+	return all;
+}
+
+std::vector<uint16_t> Model::shortIndices() {
+	std::vector<uint32_t> all = bufferIndices();
+	return std::vector<uint16_t>(all.begin(), all.end());
+}
+
+std::vector<QuantizedVertex> Model::quantizeVertices() {
+	glm::vec3 offset = quantizationOffset();
+	glm::vec3 scale = quantizationScale();
+	std::vector<QuantizedVertex> quantized(vertices.size());
+	for (size_t i = 0; i < vertices.size(); i++) {
+		quantized[i] = QuantizedVertex::quantize(vertices[i], offset, scale);
+	}
+	return quantized;
+}
+
+// Quantized positions p map back to offset + scale * p
+glm::vec3 Model::quantizationOffset() {
+	return 0.5f * (boundsMin + boundsMax);
+}
+
+glm::vec3 Model::quantizationScale() {
+	// Flat meshes keep a non zero scale on their flat axis
+	return glm::max(0.5f * (boundsMax - boundsMin), glm::vec3(1e-6f));
+}
+
+// lods and indexType are set by init()
+void Model::createIndexBuffer() {
+	if (indexType == VK_INDEX_TYPE_UINT16) {
+		std::vector<uint16_t> shorts = shortIndices();
+		createGeometryBuffer(shorts.data(), sizeof(shorts[0]) * shorts.size(),
+							 VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+							 VK_ACCESS_INDEX_READ_BIT,
+							 indexBuffer, indexBufferMemory);
+		return;
+	}
+	std::vector<uint32_t> all = bufferIndices();
+	createGeometryBuffer(all.data(), sizeof(all[0]) * all.size(),
+						 VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+						 VK_ACCESS_INDEX_READ_BIT,
+						 indexBuffer, indexBufferMemory);
+}
+
+void Model::createGeometryBuffer(const void *data, VkDeviceSize size,
+								 VkBufferUsageFlags usage, VkAccessFlags access,
+								 VkBuffer& buffer, VkDeviceMemory& bufferMemory) {
+	if (dynamic) {
+		BP->createBuffer(size, usage,
+						 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+						 VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+						 buffer, bufferMemory);
+
+		void* mapped;
+		vkMapMemory(BP->device, bufferMemory, 0, size, 0, &mapped);
+		memcpy(mapped, data, (size_t) size);
+		vkUnmapMemory(BP->device, bufferMemory);
+		return;
+	}
+	
+	VkBuffer stagingBuffer = BP->uploads.stage(data, size);
+	BP->createBuffer(size, usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+					 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+					 buffer, bufferMemory);
+	
+	BP->copyBuffer(BP->uploads.beginTransfer(), stagingBuffer, buffer, size);
+	BP->uploads.handOff(buffer, size, access, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT);
+}
+
+// Only for dynamic models: the vertex and index counts must not change,
+// and quantized vertices must stay within the bounds the model had at init()
+void Model::updateBuffers() {
+	// The buffers of the other models are device local, or the pool's
+	if (!dynamic) {
+		throw std::runtime_error("failed to update buffers: the model is not dynamic!");
+	}
+	void* data;
+	vkMapMemory(BP->device, vertexBufferMemory, 0, VK_WHOLE_SIZE, 0, &data);
+	if (format == VERTEX_QUANTIZED) {
+		std::vector<QuantizedVertex> quantized = quantizeVertices();
+		memcpy(data, quantized.data(), sizeof(quantized[0]) * quantized.size());
+	} else {
+		memcpy(data, vertices.data(), sizeof(vertices[0]) * vertices.size());
+	}
+	vkUnmapMemory(BP->device, vertexBufferMemory);
+
+	vkMapMemory(BP->device, indexBufferMemory, 0, VK_WHOLE_SIZE, 0, &data);
+	if (indexType == VK_INDEX_TYPE_UINT16) {
+		std::vector<uint16_t> shorts = shortIndices();
+		memcpy(data, shorts.data(), sizeof(shorts[0]) * shorts.size());
+	} else {
+		std::vector<uint32_t> all = bufferIndices();
+		memcpy(data, all.data(), sizeof(all[0]) * all.size());
+	}
+	vkUnmapMemory(BP->device, indexBufferMemory);
+}
+
+void Model::init(BaseProject *bp, std::string file) {
+	bundle = &bp->bundle;
+	loadModel(file);
+	init(bp);
+}
+
+void Model::init(BaseProject *bp) {
+	BP = bp;
+	if (lods.empty()) {
+		lods.assign(1, LodLevel{0, static_cast<uint32_t>(indices.size()), 0.0f});
+	}
+	indexType = vertices.size() <= 0x10000 ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+	if (!dynamic && BP->geometry.add(this)) {
+		return;
+	}
+	createVertexBuffer();
+	createIndexBuffer();
+}
+
+void Model::cleanup() {
+	if (pooled) {
+		BP->geometry.remove(this);
+		return;
+	}
+   	vkDestroyBuffer(BP->device, indexBuffer, nullptr);
+   	vkFreeMemory(BP->device, indexBufferMemory, nullptr);
+	vkDestroyBuffer(BP->device, vertexBuffer, nullptr);
+   	vkFreeMemory(BP->device, vertexBufferMemory, nullptr);
+}
+
+
+
+
+
+
+
+void Texture::loadImage(std::string file) {
+	const char *cooked;
+	size_t cookedSize;
+	if (bundle != nullptr && !gpuMips && bundle->read(file, cooked, cookedSize, bundleStorage)) {
+		if (readTextureCache(cooked, cookedSize, nullptr)) {
+			return;
+		}
+		std::vector<char>().swap(bundleStorage);
+		std::cout << file << ": bundled texture was cooked with other settings, loading the file\n";
+	}
+	
+	MappedFile source;
+	if (!source.open(file)) {
+		throw std::runtime_error("failed to load texture image " + file + "!");
+	}
+	sourceHash = hashBytes(source.data, source.size);
+	
+	std::string cacheFile = file + ".tex";
+	if (!gpuMips && loadTextureCache(cacheFile, sourceHash)) {
+		return;
+	}
+	
+	int texChannels;
+	stbi_uc *decoded = stbi_load_from_memory(
+						reinterpret_cast<const stbi_uc *>(source.data),
+						static_cast<int>(source.size), &texWidth, &texHeight,
+						&texChannels, STBI_rgb_alpha);
+	source.close();
+	if (!decoded) {
+		throw std::runtime_error("failed to load texture image " + file + "!");
+	}
+	buildMips(decoded);
+	stbi_image_free(decoded);
+	if (gpuMips) {
+		return;
+	}
+	
+	VkFormat sourceFormat = format;
+	if (compress) {
+		compressMips();
+	}
+	saveTextureCache(cacheFile, sourceHash, sourceFormat);
+}
+
+void Texture::loadPixels(const uint8_t *rgba, int width, int height) {
+	texWidth = width;
+	texHeight = height;
+	buildMips(rgba);
+}
+
+void Texture::buildMips(const stbi_uc *level0) {
+	mipLevels = static_cast<uint32_t>(std::floor(
+					std::log2(std::max(texWidth, texHeight)))) + 1;
+	mips.resize(mipLevels);
+	uint64_t offset = 0;
+	for (uint32_t i = 0; i < mipLevels; i++) {
+		mips[i].width = std::max(texWidth >> i, 1);
+		mips[i].height = std::max(texHeight >> i, 1);
+		mips[i].offset = offset;
+		mips[i].size = 4ull * mips[i].width * mips[i].height;
+		offset += mips[i].size;
+	}
+	
+	if (gpuMips) {
+		// Only level 0, the others are blitted at upload
+		mipStorage.assign(level0, level0 + mips[0].size);
+	} else {
+		mipStorage.resize(offset);
+		MipBuilder::build(level0, mips, format == VK_FORMAT_R8G8B8A8_SRGB,
+						  mipFilter, wrapMips, mipStorage.data());
+	}
+	pixels = mipStorage.data();
+}
+
+bool Texture::loadTextureCache(const std::string& cacheFile, uint64_t sourceHash) {
+	if (!cacheMapping.open(cacheFile) ||
+		!readTextureCache(cacheMapping.data, cacheMapping.size, &sourceHash)) {
+		cacheMapping.close();
+		return false;
+	}
+	return true;
+}
+
+bool Texture::readTextureCache(const char *data, size_t size, const uint64_t *sourceHash) {
+	if (size < sizeof(TextureCacheHeader)) {
+		return false;
+	}
+	
+	TextureCacheHeader header;
+	memcpy(&header, data, sizeof(header));
+	size_t tableBytes = sizeof(TextureMip) * static_cast<size_t>(header.mipLevels);
+	if (memcmp(header.magic, TEXTURE_CACHE_MAGIC, sizeof(header.magic)) != 0 ||
+		header.version != TEXTURE_CACHE_VERSION ||
+		(sourceHash != nullptr && header.sourceHash != *sourceHash) ||
+		header.sourceFormat != static_cast<uint32_t>(format) ||
+		header.compression != (compress ? (highQuality ? 2u : 1u) : 0u) ||
+		header.mipFilter != static_cast<uint32_t>(mipFilter) ||
+		header.wrapMips != (wrapMips ? 1u : 0u) ||
+		header.mipLevels == 0 ||
+		size != sizeof(header) + tableBytes + header.dataSize) {
+		return false;
+	}
+	
+	texWidth = static_cast<int>(header.width);
+	texHeight = static_cast<int>(header.height);
+	mipLevels = header.mipLevels;
+	format = static_cast<VkFormat>(header.format);
+	mips.resize(mipLevels);
+	memcpy(mips.data(), data + sizeof(header), tableBytes);
+	if (mips.back().offset + mips.back().size != header.dataSize) {
+		return false;
+	}
+	// The levels are uploaded straight from the mapping
+	pixels = reinterpret_cast<const stbi_uc *>(data + sizeof(header) + tableBytes);
+	this->sourceHash = header.sourceHash;
+	return true;
+}
+
+void Texture::saveTextureCache(const std::string& cacheFile, uint64_t sourceHash,
+							   VkFormat sourceFormat) {
+	TextureCacheHeader header{};
+	memcpy(header.magic, TEXTURE_CACHE_MAGIC, sizeof(header.magic));
+	header.version = TEXTURE_CACHE_VERSION;
+	header.sourceHash = sourceHash;
+	header.width = static_cast<uint32_t>(texWidth);
+	header.height = static_cast<uint32_t>(texHeight);
+	header.mipLevels = mipLevels;
+	header.format = static_cast<uint32_t>(format);
+	header.dataSize = mipStorage.size();
+	header.sourceFormat = static_cast<uint32_t>(sourceFormat);
+	header.compression = compress ? (highQuality ? 2u : 1u) : 0u;
+	header.mipFilter = static_cast<uint32_t>(mipFilter);
+	header.wrapMips = wrapMips ? 1u : 0u;
+	
+	// Written under a unique name and renamed, like the mesh cache
+	std::string tmpFile = cacheFile + "." +
+		std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+	std::ofstream out(tmpFile, std::ios::binary | std::ios::trunc);
+	if (!out.is_open()) {
+		std::cout << "Could not write texture cache " << cacheFile << "\n";
+		return;
+	}
+	out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+	out.write(reinterpret_cast<const char *>(mips.data()),
+			  sizeof(TextureMip) * mips.size());
+	out.write(reinterpret_cast<const char *>(mipStorage.data()), mipStorage.size());
+	out.close();
+	
+	std::remove(cacheFile.c_str());
+	if (std::rename(tmpFile.c_str(), cacheFile.c_str()) != 0) {
+		std::remove(tmpFile.c_str());
+	}
+}
+
+void Texture::compressMips() {
+	format = BlockCompressor::choose(pixels, static_cast<size_t>(texWidth) * texHeight,
+									 format, highQuality);
+	
+	std::vector<TextureMip> blockMips(mips);
+	VkDeviceSize offset = 0;
+	for (TextureMip& mip : blockMips) {
+		mip.offset = offset;
+		mip.size = BlockCompressor::levelBytes(format, mip.width, mip.height);
+		offset += mip.size;
+	}
+	std::vector<stbi_uc> blocks(offset);
+	for (size_t i = 0; i < mips.size(); i++) {
+		BlockCompressor::encode(format, mipStorage.data() + mips[i].offset,
+								mips[i].width, mips[i].height,
+								blocks.data() + blockMips[i].offset);
+	}
+	
+	mips.swap(blockMips);
+	mipStorage.swap(blocks);
+	pixels = mipStorage.data();
+}
+
+void Texture::decompressMips() {
+	VkFormat blockFormat = format;
+	std::vector<TextureMip> rgbaMips(mips);
+	VkDeviceSize offset = 0;
+	for (TextureMip& mip : rgbaMips) {
+		mip.offset = offset;
+		mip.size = 4ull * mip.width * mip.height;
+		offset += mip.size;
+	}
+	std::vector<stbi_uc> rgba(offset);
+	for (size_t i = 0; i < mips.size(); i++) {
+		BlockCompressor::decode(blockFormat, pixels + mips[i].offset,
+								mips[i].width, mips[i].height,
+								rgba.data() + rgbaMips[i].offset);
+	}
+	
+	freePixels();
+	format = BlockCompressor::decodedFormat(blockFormat);
+	mips.swap(rgbaMips);
+	mipStorage.swap(rgba);
+	pixels = mipStorage.data();
+}
+
+std::vector<stbi_uc> Texture::level0() const {
+	std::vector<stbi_uc> rgba(4 * static_cast<size_t>(texWidth) * texHeight);
+	if (BlockCompressor::isCompressed(format)) {
+		BlockCompressor::decode(format, pixels, texWidth, texHeight, rgba.data());
+	} else {
+		memcpy(rgba.data(), pixels, rgba.size());
+	}
+	return rgba;
+}
+
+void Texture::freePixels() {
+	pixels = nullptr;
+	std::vector<stbi_uc>().swap(mipStorage);
+	std::vector<char>().swap(bundleStorage);
+	cacheMapping.close();
+}
+
+void Texture::request(float screenSize) {
+	// One texel per pixel, if the texture covers the object once
+	float size = static_cast<float>(std::max(texWidth, texHeight));
+	uint32_t level = screenSize >= size ? 0 :
+		static_cast<uint32_t>(std::floor(std::log2(size / std::max(screenSize, 1.0f))));
+	wantedLevel = std::min(wantedLevel, std::min(level, tailLevel()));
+}
+
+uint32_t Texture::tailLevel() {
+	uint32_t level = 0;
+	while (level + 1 < mips.size() &&
+		   std::max(mips[level].width, mips[level].height) > STREAM_TAIL_SIZE) {
+		level++;
+	}
+	return level;
+}
+
+VkDeviceSize Texture::levelBytes(uint32_t firstLevel) {
+	return mips.back().offset + mips.back().size - mips[firstLevel].offset;
+}
+
+void Texture::createTextureImage(uint32_t firstLevel) {
+	if (BlockCompressor::isCompressed(format) && !BP->textureCompressionBC) {
+		std::cout << "BC textures are not supported, decompressing\n";
+		decompressMips();
+	}
+	if (gpuMips && !BP->linearBlitSupported(format)) {
+		std::cout << "Linear blit not supported, building the mips on the CPU\n";
+		gpuMips = false;
+		std::vector<stbi_uc> level(pixels, pixels + mips[0].size);
+		buildMips(level.data());
+	}
+	residentLevel = firstLevel;
+	mipLevels = static_cast<uint32_t>(mips.size()) - firstLevel;
+	// Level 0 only, for the blit chain
+	uint32_t copiedLevels = gpuMips ? 1 : mipLevels;
+	const TextureMip& first = mips[firstLevel];
+	const TextureMip& last = mips[firstLevel + copiedLevels - 1];
+	VkDeviceSize imageSize = last.offset + last.size - first.offset;
+	
+	// Every level in one staging buffer, copied with one region per level
+	VkBuffer stagingBuffer = BP->uploads.stage(pixels + first.offset, imageSize);
+	if (!stream) {
+		freePixels();
+	}
+	
+	VkImageUsageFlags usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+	if (gpuMips || stream) {
+		// Each level is blitted from the previous one, or the levels are
+		// copied to the next image of a streamed texture
+		usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+	}
+	BP->createImage(first.width, first.height, mipLevels, format,
+				VK_IMAGE_TILING_OPTIMAL, usage,
+				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, textureImage,
+				textureImageMemory);
+	
+	std::vector<VkBufferImageCopy> regions(copiedLevels);
+	for (uint32_t i = 0; i < copiedLevels; i++) {
+		const TextureMip& mip = mips[firstLevel + i];
+		regions[i].bufferOffset = mip.offset - first.offset;
+		regions[i].bufferRowLength = 0;
+		regions[i].bufferImageHeight = 0;
+		regions[i].imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		regions[i].imageSubresource.mipLevel = i;
+		regions[i].imageSubresource.baseArrayLayer = 0;
+		regions[i].imageSubresource.layerCount = 1;
+		regions[i].imageOffset = {0, 0, 0};
+		regions[i].imageExtent = {mip.width, mip.height, 1};
+	}
+	
+	// Recorded in the upload batch: the staging buffer stays alive
+	// until the batch has been executed. The copy may run on the transfer
+	// queue; the hand off makes the image readable by the fragment shaders.
+	VkCommandBuffer transferCommands = BP->uploads.beginTransfer();
+	BP->transitionImageLayout(transferCommands, textureImage, format,
+			VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, mipLevels);
+	vkCmdCopyBufferToImage(transferCommands, stagingBuffer, textureImage,
+			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			static_cast<uint32_t>(regions.size()), regions.data());
+	if (gpuMips) {
+		// The blits run on the graphics queue, which also moves every
+		// level to SHADER_READ_ONLY
+		BP->uploads.handOff(textureImage, mipLevels, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+				VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+				VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT,
+				VK_PIPELINE_STAGE_TRANSFER_BIT);
+		BP->generateMipmaps(BP->uploads.begin(), textureImage, format,
+							texWidth, texHeight, mipLevels);
+	} else {
+		BP->uploads.handOff(textureImage, mipLevels, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+				VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_ACCESS_SHADER_READ_BIT,
+				VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+	}
+}
+
+void Texture::replaceImage(uint32_t firstLevel) {
+	VkImage oldImage = textureImage;
+	uint32_t oldFirst = residentLevel;
+	uint32_t oldLevels = mipLevels;
+	residentLevel = firstLevel;
+	mipLevels = static_cast<uint32_t>(mips.size()) - firstLevel;
+	BP->createImage(mips[firstLevel].width, mips[firstLevel].height, mipLevels, format,
+				VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_SRC_BIT |
+				VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, textureImage,
+				textureImageMemory);
+	
+	// Recorded for the graphics queue, which owns the current image and
+	// still samples it in the frames submitted before the switch
+	VkCommandBuffer commandBuffer = BP->uploads.begin();
+	auto barrier = [](VkImage image, uint32_t levels, VkImageLayout oldLayout,
+						  VkImageLayout newLayout, VkAccessFlags srcAccess,
+						  VkAccessFlags dstAccess) {
+		VkImageMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.oldLayout = oldLayout;
+		barrier.newLayout = newLayout;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.image = image;
+		barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, levels, 0, 1};
+		barrier.srcAccessMask = srcAccess;
+		barrier.dstAccessMask = dstAccess;
+		return barrier;
+	};
+	VkImageMemoryBarrier toTransfer[] = {
+		barrier(oldImage, oldLevels, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+				VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, 0, VK_ACCESS_TRANSFER_READ_BIT),
+		barrier(textureImage, mipLevels, VK_IMAGE_LAYOUT_UNDEFINED,
+				VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 0, VK_ACCESS_TRANSFER_WRITE_BIT)};
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+						 VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr,
+						 2, toTransfer);
+	
+	if (firstLevel < oldFirst) {
+		// The new finer levels, in one staging buffer
+		const TextureMip& first = mips[firstLevel];
+		VkBuffer stagingBuffer = BP->uploads.stage(pixels + first.offset,
+												   mips[oldFirst].offset - first.offset);
+		std::vector<VkBufferImageCopy> regions(oldFirst - firstLevel);
+		for (uint32_t i = 0; i < regions.size(); i++) {
+			const TextureMip& mip = mips[firstLevel + i];
+			regions[i].bufferOffset = mip.offset - first.offset;
+			regions[i].imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, i, 0, 1};
+			regions[i].imageExtent = {mip.width, mip.height, 1};
+		}
+		vkCmdCopyBufferToImage(commandBuffer, stagingBuffer, textureImage,
+				VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+				static_cast<uint32_t>(regions.size()), regions.data());
+	}
+	std::vector<VkImageCopy> copies;
+	for (uint32_t level = std::max(firstLevel, oldFirst); level < mips.size(); level++) {
+		VkImageCopy copy{};
+		copy.srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level - oldFirst, 0, 1};
+		copy.dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level - firstLevel, 0, 1};
+		copy.extent = {mips[level].width, mips[level].height, 1};
+		copies.push_back(copy);
+	}
+	vkCmdCopyImage(commandBuffer, oldImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+				   textureImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+				   static_cast<uint32_t>(copies.size()), copies.data());
+	
+	// The old image goes back to being sampled until every set switches
+	VkImageMemoryBarrier toShader[] = {
+		barrier(oldImage, oldLevels, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+				VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, 0, VK_ACCESS_SHADER_READ_BIT),
+		barrier(textureImage, mipLevels, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+				VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_ACCESS_TRANSFER_WRITE_BIT,
+				VK_ACCESS_SHADER_READ_BIT)};
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+						 VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr,
+						 2, toShader);
+}
+
+void Texture::createTextureImageView() {
+	textureImageView = BP->createImageView(textureImage,
+									   format,
+									   VK_IMAGE_ASPECT_COLOR_BIT,
+									   mipLevels,
+									   BlockCompressor::components(format));
+}
+	
+void Texture::createTextureSampler() {
+	VkSamplerCreateInfo samplerInfo{};
+	samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	samplerInfo.magFilter = VK_FILTER_LINEAR;
+	samplerInfo.minFilter = VK_FILTER_LINEAR;
+	samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	samplerInfo.anisotropyEnable = VK_TRUE;
+	samplerInfo.maxAnisotropy = 16;
+	samplerInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
+	samplerInfo.unnormalizedCoordinates = VK_FALSE;
+	samplerInfo.compareEnable = VK_FALSE;
+	samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
+	samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+	samplerInfo.mipLodBias = 0.0f;
+	samplerInfo.minLod = 0.0f;
+	// All the levels: streaming adds some to the image later
+	samplerInfo.maxLod = static_cast<float>(mips.size());
+	
+	VkResult result = vkCreateSampler(BP->device, &samplerInfo, nullptr,
+									  &textureSampler);
+	if (result != VK_SUCCESS) {
+	 	PrintVkError(result);
+	 	throw std::runtime_error("failed to create texture sampler!");
+	}
+}
+	
+
+
+void Texture::init(BaseProject *bp, std::string file) {
+	bundle = &bp->bundle;
+	loadImage(file);
+	init(bp);
+}
+
+void Texture::init(BaseProject *bp) {
+	BP = bp;
+	// Streaming needs the levels of the file: generated textures are whole
+	stream = stream && !gpuMips && !mips.empty() && pixels != nullptr;
+	if (stream) {
+		residentLevel = wantedLevel = tailLevel();
+		BP->streamer.add(this);
+	}
+	createTextureImage(residentLevel);
+	createTextureImageView();
+	createTextureSampler();
+}
+
+void Texture::cleanup() {
+	if (stream) {
+		BP->streamer.remove(this);
+		freePixels();
+	}
+   	vkDestroySampler(BP->device, textureSampler, nullptr);
+   	vkDestroyImageView(BP->device, textureImageView, nullptr);
+	vkDestroyImage(BP->device, textureImage, nullptr);
+	vkFreeMemory(BP->device, textureImageMemory, nullptr);
+}
+
+TextureStreamer::~TextureStreamer() {
+	stop();
+}
+
+void TextureStreamer::init(BaseProject *bp) {
+	BP = bp;
+	lastChange = std::chrono::steady_clock::now();
+}
+
+void TextureStreamer::add(Texture *T) {
+	if (!worker.joinable()) {
+		worker = std::thread(&TextureStreamer::work, this);
+	}
+	textures.push_back(T);
+}
+
+void TextureStreamer::remove(Texture *T) {
+	std::unique_lock<std::mutex> lock(mutex);
+	// The worker may be reading its levels
+	wake.wait(lock, [&]() {
+		return std::none_of(reading.begin(), reading.end(),
+							[T](const Job& job) { return job.T == T; });
+	});
+	auto other = [T](const Job& job) { return job.T == T; };
+	queued.erase(std::remove_if(queued.begin(), queued.end(), other), queued.end());
+	ready.erase(std::remove_if(ready.begin(), ready.end(), other), ready.end());
+	textures.erase(std::remove(textures.begin(), textures.end(), T), textures.end());
+	// The GPU no longer uses T, nor its previous images
+	for (auto it = retired.begin(); it != retired.end();) {
+		if (it->T == T) {
+			destroy(*it);
+			it = retired.erase(it);
+		} else {
+			++it;
 		}
 	}
+}
+
+VkDeviceSize TextureStreamer::residentBytes() {
+	VkDeviceSize bytes = 0;
+	for (Texture *T : textures) {
+		bytes += T->levelBytes(T->residentLevel);
+	}
+	return bytes;
+}
 
-	// Lesson 14
-	void createImageViews() {
-		swapChainImageViews.resize(swapChainImages.size());
+void TextureStreamer::update(uint32_t currentImage) {
+	std::vector<Job> done;
+	bool busy;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		done.swap(ready);
+		busy = !queued.empty() || !reading.empty();
+	}
+	if (!done.empty()) {
+		apply(done);
+	}
+	switchImages(currentImage);
+	
+	// A texture is replaced again only once its old image is gone
+	auto now = std::chrono::steady_clock::now();
+	bool plan = !busy && done.empty() && retired.empty() &&
+		std::chrono::duration<float>(now - lastChange).count() >= STREAM_INTERVAL;
+	std::vector<Job> jobs;
+	if (plan) {
+		// The textures furthest from their requested level first
+		std::vector<Texture *> wanting;
+		for (Texture *T : textures) {
+			if (T->wantedLevel < T->residentLevel) {
+				wanting.push_back(T);
+			}
+		}
+		std::sort(wanting.begin(), wanting.end(), [](Texture *A, Texture *B) {
+			return A->residentLevel - A->wantedLevel > B->residentLevel - B->wantedLevel;
+		});
 		
-		for (size_t i = 0; i < swapChainImages.size(); i++) {
-			swapChainImageViews[i] = createImageView(swapChainImages[i],
-													 swapChainImageFormat,
-													 VK_IMAGE_ASPECT_COLOR_BIT, 1);
+		VkDeviceSize used = residentBytes();
+		std::set<Texture *> changed;
+		for (Texture *T : wanting) {
+			VkDeviceSize cost = T->mips[T->residentLevel - 1].size;
+			// Evict from the textures holding the most levels they do not need
+			while (used + cost > BP->textureBudget) {
+				Texture *victim = nullptr;
+				for (Texture *V : textures) {
+					if (V != T && changed.count(V) == 0 && V->residentLevel < V->wantedLevel &&
+						(victim == nullptr || V->wantedLevel - V->residentLevel >
+											  victim->wantedLevel - victim->residentLevel)) {
+						victim = V;
+					}
+				}
+				if (victim == nullptr) {
+					break;
+				}
+				used -= victim->mips[victim->residentLevel].size;
+				jobs.push_back({victim, victim->residentLevel + 1});
+				changed.insert(victim);
+			}
+			if (used + cost > BP->textureBudget) {
+				continue;
+			}
+			used += cost;
+			jobs.push_back({T, T->residentLevel - 1});
+			changed.insert(T);
 		}
 	}
 	
-	// Lesson 14
-	VkImageView createImageView(VkImage image, VkFormat format,
-								VkImageAspectFlags aspectFlags,
-								uint32_t mipLevels // New in Lesson 23
-								) {
-		VkImageViewCreateInfo viewInfo{};
-		viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-		viewInfo.image = image;
-		viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-		viewInfo.format = format;
-		viewInfo.subresourceRange.aspectMask = aspectFlags;
-		viewInfo.subresourceRange.baseMipLevel = 0;
-		viewInfo.subresourceRange.levelCount = mipLevels;
-		viewInfo.subresourceRange.baseArrayLayer = 0;
-		viewInfo.subresourceRange.layerCount = 1;
-		VkImageView imageView;
+	// The requests of the next frames start over
+	for (Texture *T : textures) {
+		T->wantedLevel = T->tailLevel();
+	}
+	
+	if (!jobs.empty()) {
+		std::lock_guard<std::mutex> lock(mutex);
+		queued.swap(jobs);
+		wake.notify_all();
+	}
+}
 
-		VkResult result = vkCreateImageView(device, &viewInfo, nullptr,
-				&imageView);
-		if (result != VK_SUCCESS) {
-		 	PrintVkError(result);
-			throw std::runtime_error("failed to create image view!");
+void TextureStreamer::apply(const std::vector<Job>& jobs) {
+	for (const Job& job : jobs) {
+		Texture *T = job.T;
+		retired.push_back({T, T->textureImage, T->textureImageMemory, T->textureImageView,
+						   std::vector<bool>(BP->swapChainImages.size(), false)});
+		T->replaceImage(job.level);
+		T->createTextureImageView();
+	}
+	// Submitted before the frame, on the same queue
+	BP->uploads.submit();
+	lastChange = std::chrono::steady_clock::now();
+}
+
+void TextureStreamer::switchImages(uint32_t currentImage) {
+	// The last frame of currentImage has completed: its sets and command
+	// buffer are free to change. Once every image has switched, the old
+	// image is no longer used by any frame.
+	for (auto it = retired.begin(); it != retired.end();) {
+		if (!it->switched[currentImage]) {
+			for (DescriptorSet *S : it->T->sets) {
+				S->update(it->T, currentImage);
+			}
+			it->switched[currentImage] = true;
+			BP->staleCommandBuffers[currentImage] = true;
+		}
+		if (std::find(it->switched.begin(), it->switched.end(), false) == it->switched.end()) {
+			destroy(*it);
+			it = retired.erase(it);
+		} else {
+			++it;
 		}
-		return imageView;
 	}
-	
-	// Lesson 19
-    void createRenderPass() {
-		VkAttachmentDescription depthAttachment{};
-		depthAttachment.format = VK_FORMAT_D32_SFLOAT;
-		depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
-		depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-		depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-		depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-		depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-		depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-		depthAttachment.finalLayout =
-						VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+}
 
-		VkAttachmentReference depthAttachmentRef{};
-		depthAttachmentRef.attachment = 1;
-		depthAttachmentRef.layout = 
-						VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+void TextureStreamer::destroy(const Retired& R) {
+	vkDestroyImageView(BP->device, R.view, nullptr);
+	vkDestroyImage(BP->device, R.image, nullptr);
+	vkFreeMemory(BP->device, R.memory, nullptr);
+}
 
-    	VkAttachmentDescription colorAttachment{};
-		colorAttachment.format = swapChainImageFormat;
-		colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
-		colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-		colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-		colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-		colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-		colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-		colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
-		
-		VkAttachmentReference colorAttachmentRef{};
-		colorAttachmentRef.attachment = 0;
-		colorAttachmentRef.layout =
-				VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+void TextureStreamer::work() {
+	std::unique_lock<std::mutex> lock(mutex);
+	while (true) {
+		wake.wait(lock, [&]() { return stopping || !queued.empty(); });
+		if (stopping) {
+			return;
+		}
+		reading.swap(queued);
+		lock.unlock();
 		
-		VkSubpassDescription subpass{};
-		subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-		subpass.colorAttachmentCount = 1;
-		subpass.pColorAttachments = &colorAttachmentRef;
-		subpass.pDepthStencilAttachment = &depthAttachmentRef;
+		// Touching every page of the levels to upload brings them in
+		// memory, so that staging them does not wait for the disk
+		for (const Job& job : reading) {
+			const Texture *T = job.T;
+			const TextureMip& last = T->mips.back();
+			volatile stbi_uc sum = 0;
+			for (const stbi_uc *p = T->pixels + T->mips[job.level].offset;
+				 p < T->pixels + last.offset + last.size; p += 4096) {
+				sum += *p;
+			}
+		}
 		
-		VkSubpassDependency dependency{};
-		dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-		dependency.dstSubpass = 0;
-		dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-		dependency.srcAccessMask = 0;
-		dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-		dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-
-		std::array<VkAttachmentDescription, 2> attachments =
-								{colorAttachment, depthAttachment};
+		lock.lock();
+		ready.insert(ready.end(), reading.begin(), reading.end());
+		reading.clear();
+		wake.notify_all();
+	}
+}
 
-		VkRenderPassCreateInfo renderPassInfo{};
-		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-		renderPassInfo.attachmentCount = static_cast<uint32_t>(attachments.size());;
-		renderPassInfo.pAttachments = attachments.data();
-		renderPassInfo.subpassCount = 1;
-		renderPassInfo.pSubpasses = &subpass;
-		renderPassInfo.dependencyCount = 1;
-		renderPassInfo.pDependencies = &dependency;
+void TextureStreamer::stop() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	if (worker.joinable()) {
+		worker.join();
+	}
+}
 
-		VkResult result = vkCreateRenderPass(device, &renderPassInfo, nullptr,
-					&renderPass);
-		if (result != VK_SUCCESS) {
-		 	PrintVkError(result);
-			throw std::runtime_error("failed to create render pass!");
-		}		
+void TextureStreamer::cleanup() {
+	stop();
+	for (const Retired& R : retired) {
+		destroy(R);
 	}
+	retired.clear();
+}
 
-	// Lesson 22.2 
-    void createFramebuffers() {
-		swapChainFramebuffers.resize(swapChainImageViews.size());
-		for (size_t i = 0; i < swapChainImageViews.size(); i++) {
-			std::array<VkImageView, 2> attachments = {
-				swapChainImageViews[i],
-				depthImageView
-			};
+const float *MipBuilder::linearTable() {
+	static float table[256];
+	static std::once_flag built;
+	std::call_once(built, []() {
+		for (int v = 0; v < 256; v++) {
+			float c = v / 255.0f;
+			table[v] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+		}
+	});
+	return table;
+}
 
-			VkFramebufferCreateInfo framebufferInfo{};
-			framebufferInfo.sType =
-				VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-			framebufferInfo.renderPass = renderPass;
-			framebufferInfo.attachmentCount =
-							static_cast<uint32_t>(attachments.size());;
-			framebufferInfo.pAttachments = attachments.data();
-			framebufferInfo.width = swapChainExtent.width; 
-			framebufferInfo.height = swapChainExtent.height;
-			framebufferInfo.layers = 1;
-			
-			VkResult result = vkCreateFramebuffer(device, &framebufferInfo, nullptr,
-						&swapChainFramebuffers[i]);
-			if (result != VK_SUCCESS) {
-			 	PrintVkError(result);
-				throw std::runtime_error("failed to create framebuffer!");
-			}
+const uint8_t *MipBuilder::srgbTable() {
+	// Indexed by linear values in 4096ths
+	static uint8_t table[4096];
+	static std::once_flag built;
+	std::call_once(built, []() {
+		for (int v = 0; v < 4096; v++) {
+			float l = (v + 0.5f) / 4096.0f;
+			float c = l <= 0.0031308f ? l * 12.92f : 1.055f * std::pow(l, 1.0f / 2.4f) - 0.055f;
+			table[v] = static_cast<uint8_t>(std::min(255.0f, c * 255.0f + 0.5f));
 		}
+	});
+	return table;
+}
+
+void MipBuilder::parallelRows(uint32_t rows, uint32_t width,
+							  const std::function<void(uint32_t, uint32_t)>& work) {
+	// Below this many texels per thread, starting one costs more than it saves
+	const size_t minTexels = 64 * 1024;
+	size_t threadCount = std::min<size_t>({std::max(1u, std::thread::hardware_concurrency()),
+										   std::max<size_t>(1, static_cast<size_t>(rows) * width / minTexels),
+										   rows});
+	std::vector<std::thread> workers;
+	for (size_t t = 1; t < threadCount; t++) {
+		workers.emplace_back(work, static_cast<uint32_t>(rows * t / threadCount),
+							 static_cast<uint32_t>(rows * (t + 1) / threadCount));
+	}
+	work(0, static_cast<uint32_t>(rows / threadCount));
+	for (auto& t : workers) {
+		t.join();
 	}
+}
 
-	// Lesson 13
-    void createCommandPool() {
-    	QueueFamilyIndices queueFamilyIndices = 
-    			findQueueFamilies(physicalDevice);
-    			
-		VkCommandPoolCreateInfo poolInfo{};
-		poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-		poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
-		poolInfo.flags = 0; // Optional
-		
-		VkResult result = vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool);
-		if (result != VK_SUCCESS) {
-		 	PrintVkError(result);
-			throw std::runtime_error("failed to create command pool!");
+void MipBuilder::build(const uint8_t *level0, const std::vector<TextureMip>& mips,
+					   bool srgb, MipFilter filter, bool wrap, uint8_t *levels) {
+	memcpy(levels + mips[0].offset, level0, mips[0].size);
+	if (mips.size() == 1) {
+		return;
+	}
+	
+	const float *toLinear = linearTable();
+	uint32_t width = mips[0].width;
+	std::vector<float> current(4 * static_cast<size_t>(width) * mips[0].height);
+	std::vector<float> next, scratch;
+	parallelRows(mips[0].height, width, [&](uint32_t begin, uint32_t end) {
+		for (size_t i = 4 * static_cast<size_t>(begin) * width;
+			 i < 4 * static_cast<size_t>(end) * width; i++) {
+			current[i] = srgb && (i & 3) != 3 ? toLinear[level0[i]] : level0[i] / 255.0f;
+		}
+	});
+	
+	for (size_t i = 1; i < mips.size(); i++) {
+		const TextureMip& src = mips[i - 1];
+		const TextureMip& dst = mips[i];
+		next.resize(4 * static_cast<size_t>(dst.width) * dst.height);
+		if (filter == MIP_FILTER_KAISER) {
+			kaiserLevel(current.data(), src.width, src.height,
+						next.data(), dst.width, dst.height, wrap, scratch);
+		} else {
+			boxLevel(current.data(), src.width, src.height,
+					 next.data(), dst.width, dst.height, wrap);
 		}
+		store(next.data(), dst.width, dst.height, srgb, levels + dst.offset);
+		current.swap(next);
 	}
+}
 
-	// Lesson 22.1
-	void createDepthResources() {
-		VkFormat depthFormat = VK_FORMAT_D32_SFLOAT;
-		
-		createImage(swapChainExtent.width, swapChainExtent.height, 1, depthFormat,
-					VK_IMAGE_TILING_OPTIMAL,
-					VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
-					VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-					depthImage, depthImageMemory);
-		depthImageView = createImageView(depthImage, depthFormat,
-										 VK_IMAGE_ASPECT_DEPTH_BIT, 1);
+void MipBuilder::boxLevel(const float *src, uint32_t srcWidth, uint32_t srcHeight,
+						  float *dst, uint32_t dstWidth, uint32_t dstHeight, bool wrap) {
+	parallelRows(dstHeight, dstWidth, [=](uint32_t begin, uint32_t end) {
+		for (uint32_t y = begin; y < end; y++) {
+			// Odd sizes repeat their last row / column, or their first
+			// one when wrapping
+			const float *row0 = src + 4 * static_cast<size_t>(srcWidth) * border(2 * y, srcHeight, wrap);
+			const float *row1 = src + 4 * static_cast<size_t>(srcWidth) * border(2 * y + 1, srcHeight, wrap);
+			float *out = dst + 4 * static_cast<size_t>(dstWidth) * y;
+			for (uint32_t x = 0; x < dstWidth; x++, out += 4) {
+				uint32_t x0 = 4 * border(2 * x, srcWidth, wrap);
+				uint32_t x1 = 4 * border(2 * x + 1, srcWidth, wrap);
+#ifdef BR_SSE2
+				__m128 sum = _mm_add_ps(_mm_add_ps(_mm_loadu_ps(row0 + x0), _mm_loadu_ps(row0 + x1)),
+										_mm_add_ps(_mm_loadu_ps(row1 + x0), _mm_loadu_ps(row1 + x1)));
+				_mm_storeu_ps(out, _mm_mul_ps(sum, _mm_set1_ps(0.25f)));
+#else
+				for (int c = 0; c < 4; c++) {
+					out[c] = 0.25f * (row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c]);
+				}
+#endif
+			}
+		}
+	});
+}
+
+uint32_t MipBuilder::border(int i, uint32_t size, bool wrap) {
+	int n = static_cast<int>(size);
+	if (wrap) {
+		return static_cast<uint32_t>((i % n + n) % n);
 	}
+	return static_cast<uint32_t>(std::clamp(i, 0, n - 1));
+}
 
-	// Lesson 22.1
-	void createImage(uint32_t width, uint32_t height,
-					 uint32_t mipLevels, // New in Lesson 23
-					 VkFormat format,
-				 	 VkImageTiling tiling, VkImageUsageFlags usage,
-				 	 VkMemoryPropertyFlags properties, VkImage& image,
-				 	 VkDeviceMemory& imageMemory) {		
-		VkImageCreateInfo imageInfo{};
-		imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
-		imageInfo.imageType = VK_IMAGE_TYPE_2D;
-		imageInfo.extent.width = width;
-		imageInfo.extent.height = height;
-		imageInfo.extent.depth = 1;
-		imageInfo.mipLevels = mipLevels;
-		imageInfo.arrayLayers = 1;
-		imageInfo.format = format;
-		imageInfo.tiling = tiling;
-		imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-		imageInfo.usage = usage;
-		imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-		imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
-		imageInfo.flags = 0; // Optional
-		
-		VkResult result = vkCreateImage(device, &imageInfo, nullptr, &image);
-		if (result != VK_SUCCESS) {
-		 	PrintVkError(result);
-		 	throw std::runtime_error("failed to create image!");
+void MipBuilder::kaiserTaps(uint32_t srcSize, uint32_t dstSize, bool wrap,
+							std::vector<uint32_t>& indices, std::vector<float>& weights) {
+	// Windowed sinc 3 destination texels wide on each side, alpha 4
+	const float width = 3.0f, alpha = 4.0f;
+	auto bessel0 = [](float x) {
+		float sum = 1.0f, term = 1.0f;
+		for (int k = 1; k < 20; k++) {
+			term *= (x / (2.0f * k)) * (x / (2.0f * k));
+			sum += term;
 		}
-		
-		VkMemoryRequirements memRequirements;
-		vkGetImageMemoryRequirements(device, image, &memRequirements);
+		return sum;
+	};
+	auto kaiser = [&](float t) {
+		float window = t / width;
+		if (std::abs(window) >= 1.0f) {
+			return 0.0f;
+		}
+		float sinc = t == 0.0f ? 1.0f : std::sin(glm::pi<float>() * t) / (glm::pi<float>() * t);
+		return sinc * bessel0(alpha * std::sqrt(1.0f - window * window)) / bessel0(alpha);
+	};
+	
+	float scale = static_cast<float>(srcSize) / dstSize;
+	int taps = 2 * static_cast<int>(std::ceil(width * scale)) + 1;
+	indices.resize(static_cast<size_t>(dstSize) * taps);
+	weights.resize(static_cast<size_t>(dstSize) * taps);
+	for (uint32_t x = 0; x < dstSize; x++) {
+		float center = (x + 0.5f) * scale;
+		int first = static_cast<int>(std::floor(center - width * scale));
+		float total = 0.0f;
+		for (int k = 0; k < taps; k++) {
+			int i = first + k;
+			float w = kaiser((i + 0.5f - center) / scale);
+			indices[x * taps + k] = border(i, srcSize, wrap);
+			weights[x * taps + k] = w;
+			total += w;
+		}
+		for (int k = 0; k < taps; k++) {
+			weights[x * taps + k] /= total;
+		}
+	}
+}
 
-		VkMemoryAllocateInfo allocInfo{};
-		allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-		allocInfo.allocationSize = memRequirements.size;
-		allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits,
-											properties);
-		if (vkAllocateMemory(device, &allocInfo, nullptr, &imageMemory) !=
-								VK_SUCCESS) {
-			throw std::runtime_error("failed to allocate image memory!");
+void MipBuilder::kaiserLevel(const float *src, uint32_t srcWidth, uint32_t srcHeight,
+							 float *dst, uint32_t dstWidth, uint32_t dstHeight, bool wrap,
+							 std::vector<float>& scratch) {
+	std::vector<uint32_t> columns, rows;
+	std::vector<float> columnWeights, rowWeights;
+	kaiserTaps(srcWidth, dstWidth, wrap, columns, columnWeights);
+	kaiserTaps(srcHeight, dstHeight, wrap, rows, rowWeights);
+	size_t columnTaps = columns.size() / dstWidth;
+	size_t rowTaps = rows.size() / dstHeight;
+	
+	// Separable: rows into scratch (dstWidth x srcHeight), then columns
+	auto filter = [](const float *in, size_t stride, const uint32_t *index,
+					 const float *weight, size_t taps, float *out, bool clamp) {
+#ifdef BR_SSE2
+		__m128 sum = _mm_setzero_ps();
+		for (size_t k = 0; k < taps; k++) {
+			sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(in + stride * index[k]),
+											 _mm_set1_ps(weight[k])));
+		}
+		if (clamp) {
+			// The negative lobes ring around sharp edges
+			sum = _mm_min_ps(_mm_max_ps(sum, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+		}
+		_mm_storeu_ps(out, sum);
+#else
+		for (int c = 0; c < 4; c++) {
+			float sum = 0.0f;
+			for (size_t k = 0; k < taps; k++) {
+				sum += in[stride * index[k] + c] * weight[k];
+			}
+			out[c] = clamp ? std::clamp(sum, 0.0f, 1.0f) : sum;
+		}
+#endif
+	};
+	
+	scratch.resize(4 * static_cast<size_t>(dstWidth) * srcHeight);
+	float *horizontal = scratch.data();
+	parallelRows(srcHeight, dstWidth, [&](uint32_t begin, uint32_t end) {
+		for (uint32_t y = begin; y < end; y++) {
+			const float *in = src + 4 * static_cast<size_t>(srcWidth) * y;
+			float *out = horizontal + 4 * static_cast<size_t>(dstWidth) * y;
+			for (uint32_t x = 0; x < dstWidth; x++) {
+				filter(in, 4, &columns[x * columnTaps], &columnWeights[x * columnTaps],
+					   columnTaps, out + 4 * x, false);
+			}
+		}
+	});
+	parallelRows(dstHeight, dstWidth, [&](uint32_t begin, uint32_t end) {
+		for (uint32_t y = begin; y < end; y++) {
+			float *out = dst + 4 * static_cast<size_t>(dstWidth) * y;
+			for (uint32_t x = 0; x < dstWidth; x++) {
+				filter(horizontal + 4 * x, 4 * static_cast<size_t>(dstWidth),
+					   &rows[y * rowTaps], &rowWeights[y * rowTaps], rowTaps, out + 4 * x, true);
+			}
 		}
+	});
+}
 
-		vkBindImageMemory(device, image, imageMemory, 0);
+void MipBuilder::store(const float *linear, uint32_t width, uint32_t height,
+					   bool srgb, uint8_t *out) {
+	const uint8_t *toSrgb = srgbTable();
+	parallelRows(height, width, [=](uint32_t begin, uint32_t end) {
+		for (size_t i = static_cast<size_t>(begin) * width;
+			 i < static_cast<size_t>(end) * width; i++) {
+			// sRGB color goes through the table, in 4096ths; the rest is
+			// rounded to 8 bits
+			int32_t v[4];
+#ifdef BR_SSE2
+			__m128 scale = srgb ? _mm_setr_ps(4096.0f, 4096.0f, 4096.0f, 255.0f) : _mm_set1_ps(255.0f);
+			__m128 bias = srgb ? _mm_setr_ps(0.0f, 0.0f, 0.0f, 0.5f) : _mm_set1_ps(0.5f);
+			__m128 l = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(linear + 4 * i), _mm_setzero_ps()),
+								  _mm_set1_ps(1.0f));
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(v),
+							 _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(l, scale), bias)));
+#else
+			for (int c = 0; c < 4; c++) {
+				float l = std::clamp(linear[4 * i + c], 0.0f, 1.0f);
+				v[c] = srgb && c < 3 ? static_cast<int32_t>(l * 4096.0f) :
+									   static_cast<int32_t>(l * 255.0f + 0.5f);
+			}
+#endif
+			for (int c = 0; c < 4; c++) {
+				out[4 * i + c] = srgb && c < 3 ? toSrgb[std::min(v[c], 4095)] :
+												 static_cast<uint8_t>(v[c]);
+			}
+		}
+	});
+}
+
+// Interpolation weights of the 4 bit BC7 indices, in 64ths
+const int BC7_WEIGHTS[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+VkFormat BlockCompressor::choose(const uint8_t *rgba, size_t texels, VkFormat format,
+								 bool highQuality) {
+	bool opaque = true, gray = true, noBlue = true;
+	for (size_t i = 0; i < texels; i++) {
+		const uint8_t *t = rgba + 4 * i;
+		opaque = opaque && t[3] == 255;
+		gray = gray && t[0] == t[1] && t[1] == t[2];
+		noBlue = noBlue && t[2] == 0;
+	}
+	
+	bool srgb = format == VK_FORMAT_R8G8B8A8_SRGB;
+	if (!srgb && opaque && gray) {
+		return VK_FORMAT_BC4_UNORM_BLOCK;
+	}
+	if (!srgb && opaque && noBlue) {
+		return VK_FORMAT_BC5_UNORM_BLOCK;
+	}
+	if (highQuality) {
+		return srgb ? VK_FORMAT_BC7_SRGB_BLOCK : VK_FORMAT_BC7_UNORM_BLOCK;
+	}
+	if (!opaque) {
+		return srgb ? VK_FORMAT_BC3_SRGB_BLOCK : VK_FORMAT_BC3_UNORM_BLOCK;
 	}
+	return srgb ? VK_FORMAT_BC1_RGB_SRGB_BLOCK : VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+}
 
-	// New - Lesson 23
-	void generateMipmaps(VkImage image, VkFormat imageFormat,
-						 int32_t texWidth, int32_t texHeight,
-						 uint32_t mipLevels) {
-		VkFormatProperties formatProperties;
-		vkGetPhysicalDeviceFormatProperties(physicalDevice, imageFormat,
-							&formatProperties);
+bool BlockCompressor::isCompressed(VkFormat format) {
+	return blockBytes(format) != 0;
+}
 
-		if (!(formatProperties.optimalTilingFeatures &
-					VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT)) {
-			throw std::runtime_error("texture image format does not support linear blitting!");
-		}
+VkDeviceSize BlockCompressor::blockBytes(VkFormat format) {
+	switch (format) {
+		case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+		case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+		case VK_FORMAT_BC4_UNORM_BLOCK:
+			return 8;
+		case VK_FORMAT_BC3_SRGB_BLOCK:
+		case VK_FORMAT_BC3_UNORM_BLOCK:
+		case VK_FORMAT_BC5_UNORM_BLOCK:
+		case VK_FORMAT_BC7_SRGB_BLOCK:
+		case VK_FORMAT_BC7_UNORM_BLOCK:
+			return 16;
+		default:
+			return 0;
+	}
+}
 
-		VkCommandBuffer commandBuffer = beginSingleTimeCommands();
-		
-		VkImageMemoryBarrier barrier{};
-		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-		barrier.image = image;
-		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-		barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		barrier.subresourceRange.baseArrayLayer = 0;
-		barrier.subresourceRange.layerCount = 1;
-		barrier.subresourceRange.levelCount = 1;
+VkDeviceSize BlockCompressor::levelBytes(VkFormat format, uint32_t width, uint32_t height) {
+	return blockBytes(format) * ((width + 3) / 4) * ((height + 3) / 4);
+}
 
-		int32_t mipWidth = texWidth;
-		int32_t mipHeight = texHeight;
+VkFormat BlockCompressor::decodedFormat(VkFormat format) {
+	switch (format) {
+		case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+		case VK_FORMAT_BC3_SRGB_BLOCK:
+		case VK_FORMAT_BC7_SRGB_BLOCK:
+			return VK_FORMAT_R8G8B8A8_SRGB;
+		default:
+			return VK_FORMAT_R8G8B8A8_UNORM;
+	}
+}
 
-		for (uint32_t i = 1; i < mipLevels; i++) { 
-			barrier.subresourceRange.baseMipLevel = i - 1;
-			barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-			barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-			barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-			barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-			
-			vkCmdPipelineBarrier(commandBuffer,
-								 VK_PIPELINE_STAGE_TRANSFER_BIT,
-								 VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
-								 0, nullptr, 0, nullptr,
-								 1, &barrier);
+VkComponentMapping BlockCompressor::components(VkFormat format) {
+	if (format == VK_FORMAT_BC4_UNORM_BLOCK) {
+		// Grayscale: samples as the RGBA8 image it was encoded from
+		return {VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_R,
+				VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_ONE};
+	}
+	return {};
+}
 
-			VkImageBlit blit{};
-			blit.srcOffsets[0] = { 0, 0, 0 };
-			blit.srcOffsets[1] = { mipWidth, mipHeight, 1 };
-			blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-			blit.srcSubresource.mipLevel = i - 1;
-			blit.srcSubresource.baseArrayLayer = 0;
-			blit.srcSubresource.layerCount = 1;
-			blit.dstOffsets[0] = { 0, 0, 0 };
-			blit.dstOffsets[1] = { mipWidth > 1 ? mipWidth / 2 : 1,
-								   mipHeight > 1 ? mipHeight/2:1, 1};
-			blit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-			blit.dstSubresource.mipLevel = i;
-			blit.dstSubresource.baseArrayLayer = 0;
-			blit.dstSubresource.layerCount = 1;
+void BlockCompressor::encode(VkFormat format, const uint8_t *rgba,
+							 uint32_t width, uint32_t height, uint8_t *blocks) {
+	VkDeviceSize stride = blockBytes(format);
+	for (uint32_t by = 0; by < height; by += 4) {
+		for (uint32_t bx = 0; bx < width; bx += 4) {
+			// Blocks crossing the border repeat the last row / column
+			Block texels;
+			for (uint32_t i = 0; i < 16; i++) {
+				uint32_t x = std::min(bx + (i & 3), width - 1);
+				uint32_t y = std::min(by + (i >> 2), height - 1);
+				const uint8_t *t = rgba + 4 * (static_cast<size_t>(y) * width + x);
+				for (int c = 0; c < 4; c++) {
+					texels[c][i] = t[c];
+				}
+			}
 			
-			vkCmdBlitImage(commandBuffer, image,
-						   VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-						   image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1,
-						   &blit, VK_FILTER_LINEAR);
+			switch (format) {
+				case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+				case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+					encodeBC1(texels, blocks);
+					break;
+				case VK_FORMAT_BC3_SRGB_BLOCK:
+				case VK_FORMAT_BC3_UNORM_BLOCK:
+					encodeBC4(texels[3], blocks);
+					encodeBC1(texels, blocks + 8);
+					break;
+				case VK_FORMAT_BC4_UNORM_BLOCK:
+					encodeBC4(texels[0], blocks);
+					break;
+				case VK_FORMAT_BC5_UNORM_BLOCK:
+					encodeBC4(texels[0], blocks);
+					encodeBC4(texels[1], blocks + 8);
+					break;
+				case VK_FORMAT_BC7_SRGB_BLOCK:
+				case VK_FORMAT_BC7_UNORM_BLOCK:
+					encodeBC7(texels, blocks);
+					break;
+				default:
+					throw std::runtime_error("unsupported block compression format!");
+			}
+			blocks += stride;
+		}
+	}
+}
 
-			barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-			barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-			barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-			barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+void BlockCompressor::decode(VkFormat format, const uint8_t *blocks,
+							 uint32_t width, uint32_t height, uint8_t *rgba) {
+	VkDeviceSize stride = blockBytes(format);
+	for (uint32_t by = 0; by < height; by += 4) {
+		for (uint32_t bx = 0; bx < width; bx += 4) {
+			uint8_t texels[16][4];
+			for (auto& t : texels) {
+				t[0] = t[1] = t[2] = 0;
+				t[3] = 255;
+			}
 			
-			vkCmdPipelineBarrier(commandBuffer,
-								 VK_PIPELINE_STAGE_TRANSFER_BIT,
-								 VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
-								 0, nullptr, 0, nullptr,
-								 1, &barrier);
-			if (mipWidth > 1) mipWidth /= 2;
-			if (mipHeight > 1) mipHeight /= 2;
+			switch (format) {
+				case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+				case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+					decodeBC1(blocks, texels);
+					break;
+				case VK_FORMAT_BC3_SRGB_BLOCK:
+				case VK_FORMAT_BC3_UNORM_BLOCK:
+					decodeBC1(blocks + 8, texels);
+					decodeBC4(blocks, texels, 3);
+					break;
+				case VK_FORMAT_BC4_UNORM_BLOCK:
+					decodeBC4(blocks, texels, 0);
+					for (auto& t : texels) {
+						t[1] = t[2] = t[0];
+					}
+					break;
+				case VK_FORMAT_BC5_UNORM_BLOCK:
+					decodeBC4(blocks, texels, 0);
+					decodeBC4(blocks + 8, texels, 1);
+					break;
+				case VK_FORMAT_BC7_SRGB_BLOCK:
+				case VK_FORMAT_BC7_UNORM_BLOCK:
+					decodeBC7(blocks, texels);
+					break;
+				default:
+					throw std::runtime_error("unsupported block compression format!");
+			}
+			blocks += stride;
+			
+			for (uint32_t i = 0; i < 16; i++) {
+				uint32_t x = bx + (i & 3), y = by + (i >> 2);
+				if (x < width && y < height) {
+					memcpy(rgba + 4 * (static_cast<size_t>(y) * width + x), texels[i], 4);
+				}
+			}
 		}
-
-		barrier.subresourceRange.baseMipLevel = mipLevels - 1;
-		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-		barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-		vkCmdPipelineBarrier(commandBuffer,
-							 VK_PIPELINE_STAGE_TRANSFER_BIT,
-							 VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
-							 0, nullptr, 0, nullptr,
-							 1, &barrier);
-
-		endSingleTimeCommands(commandBuffer);
 	}
-	
-	// New - Lesson 23
-	void transitionImageLayout(VkImage image, VkFormat format,
-					VkImageLayout oldLayout, VkImageLayout newLayout,
-					uint32_t mipLevels) {
-		VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+}
 
-		VkImageMemoryBarrier barrier{};
-		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-		barrier.oldLayout = oldLayout;
-		barrier.newLayout = newLayout;
-		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-		barrier.image = image;
+float BlockCompressor::fitIndices(const Block& texels, int channels,
+								  const float palette[][4], int entries, uint8_t indices[16]) {
+	float error = 0.0f;
+#ifdef BR_SSE2
+	// 4 texels at a time, keeping the closest entry of each lane
+	for (int i = 0; i < 16; i += 4) {
+		__m128 t[4];
+		for (int c = 0; c < channels; c++) {
+			t[c] = _mm_loadu_ps(&texels[c][i]);
+		}
+		__m128 best = _mm_set1_ps(FLT_MAX);
+		__m128i bestIndex = _mm_setzero_si128();
+		for (int e = 0; e < entries; e++) {
+			__m128 distance = _mm_setzero_ps();
+			for (int c = 0; c < channels; c++) {
+				__m128 d = _mm_sub_ps(t[c], _mm_set1_ps(palette[e][c]));
+				distance = _mm_add_ps(distance, _mm_mul_ps(d, d));
+			}
+			__m128i closer = _mm_castps_si128(_mm_cmplt_ps(distance, best));
+			best = _mm_min_ps(distance, best);
+			bestIndex = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi32(e)),
+									 _mm_andnot_si128(closer, bestIndex));
+		}
 		
-		barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		barrier.subresourceRange.baseMipLevel = 0;
-		barrier.subresourceRange.levelCount = mipLevels;
-		barrier.subresourceRange.baseArrayLayer = 0;
-		barrier.subresourceRange.layerCount = 1;
-
-		barrier.srcAccessMask = 0;
-		barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		alignas(16) int32_t index[4];
+		alignas(16) float distance[4];
+		_mm_store_si128(reinterpret_cast<__m128i *>(index), bestIndex);
+		_mm_store_ps(distance, best);
+		for (int k = 0; k < 4; k++) {
+			indices[i + k] = static_cast<uint8_t>(index[k]);
+			error += distance[k];
+		}
+	}
+#else
+	for (int i = 0; i < 16; i++) {
+		float best = FLT_MAX;
+		for (int e = 0; e < entries; e++) {
+			float distance = 0.0f;
+			for (int c = 0; c < channels; c++) {
+				float d = texels[c][i] - palette[e][c];
+				distance += d * d;
+			}
+			if (distance < best) {
+				best = distance;
+				indices[i] = static_cast<uint8_t>(e);
+			}
+		}
+		error += best;
+	}
+#endif
+	return error;
+}
 
-		vkCmdPipelineBarrier(commandBuffer,
-								VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
-								VK_ACCESS_TRANSFER_WRITE_BIT, 0,
-								0, nullptr, 0, nullptr, 1, &barrier);
+void BlockCompressor::fitEndpoints(const Block& texels, int channels, const float weights[],
+								   const uint8_t indices[16], float e0[4], float e1[4]) {
+	// Least squares endpoints for the chosen indices: weights[index] is
+	// how far the texel lies from e0 towards e1
+	float a = 0.0f, b = 0.0f, c = 0.0f;
+	float x[4] = {}, y[4] = {};
+	for (int i = 0; i < 16; i++) {
+		float w = weights[indices[i]];
+		a += (1.0f - w) * (1.0f - w);
+		b += (1.0f - w) * w;
+		c += w * w;
+		for (int k = 0; k < channels; k++) {
+			x[k] += (1.0f - w) * texels[k][i];
+			y[k] += w * texels[k][i];
+		}
+	}
+	float det = a * c - b * b;
+	if (std::abs(det) < 1e-6f) {
+		// Every texel on the same index
+		return;
+	}
+	for (int k = 0; k < channels; k++) {
+		e0[k] = std::clamp((c * x[k] - b * y[k]) / det, 0.0f, 255.0f);
+		e1[k] = std::clamp((a * y[k] - b * x[k]) / det, 0.0f, 255.0f);
+	}
+}
 
-		endSingleTimeCommands(commandBuffer);
+void BlockCompressor::principalRange(const Block& texels, int channels,
+									 float e0[4], float e1[4]) {
+	float mean[4] = {};
+	for (int k = 0; k < channels; k++) {
+		for (int i = 0; i < 16; i++) {
+			mean[k] += texels[k][i] / 16.0f;
+		}
+	}
+	float covariance[4][4] = {};
+	for (int i = 0; i < 16; i++) {
+		for (int j = 0; j < channels; j++) {
+			for (int k = 0; k < channels; k++) {
+				covariance[j][k] += (texels[j][i] - mean[j]) * (texels[k][i] - mean[k]);
+			}
+		}
 	}
 	
-	// New - Lesson 23
-	void copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t
-						   width, uint32_t height) {
-		VkCommandBuffer commandBuffer = beginSingleTimeCommands();
-		
-		VkBufferImageCopy region{};
-		region.bufferOffset = 0;
-		region.bufferRowLength = 0;
-		region.bufferImageHeight = 0;
-		region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		region.imageSubresource.mipLevel = 0;
-		region.imageSubresource.baseArrayLayer = 0;
-		region.imageSubresource.layerCount = 1;
-		region.imageOffset = {0, 0, 0};
-		region.imageExtent = {width, height, 1};
-		
-		vkCmdCopyBufferToImage(commandBuffer, buffer, image,
-				VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
-
-		endSingleTimeCommands(commandBuffer);
+	// Principal axis by power iteration
+	float axis[4] = {1.0f, 1.0f, 1.0f, 1.0f};
+	for (int iteration = 0; iteration < 8; iteration++) {
+		float next[4] = {};
+		float largest = 0.0f;
+		for (int j = 0; j < channels; j++) {
+			for (int k = 0; k < channels; k++) {
+				next[j] += covariance[j][k] * axis[k];
+			}
+			largest = std::max(largest, std::abs(next[j]));
+		}
+		if (largest < 1e-6f) {
+			// Flat block
+			std::fill(axis, axis + 4, 0.0f);
+			break;
+		}
+		for (int k = 0; k < channels; k++) {
+			axis[k] = next[k] / largest;
+		}
 	}
+	float length = 0.0f;
+	for (int k = 0; k < channels; k++) {
+		length += axis[k] * axis[k];
+	}
+	length = std::sqrt(length);
 	
-	// New - Lesson 23
-	VkCommandBuffer beginSingleTimeCommands() { 
-		VkCommandBufferAllocateInfo allocInfo{};
-		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-		allocInfo.commandPool = commandPool;
-		allocInfo.commandBufferCount = 1;
-		
-		VkCommandBuffer commandBuffer;
-		vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer);
-		
-		VkCommandBufferBeginInfo beginInfo{};
-		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-		
-		vkBeginCommandBuffer(commandBuffer, &beginInfo);
-		
-		return commandBuffer;
+	float low = 0.0f, high = 0.0f;
+	if (length > 0.0f) {
+		for (int k = 0; k < channels; k++) {
+			axis[k] /= length;
+		}
+		low = FLT_MAX;
+		high = -FLT_MAX;
+		for (int i = 0; i < 16; i++) {
+			float t = 0.0f;
+			for (int k = 0; k < channels; k++) {
+				t += (texels[k][i] - mean[k]) * axis[k];
+			}
+			low = std::min(low, t);
+			high = std::max(high, t);
+		}
+		// Inset, the extremes are rarely worth an endpoint each
+		float inset = (high - low) / 16.0f;
+		low += inset;
+		high -= inset;
+	}
+	for (int k = 0; k < channels; k++) {
+		e0[k] = std::clamp(mean[k] + axis[k] * low, 0.0f, 255.0f);
+		e1[k] = std::clamp(mean[k] + axis[k] * high, 0.0f, 255.0f);
 	}
+}
+
+void BlockCompressor::encodeBC1(const Block& texels, uint8_t *out) {
+	static const float weights[4] = {0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f};
+	auto pack = [](const float e[4]) {
+		uint16_t r = static_cast<uint16_t>(std::lround(e[0] * 31.0f / 255.0f));
+		uint16_t g = static_cast<uint16_t>(std::lround(e[1] * 63.0f / 255.0f));
+		uint16_t b = static_cast<uint16_t>(std::lround(e[2] * 31.0f / 255.0f));
+		return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+	};
+	auto unpack = [](uint16_t color, float e[4]) {
+		uint32_t r = color >> 11, g = (color >> 5) & 63, b = color & 31;
+		e[0] = static_cast<float>((r << 3) | (r >> 2));
+		e[1] = static_cast<float>((g << 2) | (g >> 4));
+		e[2] = static_cast<float>((b << 3) | (b >> 2));
+		e[3] = 255.0f;
+	};
 	
-	// New - Lesson 23
-	void endSingleTimeCommands(VkCommandBuffer commandBuffer) {
-		vkEndCommandBuffer(commandBuffer);
-		
-		VkSubmitInfo submitInfo{};
-		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-		submitInfo.commandBufferCount = 1;
-		submitInfo.pCommandBuffers = &commandBuffer;
-		vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
-		vkQueueWaitIdle(graphicsQueue);
+	float e0[4], e1[4];
+	principalRange(texels, 3, e1, e0);
+	uint16_t best0 = 0, best1 = 0;
+	uint8_t bestIndices[16] = {};
+	float bestError = FLT_MAX;
+	// PCA endpoints, then once more with the least squares endpoints
+	for (int pass = 0; pass < 2; pass++) {
+		// color0 > color1 selects the 4 color mode; when they are equal
+		// every texel uses color0
+		uint16_t color0 = pack(e0), color1 = pack(e1);
+		if (color0 < color1) {
+			std::swap(color0, color1);
+		}
+		float palette[4][4];
+		unpack(color0, palette[0]);
+		unpack(color1, palette[1]);
+		for (int k = 0; k < 4; k++) {
+			palette[2][k] = (2.0f * palette[0][k] + palette[1][k]) / 3.0f;
+			palette[3][k] = (palette[0][k] + 2.0f * palette[1][k]) / 3.0f;
+		}
 		
-		vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
+		uint8_t indices[16];
+		float error = fitIndices(texels, 3, palette, color0 == color1 ? 1 : 4, indices);
+		if (error < bestError) {
+			bestError = error;
+			best0 = color0;
+			best1 = color1;
+			memcpy(bestIndices, indices, sizeof(indices));
+		}
+		memcpy(e0, palette[0], sizeof(e0));
+		memcpy(e1, palette[1], sizeof(e1));
+		fitEndpoints(texels, 3, weights, indices, e0, e1);
 	}
 	
+	uint32_t bits = 0;
+	for (int i = 0; i < 16; i++) {
+		bits |= static_cast<uint32_t>(bestIndices[i]) << (2 * i);
+	}
+	out[0] = best0 & 0xFF;
+	out[1] = best0 >> 8;
+	out[2] = best1 & 0xFF;
+	out[3] = best1 >> 8;
+	for (int b = 0; b < 4; b++) {
+		out[4 + b] = (bits >> (8 * b)) & 0xFF;
+	}
+}
 
-
-	// Lesson 22.4
+void BlockCompressor::encodeBC4(const float values[16], uint8_t *out) {
+	float low = *std::min_element(values, values + 16);
+	float high = *std::max_element(values, values + 16);
+	uint8_t value0 = static_cast<uint8_t>(std::lround(high));
+	uint8_t value1 = static_cast<uint8_t>(std::lround(low));
 	
-	// Lesson 21
-	void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage,
-					  VkMemoryPropertyFlags properties,
-					  VkBuffer& buffer, VkDeviceMemory& bufferMemory) {
-		VkBufferCreateInfo bufferInfo{};
-		bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-		bufferInfo.size = size;
-		bufferInfo.usage = usage;
-		bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-		
-		VkResult result =
-				vkCreateBuffer(device, &bufferInfo, nullptr, &buffer);
-		if (result != VK_SUCCESS) {
-		 	PrintVkError(result);
-			throw std::runtime_error("failed to create vertex buffer!");
+	// value0 > value1 selects the 8 value mode; when they are equal every
+	// texel uses value0
+	uint8_t indices[16] = {};
+	if (value0 > value1) {
+		Block texels;
+		std::copy(values, values + 16, texels[0]);
+		float palette[8][4] = {};
+		palette[0][0] = value0;
+		palette[1][0] = value1;
+		for (int i = 2; i < 8; i++) {
+			palette[i][0] = ((8 - i) * value0 + (i - 1) * value1) / 7.0f;
 		}
-		
-		VkMemoryRequirements memRequirements;
-		vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
-		
-		VkMemoryAllocateInfo allocInfo{};
-		allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-		allocInfo.allocationSize = memRequirements.size;
-		allocInfo.memoryTypeIndex =
-				findMemoryType(memRequirements.memoryTypeBits, properties);
+		fitIndices(texels, 1, palette, 8, indices);
+	}
+	
+	uint64_t bits = 0;
+	for (int i = 0; i < 16; i++) {
+		bits |= static_cast<uint64_t>(indices[i]) << (3 * i);
+	}
+	out[0] = value0;
+	out[1] = value1;
+	for (int b = 0; b < 6; b++) {
+		out[2 + b] = (bits >> (8 * b)) & 0xFF;
+	}
+}
 
-		result = vkAllocateMemory(device, &allocInfo, nullptr,
-				&bufferMemory);
-		if (result != VK_SUCCESS) {
-		 	PrintVkError(result);
-			throw std::runtime_error("failed to allocate vertex buffer memory!");
+void BlockCompressor::encodeBC7(const Block& texels, uint8_t *out) {
+	// Mode 6 only: one subset, RGBA endpoints of 7 bits plus a p-bit
+	// (shared lowest bit) each, 4 bit indices
+	float weights[16];
+	for (int i = 0; i < 16; i++) {
+		weights[i] = BC7_WEIGHTS[i] / 64.0f;
+	}
+	
+	float e[2][4];
+	principalRange(texels, 4, e[0], e[1]);
+	uint8_t bestEndpoints[2][4] = {}, bestP[2] = {}, bestIndices[16] = {};
+	float bestError = FLT_MAX;
+	for (int pass = 0; pass < 2; pass++) {
+		uint8_t endpoints[2][4], p[2];
+		float palette[16][4];
+		int ends[2][4];
+		for (int k = 0; k < 2; k++) {
+			float pError = FLT_MAX;
+			for (int bit = 0; bit < 2; bit++) {
+				uint8_t q[4];
+				float error = 0.0f;
+				for (int c = 0; c < 4; c++) {
+					q[c] = static_cast<uint8_t>(std::clamp<long>(
+								std::lround((e[k][c] - bit) / 2.0f), 0, 127));
+					float d = (q[c] * 2 + bit) - e[k][c];
+					error += d * d;
+				}
+				if (error < pError) {
+					pError = error;
+					memcpy(endpoints[k], q, sizeof(q));
+					p[k] = static_cast<uint8_t>(bit);
+				}
+			}
+			for (int c = 0; c < 4; c++) {
+				ends[k][c] = endpoints[k][c] * 2 + p[k];
+			}
+		}
+		for (int i = 0; i < 16; i++) {
+			for (int c = 0; c < 4; c++) {
+				palette[i][c] = static_cast<float>(((64 - BC7_WEIGHTS[i]) * ends[0][c] +
+													BC7_WEIGHTS[i] * ends[1][c] + 32) >> 6);
+			}
 		}
 		
-		vkBindBufferMemory(device, buffer, bufferMemory, 0);	
+		uint8_t indices[16];
+		float error = fitIndices(texels, 4, palette, 16, indices);
+		if (error < bestError) {
+			bestError = error;
+			memcpy(bestEndpoints, endpoints, sizeof(endpoints));
+			memcpy(bestP, p, sizeof(p));
+			memcpy(bestIndices, indices, sizeof(indices));
+		}
+		fitEndpoints(texels, 4, weights, indices, e[0], e[1]);
 	}
 	
-	// Lesson 21
-	uint32_t findMemoryType(uint32_t typeFilter,
-							VkMemoryPropertyFlags properties) {
-		 VkPhysicalDeviceMemoryProperties memProperties;
-		 vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
-		 
-		 for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
-		 	if ((typeFilter & (1 << i)) && 
-		 		(memProperties.memoryTypes[i].propertyFlags & properties) ==
-		 				properties) {
-				return i;
-			}
+	// The first index is stored without its top bit, which must be 0
+	if (bestIndices[0] & 8) {
+		std::swap(bestEndpoints[0], bestEndpoints[1]);
+		std::swap(bestP[0], bestP[1]);
+		for (uint8_t& index : bestIndices) {
+			index = 15 - index;
+		}
+	}
+	
+	memset(out, 0, 16);
+	int position = 0;
+	auto put = [out, &position](uint32_t value, int bits) {
+		for (int b = 0; b < bits; b++, position++) {
+			out[position >> 3] |= static_cast<uint8_t>(((value >> b) & 1) << (position & 7));
 		}
-		
-		throw std::runtime_error("failed to find suitable memory type!");
+	};
+	put(1 << 6, 7);
+	for (int c = 0; c < 4; c++) {
+		put(bestEndpoints[0][c], 7);
+		put(bestEndpoints[1][c], 7);
 	}
-    
-    // Lesson 21
-	void createDescriptorPool() {
-		std::array<VkDescriptorPoolSize, 2> poolSizes{};
-		poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-		poolSizes[0].descriptorCount = static_cast<uint32_t>(uniformBlocksInPool *
-															 swapChainImages.size());
-		// New - Lesson 23
-		poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-		poolSizes[1].descriptorCount = static_cast<uint32_t>(texturesInPool *
-															 swapChainImages.size());
-		//
+	put(bestP[0], 1);
+	put(bestP[1], 1);
+	for (int i = 0; i < 16; i++) {
+		put(bestIndices[i], i == 0 ? 3 : 4);
+	}
+}
 
-		VkDescriptorPoolCreateInfo poolInfo{};
-		poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-		poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());;
-		poolInfo.pPoolSizes = poolSizes.data();
-		poolInfo.maxSets = static_cast<uint32_t>(setsInPool * swapChainImages.size());
-		
-		VkResult result = vkCreateDescriptorPool(device, &poolInfo, nullptr,
-									&descriptorPool);
-		if (result != VK_SUCCESS) {
-		 	PrintVkError(result);
-			throw std::runtime_error("failed to create descriptor pool!");
+void BlockCompressor::decodeBC1(const uint8_t *in, uint8_t texels[16][4]) {
+	uint16_t color0 = static_cast<uint16_t>(in[0] | (in[1] << 8));
+	uint16_t color1 = static_cast<uint16_t>(in[2] | (in[3] << 8));
+	int colors[4][3];
+	for (int k = 0; k < 2; k++) {
+		uint32_t color = k ? color1 : color0;
+		uint32_t r = color >> 11, g = (color >> 5) & 63, b = color & 31;
+		colors[k][0] = (r << 3) | (r >> 2);
+		colors[k][1] = (g << 2) | (g >> 4);
+		colors[k][2] = (b << 3) | (b >> 2);
+	}
+	for (int c = 0; c < 3; c++) {
+		if (color0 > color1) {
+			colors[2][c] = (2 * colors[0][c] + colors[1][c] + 1) / 3;
+			colors[3][c] = (colors[0][c] + 2 * colors[1][c] + 1) / 3;
+		} else {
+			colors[2][c] = (colors[0][c] + colors[1][c]) / 2;
+			colors[3][c] = 0;
 		}
 	}
 	
-	virtual void populateCommandBuffer(VkCommandBuffer commandBuffer, int i) = 0;
+	uint32_t bits = in[4] | (in[5] << 8) | (in[6] << 16) | (static_cast<uint32_t>(in[7]) << 24);
+	for (int i = 0; i < 16; i++) {
+		const int *color = colors[(bits >> (2 * i)) & 3];
+		for (int c = 0; c < 3; c++) {
+			texels[i][c] = static_cast<uint8_t>(color[c]);
+		}
+	}
+}
 
-	// Lesson 22.5 (and 13)
-    void createCommandBuffers() {
-    	// Lesson 13
-    	commandBuffers.resize(swapChainFramebuffers.size());
-    	
-    	VkCommandBufferAllocateInfo allocInfo{};
-		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-		allocInfo.commandPool = commandPool;
-		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-		allocInfo.commandBufferCount = (uint32_t) commandBuffers.size();
-		
-		VkResult result = vkAllocateCommandBuffers(device, &allocInfo,
-				commandBuffers.data());
-		if (result != VK_SUCCESS) {
-		 	PrintVkError(result);
-			throw std::runtime_error("failed to allocate command buffers!");
+void BlockCompressor::decodeBC4(const uint8_t *in, uint8_t texels[16][4], int channel) {
+	int values[8] = {in[0], in[1]};
+	if (values[0] > values[1]) {
+		for (int i = 2; i < 8; i++) {
+			values[i] = ((8 - i) * values[0] + (i - 1) * values[1] + 3) / 7;
 		}
-		
-		// Lesson 22.5 --- Draw calls
-		// This is where the commands that actually draw something on screen are!
-		for (size_t i = 0; i < commandBuffers.size(); i++) {
-			VkCommandBufferBeginInfo beginInfo{};
-			beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-			beginInfo.flags = 0; // Optional
-			beginInfo.pInheritanceInfo = nullptr; // Optional
+	} else {
+		for (int i = 2; i < 6; i++) {
+			values[i] = ((6 - i) * values[0] + (i - 1) * values[1] + 2) / 5;
+		}
+		values[6] = 0;
+		values[7] = 255;
+	}
+	
+	uint64_t bits = 0;
+	for (int b = 0; b < 6; b++) {
+		bits |= static_cast<uint64_t>(in[2 + b]) << (8 * b);
+	}
+	for (int i = 0; i < 16; i++) {
+		texels[i][channel] = static_cast<uint8_t>(values[(bits >> (3 * i)) & 7]);
+	}
+}
 
-			if (vkBeginCommandBuffer(commandBuffers[i], &beginInfo) !=
-						VK_SUCCESS) {
-				throw std::runtime_error("failed to begin recording command buffer!");
-			}
-			
-			VkRenderPassBeginInfo renderPassInfo{};
-			renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-			renderPassInfo.renderPass = renderPass; 
-			renderPassInfo.framebuffer = swapChainFramebuffers[i];
-			renderPassInfo.renderArea.offset = {0, 0};
-			renderPassInfo.renderArea.extent = swapChainExtent;
-	
-			std::array<VkClearValue, 2> clearValues{};
-			clearValues[0].color = initialBackgroundColor;
-			clearValues[1].depthStencil = {1.0f, 0};
-	
-			renderPassInfo.clearValueCount =
-							static_cast<uint32_t>(clearValues.size());
-			renderPassInfo.pClearValues = clearValues.data();
-			
-			vkCmdBeginRenderPass(commandBuffers[i], &renderPassInfo,
-					VK_SUBPASS_CONTENTS_INLINE);			
+void BlockCompressor::decodeBC7(const uint8_t *in, uint8_t texels[16][4]) {
+	if ((in[0] & 0x7F) != (1 << 6)) {
+		throw std::runtime_error("only BC7 mode 6 blocks can be decoded!");
+	}
+	int position = 7;
+	auto get = [in, &position](int bits) {
+		uint32_t value = 0;
+		for (int b = 0; b < bits; b++, position++) {
+			value |= ((in[position >> 3] >> (position & 7)) & 1u) << b;
+		}
+		return value;
+	};
 	
+	uint32_t ends[2][4];
+	for (int c = 0; c < 4; c++) {
+		ends[0][c] = get(7);
+		ends[1][c] = get(7);
+	}
+	uint32_t p0 = get(1), p1 = get(1);
+	for (int c = 0; c < 4; c++) {
+		ends[0][c] = (ends[0][c] << 1) | p0;
+		ends[1][c] = (ends[1][c] << 1) | p1;
+	}
+	for (int i = 0; i < 16; i++) {
+		int w = BC7_WEIGHTS[get(i == 0 ? 3 : 4)];
+		for (int c = 0; c < 4; c++) {
+			texels[i][c] = static_cast<uint8_t>(((64 - w) * ends[0][c] + w * ends[1][c] + 32) >> 6);
+		}
+	}
+}
 
-			populateCommandBuffer(commandBuffers[i], i);
-			
 
-			vkCmdEndRenderPass(commandBuffers[i]);
 
-			if (vkEndCommandBuffer(commandBuffers[i]) != VK_SUCCESS) {
-				throw std::runtime_error("failed to record command buffer!");
+void Impostor::frameBasis(glm::vec3 dir, glm::vec3& right, glm::vec3& up) {
+	glm::vec3 reference = std::abs(dir.y) > 0.999f ? glm::vec3(0.0f, 0.0f, 1.0f) :
+													 glm::vec3(0.0f, 1.0f, 0.0f);
+	right = glm::normalize(glm::cross(reference, dir));
+	up = glm::cross(dir, right);
+}
+
+void Impostor::bake(const Model *M, const Texture *T) {
+	center = 0.5f * (M->boundsMin + M->boundsMax);
+	// A small margin keeps the silhouettes away from the frame borders
+	radius = 0.5f * glm::length(M->boundsMax - M->boundsMin) * 1.05f;
+	if (radius <= 0.0f) {
+		radius = 1.0f;
+	}
+	
+	// The texels sampled depend on the format T is stored in
+	const uint64_t sources[3] = {M->sourceHash, T->sourceHash,
+								 static_cast<uint64_t>(T->format)};
+	uint64_t sourceHash = hashBytes(reinterpret_cast<const char *>(sources), sizeof(sources));
+	normals.format = VK_FORMAT_R8G8B8A8_UNORM;
+	if (!cacheName.empty()) {
+		if (albedo.loadTextureCache(cacheName + ".albedo.imp", sourceHash) &&
+			normals.loadTextureCache(cacheName + ".normals.imp", sourceHash)) {
+			return;
+		}
+		albedo.freePixels();
+	}
+	
+	const int size = frames * frameSize;
+	std::vector<uint8_t> color(4 * size * size, 0);
+	std::vector<uint8_t> normal(4 * size * size, 0);
+	std::vector<float> depth(frameSize * frameSize);
+	
+	std::vector<stbi_uc> texels = T->level0();
+	auto sample = [T, &texels](glm::vec2 uv) {
+		// Bilinear, repeating like the texture sampler
+		float x = (uv.x - std::floor(uv.x)) * T->texWidth - 0.5f;
+		float y = (uv.y - std::floor(uv.y)) * T->texHeight - 0.5f;
+		int x0 = static_cast<int>(std::floor(x)), y0 = static_cast<int>(std::floor(y));
+		float fx = x - x0, fy = y - y0;
+		glm::vec4 result(0.0f);
+		for (int k = 0; k < 4; k++) {
+			int sx = ((x0 + (k & 1)) % T->texWidth + T->texWidth) % T->texWidth;
+			int sy = ((y0 + (k >> 1)) % T->texHeight + T->texHeight) % T->texHeight;
+			const stbi_uc *p = texels.data() + 4 * (static_cast<size_t>(sy) * T->texWidth + sx);
+			float w = ((k & 1) ? fx : 1.0f - fx) * ((k >> 1) ? fy : 1.0f - fy);
+			result += w * glm::vec4(p[0], p[1], p[2], p[3]);
+		}
+		return result;
+	};
+	
+	for (int fy = 0; fy < frames; fy++) {
+		for (int fx = 0; fx < frames; fx++) {
+			glm::vec3 dir = octahedralDecode(glm::vec2((fx + 0.5f) / frames,
+													   (fy + 0.5f) / frames) * 2.0f - 1.0f);
+			glm::vec3 right, up;
+			frameBasis(dir, right, up);
+			std::fill(depth.begin(), depth.end(), std::numeric_limits<float>::lowest());
+			
+			for (size_t i = 0; i + 2 < M->indices.size(); i += 3) {
+				const Vertex *v[3];
+				glm::vec3 s[3];
+				for (int k = 0; k < 3; k++) {
+					v[k] = &M->vertices[M->indices[i + k]];
+					glm::vec3 p = v[k]->pos - center;
+					s[k] = glm::vec3((glm::dot(p, right) / radius * 0.5f + 0.5f) * frameSize,
+									 (0.5f - glm::dot(p, up) / radius * 0.5f) * frameSize,
+									 glm::dot(p, dir));
+				}
+				float area = (s[1].x - s[0].x) * (s[2].y - s[0].y) -
+							 (s[2].x - s[0].x) * (s[1].y - s[0].y);
+				if (area == 0.0f) {
+					continue;
+				}
+				int minX = std::max(0, static_cast<int>(std::floor(std::min({s[0].x, s[1].x, s[2].x}))));
+				int maxX = std::min(frameSize - 1, static_cast<int>(std::ceil(std::max({s[0].x, s[1].x, s[2].x}))));
+				int minY = std::max(0, static_cast<int>(std::floor(std::min({s[0].y, s[1].y, s[2].y}))));
+				int maxY = std::min(frameSize - 1, static_cast<int>(std::ceil(std::max({s[0].y, s[1].y, s[2].y}))));
+				
+				for (int y = minY; y <= maxY; y++) {
+					for (int x = minX; x <= maxX; x++) {
+						float px = x + 0.5f, py = y + 0.5f;
+						float b0 = ((s[1].x - px) * (s[2].y - py) - (s[2].x - px) * (s[1].y - py)) / area;
+						float b1 = ((s[2].x - px) * (s[0].y - py) - (s[0].x - px) * (s[2].y - py)) / area;
+						float b2 = 1.0f - b0 - b1;
+						if (b0 < 0.0f || b1 < 0.0f || b2 < 0.0f) {
+							continue;
+						}
+						float z = b0 * s[0].z + b1 * s[1].z + b2 * s[2].z;
+						float &stored = depth[y * frameSize + x];
+						if (z <= stored) {
+							continue;
+						}
+						stored = z;
+						
+						glm::vec2 uv = b0 * v[0]->texCoord + b1 * v[1]->texCoord + b2 * v[2]->texCoord;
+						glm::vec3 n = b0 * v[0]->norm + b1 * v[1]->norm + b2 * v[2]->norm;
+						float length = glm::length(n);
+						n = length > 0.0f ? n / length : dir;
+						
+						glm::vec4 c = sample(uv);
+						size_t texel = 4 * ((static_cast<size_t>(fy) * frameSize + y) * size +
+											 static_cast<size_t>(fx) * frameSize + x);
+						for (int k = 0; k < 3; k++) {
+							color[texel + k] = static_cast<uint8_t>(std::min(255.0f, c[k] + 0.5f));
+							normal[texel + k] = static_cast<uint8_t>((n[k] * 0.5f + 0.5f) * 255.0f + 0.5f);
+						}
+						color[texel + 3] = 255;
+						normal[texel + 3] = 255;
+					}
+				}
 			}
 		}
 	}
-    
-    // Lesson 22.5
-    void createSyncObjects() {
-    	imageAvailableSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-    	renderFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-    	inFlightFences.resize(MAX_FRAMES_IN_FLIGHT);
-    	imagesInFlight.resize(swapChainImages.size(), VK_NULL_HANDLE);
-    	    	
-    	VkSemaphoreCreateInfo semaphoreInfo{};
-		semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
-		
-		VkFenceCreateInfo fenceInfo{};
-		fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-		fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
-		
-		for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-			VkResult result1 = vkCreateSemaphore(device, &semaphoreInfo, nullptr,
-								&imageAvailableSemaphores[i]);
-			VkResult result2 = vkCreateSemaphore(device, &semaphoreInfo, nullptr,
-								&renderFinishedSemaphores[i]);
-			VkResult result3 = vkCreateFence(device, &fenceInfo, nullptr,
-								&inFlightFences[i]);
-			if (result1 != VK_SUCCESS ||
-				result2 != VK_SUCCESS ||
-				result3 != VK_SUCCESS) {
-			 	PrintVkError(result1);
-			 	PrintVkError(result2);
-			 	PrintVkError(result3);
-				throw std::runtime_error("failed to create synchronization objects for a frame!!");
+	
+	// Empty texels take the color of their covered neighbours, so that
+	// filtering and mipmaps do not darken the silhouettes
+	for (int pass = 0; pass < 4; pass++) {
+		std::vector<uint8_t> covered(size * size);
+		for (size_t t = 0; t < covered.size(); t++) {
+			covered[t] = color[4 * t + 3] != 0 || normal[4 * t + 3] != 0;
+		}
+		for (int y = 0; y < size; y++) {
+			for (int x = 0; x < size; x++) {
+				size_t texel = static_cast<size_t>(y) * size + x;
+				if (covered[texel]) {
+					continue;
+				}
+				int sumC[3] = {0, 0, 0}, sumN[3] = {0, 0, 0}, count = 0;
+				const int dx[4] = {-1, 1, 0, 0}, dy[4] = {0, 0, -1, 1};
+				for (int k = 0; k < 4; k++) {
+					int nx = x + dx[k], ny = y + dy[k];
+					// Stay inside the frame
+					if (nx < 0 || ny < 0 || nx >= size || ny >= size ||
+						nx / frameSize != x / frameSize || ny / frameSize != y / frameSize) {
+						continue;
+					}
+					size_t other = static_cast<size_t>(ny) * size + nx;
+					if (!covered[other]) {
+						continue;
+					}
+					for (int c = 0; c < 3; c++) {
+						sumC[c] += color[4 * other + c];
+						sumN[c] += normal[4 * other + c];
+					}
+					count++;
+				}
+				if (count > 0) {
+					for (int c = 0; c < 3; c++) {
+						color[4 * texel + c] = static_cast<uint8_t>(sumC[c] / count);
+						normal[4 * texel + c] = static_cast<uint8_t>(sumN[c] / count);
+					}
+					// Marks the texel as filled for the next pass only
+					normal[4 * texel + 3] = 1;
+				}
 			}
 		}
 	}
-    
-    // Lesson 22.6 --- Main Rendering Loop
-    void mainLoop() {
-        while (!glfwWindowShouldClose(window)) {
-            glfwPollEvents();
-            drawFrame();
-        }
-        
-        vkDeviceWaitIdle(device);
-    }
-    
-    // Lesson 22.6
-    void drawFrame() {
-		vkWaitForFences(device, 1, &inFlightFences[currentFrame],
-						VK_TRUE, UINT64_MAX);
-		
-		uint32_t imageIndex;
-		
-		VkResult result = vkAcquireNextImageKHR(device, swapChain, UINT64_MAX,
-				imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
-
-		if (imagesInFlight[imageIndex] != VK_NULL_HANDLE) {
-			vkWaitForFences(device, 1, &imagesInFlight[imageIndex],
-							VK_TRUE, UINT64_MAX);
+	for (size_t t = 0; t < normal.size(); t += 4) {
+		if (normal[t + 3] == 1) {
+			normal[t + 3] = 0;
 		}
-		imagesInFlight[imageIndex] = inFlightFences[currentFrame];
-		
-		updateUniformBuffer(imageIndex);
-		
-		VkSubmitInfo submitInfo{};
-		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-		VkSemaphore waitSemaphores[] = {imageAvailableSemaphores[currentFrame]};
-		VkPipelineStageFlags waitStages[] =
-			{VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
-		submitInfo.waitSemaphoreCount = 1;
-		submitInfo.pWaitSemaphores = waitSemaphores;
-		submitInfo.pWaitDstStageMask = waitStages;
-		submitInfo.commandBufferCount = 1;
-		submitInfo.pCommandBuffers = &commandBuffers[imageIndex];
-		VkSemaphore signalSemaphores[] = {renderFinishedSemaphores[currentFrame]};
-		submitInfo.signalSemaphoreCount = 1;
-		submitInfo.pSignalSemaphores = signalSemaphores;
-		
-		vkResetFences(device, 1, &inFlightFences[currentFrame]);
+	}
+	
+	albedo.loadPixels(color.data(), size, size);
+	normals.loadPixels(normal.data(), size, size);
+	if (!cacheName.empty()) {
+		albedo.saveTextureCache(cacheName + ".albedo.imp", sourceHash, albedo.format);
+		normals.saveTextureCache(cacheName + ".normals.imp", sourceHash, normals.format);
+	}
+}
 
-		if (vkQueueSubmit(graphicsQueue, 1, &submitInfo,
-				inFlightFences[currentFrame]) != VK_SUCCESS) {
-			throw std::runtime_error("failed to submit draw command buffer!");
-		}
-		
-		VkPresentInfoKHR presentInfo{};
-		presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
-		presentInfo.waitSemaphoreCount = 1;
-		presentInfo.pWaitSemaphores = signalSemaphores;
-		
-		VkSwapchainKHR swapChains[] = {swapChain};
-		presentInfo.swapchainCount = 1;
-		presentInfo.pSwapchains = swapChains;
-		presentInfo.pImageIndices = &imageIndex;
-		presentInfo.pResults = nullptr; // Optional
-		
-		result = vkQueuePresentKHR(presentQueue, &presentInfo);
+void Impostor::init(BaseProject *bp) {
+	BP = bp;
+	albedo.init(bp);
+	normals.init(bp);
+}
 
-		currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
-    }
+void Impostor::cleanup() {
+	albedo.cleanup();
+	normals.cleanup();
+}
 
-	virtual void updateUniformBuffer(uint32_t currentImage) = 0;
+float Impostor::fade(const glm::mat4& model, const glm::mat4& view,
+					 const glm::mat4& proj, float viewportHeight) {
+	float scale = std::max(glm::length(glm::vec3(model[0])),
+				  std::max(glm::length(glm::vec3(model[1])),
+						   glm::length(glm::vec3(model[2]))));
+	glm::vec4 viewCenter = view * model * glm::vec4(center, 1.0f);
+	float distance = glm::length(glm::vec3(viewCenter));
+	if (distance <= radius * scale) {
+		return 0.0f;
+	}
+	float diameter = 2.0f * radius * scale * std::abs(proj[1][1]) *
+					 0.5f * viewportHeight / distance;
+	return glm::clamp((IMPOSTOR_FADE_SIZE - diameter) /
+					  (IMPOSTOR_FADE_SIZE - IMPOSTOR_FULL_SIZE), 0.0f, 1.0f);
+}
 
-	virtual void localCleanup() = 0;
-	
-	// All lessons
-	
-    void cleanup() {
-		vkDestroyImageView(device, depthImageView, nullptr);
-		vkDestroyImage(device, depthImage, nullptr);
-		vkFreeMemory(device, depthImageMemory, nullptr);
+void Impostor::buildQuad(Model *M) {
+	// Corners in pos.xy, frame coordinates in texCoord. Both windings are
+	// kept, since the shader may flip the quad.
+	M->vertices.clear();
+	for (int k = 0; k < 4; k++) {
+		Vertex v{};
+		float x = (k & 1) ? 1.0f : -1.0f;
+		float y = (k & 2) ? 1.0f : -1.0f;
+		v.pos = glm::vec3(x, y, 0.0f);
+		v.norm = glm::vec3(0.0f, 0.0f, 1.0f);
+		v.texCoord = glm::vec2(0.5f * x + 0.5f, 0.5f - 0.5f * y);
+		M->vertices.push_back(v);
+	}
+	M->indices = {0, 1, 3, 0, 3, 2, 0, 3, 1, 0, 2, 3};
+	M->boundsMin = glm::vec3(-1.0f, -1.0f, 0.0f);
+	M->boundsMax = glm::vec3(1.0f, 1.0f, 0.0f);
+}
 
-		for (size_t i = 0; i < swapChainFramebuffers.size(); i++) {
-			vkDestroyFramebuffer(device, swapChainFramebuffers[i], nullptr);
-		}
-		
-		vkFreeCommandBuffers(device, commandPool,
-				static_cast<uint32_t>(commandBuffers.size()), commandBuffers.data());
 
-		vkDestroyRenderPass(device, renderPass, nullptr);
 
-		for (size_t i = 0; i < swapChainImageViews.size(); i++){
-			vkDestroyImageView(device, swapChainImageViews[i], nullptr);
-		}
-		
-		vkDestroySwapchainKHR(device, swapChain, nullptr);
-		
-		vkDestroyDescriptorPool(device, descriptorPool, nullptr);
-    	
-    	
-		localCleanup();
-    	
-    	for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-			vkDestroySemaphore(device, renderFinishedSemaphores[i], nullptr);
-			vkDestroySemaphore(device, imageAvailableSemaphores[i], nullptr);
-			vkDestroyFence(device, inFlightFences[i], nullptr);
-    	}
-    	
-    	vkDestroyCommandPool(device, commandPool, nullptr);
-    	
- 		vkDestroyDevice(device, nullptr);
-		
-		DestroyDebugUtilsMessengerEXT(instance, debugMessenger, nullptr);
-		
-		vkDestroySurfaceKHR(instance, surface, nullptr);
-    	vkDestroyInstance(instance, nullptr);
 
-        glfwDestroyWindow(window);
 
-        glfwTerminate();
-    }
-	
-};
+void AssetLoader::add(Model *M, std::string file) {
+	jobs.push_back([M, file]() { M->loadModel(file); });
+}
+
+void AssetLoader::add(Texture *T, std::string file) {
+	jobs.push_back([T, file]() { T->loadImage(file); });
+}
+
+void AssetLoader::add(Impostor *I, const Model *M, const Texture *T) {
+	jobs.push_back([I, M, T]() { I->bake(M, T); });
+}
+
+void AssetRegistry::init(BaseProject *bp) {
+	BP = bp;
+}
+
+template <class T>
+T *AssetRegistry::acquire(std::unordered_map<std::string, Entry<T>>& entries,
+						  const std::string& file) {
+	Entry<T>& entry = entries[file];
+	if (!entry.asset) {
+		entry.asset = std::make_unique<T>();
+		entry.asset->bundle = &BP->bundle;
+	}
+	entry.references++;
+	return entry.asset.get();
+}
+
+Model *AssetRegistry::model(const std::string& file) {
+	return acquire(models, file);
+}
 
+Texture *AssetRegistry::texture(const std::string& file) {
+	return acquire(textures, file);
+}
 
+void AssetRegistry::queue(AssetLoader& loader) {
+	for (auto& [file, entry] : models) {
+		if (!entry.loaded) {
+			loader.add(entry.asset.get(), file);
+			entry.loaded = true;
+		}
+	}
+	for (auto& [file, entry] : textures) {
+		if (!entry.loaded) {
+			loader.add(entry.asset.get(), file);
+			entry.loaded = true;
+		}
+	}
+}
 
+void AssetRegistry::loadAll() {
+	AssetLoader loader;
+	queue(loader);
+	loader.loadAll();
+}
 
-void Model::loadModel(std::string file) {
-	tinyobj::attrib_t attrib;
-	std::vector<tinyobj::shape_t> shapes;
-	std::vector<tinyobj::material_t> materials;
-	std::string warn, err;
-	
-	if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err,
-						  file.c_str())) {
-		throw std::runtime_error(warn + err);
+void AssetRegistry::initAll() {
+	for (auto& [file, entry] : models) {
+		if (entry.loaded && !entry.created) {
+			entry.asset->init(BP);
+			entry.created = true;
+		}
 	}
-	
-	for (const auto& shape : shapes) {
-		for (const auto& index : shape.mesh.indices) {
-			Vertex vertex{};
-			
-			vertex.pos = {
-				attrib.vertices[3 * index.vertex_index + 0],
-				attrib.vertices[3 * index.vertex_index + 1],
-				attrib.vertices[3 * index.vertex_index + 2]
-			};
-			
-			vertex.texCoord = {
-				attrib.texcoords[2 * index.texcoord_index + 0],
-				1 - attrib.texcoords[2 * index.texcoord_index + 1] 
-			};
-
-			vertex.norm = {
-				attrib.normals[3 * index.normal_index + 0],
-				attrib.normals[3 * index.normal_index + 1],
-				attrib.normals[3 * index.normal_index + 2]
-			};
-			
-			vertices.push_back(vertex);
-			indices.push_back(vertices.size()-1);
+	for (auto& [file, entry] : textures) {
+		if (entry.loaded && !entry.created) {
+			entry.asset->init(BP);
+			entry.created = true;
 		}
 	}
-	
-	
 }
 
-// Lesson 21
-void Model::createVertexBuffer() {
-	VkDeviceSize bufferSize = sizeof(vertices[0]) * vertices.size();
-	
-	BP->createBuffer(bufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, 
-						VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-						VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-						vertexBuffer, vertexBufferMemory);
+template <class T>
+void AssetRegistry::destroy(Entry<T>& entry) {
+	if (entry.created) {
+		entry.asset->cleanup();
+	}
+}
 
-	void* data;
-	vkMapMemory(BP->device, vertexBufferMemory, 0, bufferSize, 0, &data);
-	memcpy(data, vertices.data(), (size_t) bufferSize);
-	vkUnmapMemory(BP->device, vertexBufferMemory);			
+template <>
+void AssetRegistry::destroy(Entry<Texture>& entry) {
+	if (entry.created) {
+		entry.asset->cleanup();
+	} else {
+		// Loaded but never created
+		entry.asset->freePixels();
+	}
 }
 
-void Model::createIndexBuffer() {
-	VkDeviceSize bufferSize = sizeof(indices[0]) * indices.size();
+template <class T>
+void AssetRegistry::release(std::unordered_map<std::string, Entry<T>>& entries, T *asset) {
+	for (auto it = entries.begin(); it != entries.end(); ++it) {
+		if (it->second.asset.get() == asset) {
+			if (--it->second.references == 0) {
+				destroy(it->second);
+				entries.erase(it);
+			}
+			return;
+		}
+	}
+	throw std::runtime_error("released an asset not in the registry!");
+}
 
-	BP->createBuffer(bufferSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
-							 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-							 VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-							 indexBuffer, indexBufferMemory);
+void AssetRegistry::release(Model *M) {
+	release(models, M);
+}
 
-	void* data;
-	vkMapMemory(BP->device, indexBufferMemory, 0, bufferSize, 0, &data);
-	memcpy(data, indices.data(), (size_t) bufferSize);
-	vkUnmapMemory(BP->device, indexBufferMemory);
+void AssetRegistry::release(Texture *T) {
+	release(textures, T);
 }
 
-void Model::init(BaseProject *bp, std::string file) {
-	BP = bp;
-	loadModel(file);
-	createVertexBuffer();
-	createIndexBuffer();
+void AssetRegistry::cleanup() {
+	for (auto& [file, entry] : models) {
+		destroy(entry);
+	}
+	for (auto& [file, entry] : textures) {
+		destroy(entry);
+	}
+	models.clear();
+	textures.clear();
 }
 
-void Model::cleanup() {
-   	vkDestroyBuffer(BP->device, indexBuffer, nullptr);
-   	vkFreeMemory(BP->device, indexBufferMemory, nullptr);
-	vkDestroyBuffer(BP->device, vertexBuffer, nullptr);
-   	vkFreeMemory(BP->device, vertexBufferMemory, nullptr);
+void AssetLoader::loadAll() {
+	std::atomic<size_t> next{0};
+	std::exception_ptr error = nullptr;
+	std::mutex errorMutex;
+	
+	auto worker = [&]() {
+		for (size_t i = next++; i < jobs.size(); i = next++) {
+			try {
+				jobs[i]();
+			} catch (...) {
+				std::lock_guard<std::mutex> lock(errorMutex);
+				if (!error) error = std::current_exception();
+			}
+		}
+	};
+	
+	size_t threadCount = std::max(1u, std::thread::hardware_concurrency());
+	threadCount = std::min(threadCount, jobs.size());
+	std::vector<std::thread> workers;
+	for (size_t i = 1; i < threadCount; i++) {
+		workers.emplace_back(worker);
+	}
+	worker();
+	for (auto& t : workers) {
+		t.join();
+	}
+	jobs.clear();
+	
+	if (error) {
+		std::rethrow_exception(error);
+	}
 }
 
 
 
+void UploadBatch::init(BaseProject *bp) {
+	BP = bp;
+}
 
+bool UploadBatch::separateTransfer() {
+	return BP->transferQueueFamily != BP->graphicsQueueFamily;
+}
 
+VkCommandBuffer UploadBatch::allocate(VkCommandPool pool) {
+	VkCommandBufferAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	allocInfo.commandPool = pool;
+	allocInfo.commandBufferCount = 1;
+	
+	VkCommandBuffer buffer;
+	VkResult result = vkAllocateCommandBuffers(BP->device, &allocInfo, &buffer);
+	if (result != VK_SUCCESS) {
+	 	PrintVkError(result);
+		throw std::runtime_error("failed to allocate upload command buffer!");
+	}
+	
+	VkCommandBufferBeginInfo beginInfo{};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	
+	vkBeginCommandBuffer(buffer, &beginInfo);
+	
+	return buffer;
+}
 
+VkCommandBuffer UploadBatch::begin() {
+	if (commandBuffer == VK_NULL_HANDLE) {
+		commandBuffer = allocate(BP->commandPool);
+	}
+	return commandBuffer;
+}
 
-void Texture::createTextureImage(std::string file) {
-	int texWidth, texHeight, texChannels;
-	stbi_uc* pixels = stbi_load(file.c_str(), &texWidth, &texHeight,
-						&texChannels, STBI_rgb_alpha);
-	if (!pixels) {
-		throw std::runtime_error("failed to load texture image!");
+VkCommandBuffer UploadBatch::beginTransfer() {
+	if (!separateTransfer()) {
+		return begin();
 	}
+	if (transferCommandBuffer == VK_NULL_HANDLE) {
+		transferCommandBuffer = allocate(BP->transferCommandPool);
+	}
+	return transferCommandBuffer;
+}
 
-	VkDeviceSize imageSize = texWidth * texHeight * 4;
-	mipLevels = static_cast<uint32_t>(std::floor(
-					std::log2(std::max(texWidth, texHeight)))) + 1;
-	
+VkBuffer UploadBatch::stage(const void *data, VkDeviceSize size) {
 	VkBuffer stagingBuffer;
 	VkDeviceMemory stagingBufferMemory;
-	 
-	BP->createBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-	  						VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-	  						VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-	  						stagingBuffer, stagingBufferMemory);
-	void* data;
-	vkMapMemory(BP->device, stagingBufferMemory, 0, imageSize, 0, &data);
-	memcpy(data, pixels, static_cast<size_t>(imageSize));
-	vkUnmapMemory(BP->device, stagingBufferMemory);
 	
-	stbi_image_free(pixels);
+	BP->createBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+					 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+					 VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+					 stagingBuffer, stagingBufferMemory);
+	void* mapped;
+	vkMapMemory(BP->device, stagingBufferMemory, 0, size, 0, &mapped);
+	memcpy(mapped, data, static_cast<size_t>(size));
+	vkUnmapMemory(BP->device, stagingBufferMemory);
 	
-	BP->createImage(texWidth, texHeight, mipLevels, VK_FORMAT_R8G8B8A8_SRGB,
-				VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_SRC_BIT |
-				VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
-				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, textureImage,
-				textureImageMemory);
-				
-	BP->transitionImageLayout(textureImage, VK_FORMAT_R8G8B8A8_SRGB,
-			VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, mipLevels);
-	BP->copyBufferToImage(stagingBuffer, textureImage,
-			static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight));
-
-	BP->generateMipmaps(textureImage, VK_FORMAT_R8G8B8A8_SRGB,
-					texWidth, texHeight, mipLevels);
+	stagingBuffers.push_back(stagingBuffer);
+	stagingBuffersMemory.push_back(stagingBufferMemory);
+	return stagingBuffer;
+}
 
-	vkDestroyBuffer(BP->device, stagingBuffer, nullptr);
-	vkFreeMemory(BP->device, stagingBufferMemory, nullptr);
+void UploadBatch::handOff(VkBuffer buffer, VkDeviceSize size,
+						  VkAccessFlags dstAccess, VkPipelineStageFlags dstStage) {
+	VkBufferMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = dstAccess;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.buffer = buffer;
+	barrier.offset = 0;
+	barrier.size = size;
+	
+	if (!separateTransfer()) {
+		vkCmdPipelineBarrier(begin(), VK_PIPELINE_STAGE_TRANSFER_BIT, dstStage, 0,
+							 0, nullptr, 1, &barrier, 0, nullptr);
+		return;
+	}
+	
+	// Release on the transfer queue...
+	barrier.srcQueueFamilyIndex = BP->transferQueueFamily;
+	barrier.dstQueueFamilyIndex = BP->graphicsQueueFamily;
+	barrier.dstAccessMask = 0;
+	vkCmdPipelineBarrier(beginTransfer(), VK_PIPELINE_STAGE_TRANSFER_BIT,
+						 VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+						 0, nullptr, 1, &barrier, 0, nullptr);
+
+	// ...and acquire on the graphics queue
+	barrier.srcAccessMask = 0;
+	barrier.dstAccessMask = dstAccess;
+	vkCmdPipelineBarrier(begin(), VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, dstStage, 0,
+						 0, nullptr, 1, &barrier, 0, nullptr);
 }
 
-void Texture::createTextureImageView() {
-	textureImageView = BP->createImageView(textureImage,
-									   VK_FORMAT_R8G8B8A8_SRGB,
-									   VK_IMAGE_ASPECT_COLOR_BIT,
-									   mipLevels);
+void UploadBatch::handOff(VkImage image, uint32_t mipLevels,
+						  VkImageLayout oldLayout, VkImageLayout newLayout,
+						  VkAccessFlags dstAccess, VkPipelineStageFlags dstStage) {
+	// With a queue family transfer, the release and acquire barriers
+	// describe the same layout transition, executed once
+	VkImageMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = dstAccess;
+	barrier.oldLayout = oldLayout;
+	barrier.newLayout = newLayout;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = image;
+	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	barrier.subresourceRange.baseMipLevel = 0;
+	barrier.subresourceRange.levelCount = mipLevels;
+	barrier.subresourceRange.baseArrayLayer = 0;
+	barrier.subresourceRange.layerCount = 1;
+	
+	if (!separateTransfer()) {
+		vkCmdPipelineBarrier(begin(), VK_PIPELINE_STAGE_TRANSFER_BIT, dstStage, 0,
+							 0, nullptr, 0, nullptr, 1, &barrier);
+		return;
+	}
+	
+	barrier.srcQueueFamilyIndex = BP->transferQueueFamily;
+	barrier.dstQueueFamilyIndex = BP->graphicsQueueFamily;
+	barrier.dstAccessMask = 0;
+	vkCmdPipelineBarrier(beginTransfer(), VK_PIPELINE_STAGE_TRANSFER_BIT,
+						 VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+						 0, nullptr, 0, nullptr, 1, &barrier);
+
+	barrier.srcAccessMask = 0;
+	barrier.dstAccessMask = dstAccess;
+	vkCmdPipelineBarrier(begin(), VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, dstStage, 0,
+						 0, nullptr, 0, nullptr, 1, &barrier);
 }
+
+void UploadBatch::submit() {
+	if (commandBuffer == VK_NULL_HANDLE && transferCommandBuffer == VK_NULL_HANDLE) {
+		return;
+	}
 	
-void Texture::createTextureSampler() {
-	VkSamplerCreateInfo samplerInfo{};
-	samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
-	samplerInfo.magFilter = VK_FILTER_LINEAR;
-	samplerInfo.minFilter = VK_FILTER_LINEAR;
-	samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-	samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-	samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-	samplerInfo.anisotropyEnable = VK_TRUE;
-	samplerInfo.maxAnisotropy = 16;
-	samplerInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
-	samplerInfo.unnormalizedCoordinates = VK_FALSE;
-	samplerInfo.compareEnable = VK_FALSE;
-	samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
-	samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
-	samplerInfo.mipLodBias = 0.0f;
-	samplerInfo.minLod = 0.0f;
-	samplerInfo.maxLod = static_cast<float>(mipLevels);
+	Submission S;
+	S.commandBuffer = commandBuffer;
+	S.transferCommandBuffer = transferCommandBuffer;
+	S.transferDone = VK_NULL_HANDLE;
+	S.stagingBuffers.swap(stagingBuffers);
+	S.stagingBuffersMemory.swap(stagingBuffersMemory);
+	commandBuffer = VK_NULL_HANDLE;
+	transferCommandBuffer = VK_NULL_HANDLE;
 	
-	VkResult result = vkCreateSampler(BP->device, &samplerInfo, nullptr,
-									  &textureSampler);
+	VkFenceCreateInfo fenceInfo{};
+	fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+	VkResult result = vkCreateFence(BP->device, &fenceInfo, nullptr, &S.fence);
 	if (result != VK_SUCCESS) {
 	 	PrintVkError(result);
-	 	throw std::runtime_error("failed to create texture sampler!");
+		throw std::runtime_error("failed to create upload fence!");
 	}
-}
 	
-
-
-void Texture::init(BaseProject *bp, std::string file) {
-	BP = bp;
-	createTextureImage(file);
-	createTextureImageView();
-	createTextureSampler();
+	if (S.transferCommandBuffer != VK_NULL_HANDLE) {
+		vkEndCommandBuffer(S.transferCommandBuffer);
+		
+		VkSubmitInfo submitInfo{};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &S.transferCommandBuffer;
+		if (S.commandBuffer != VK_NULL_HANDLE) {
+			VkSemaphoreCreateInfo semaphoreInfo{};
+			semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+			result = vkCreateSemaphore(BP->device, &semaphoreInfo, nullptr,
+									   &S.transferDone);
+			if (result != VK_SUCCESS) {
+			 	PrintVkError(result);
+				throw std::runtime_error("failed to create upload semaphore!");
+			}
+			submitInfo.signalSemaphoreCount = 1;
+			submitInfo.pSignalSemaphores = &S.transferDone;
+		}
+		result = vkQueueSubmit(BP->transferQueue, 1, &submitInfo,
+				S.commandBuffer == VK_NULL_HANDLE ? S.fence : VK_NULL_HANDLE);
+		if (result != VK_SUCCESS) {
+		 	PrintVkError(result);
+			throw std::runtime_error("failed to submit upload command buffer!");
+		}
+	}
+	
+	if (S.commandBuffer != VK_NULL_HANDLE) {
+		vkEndCommandBuffer(S.commandBuffer);
+		
+		VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+		VkSubmitInfo submitInfo{};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		if (S.transferDone != VK_NULL_HANDLE) {
+			submitInfo.waitSemaphoreCount = 1;
+			submitInfo.pWaitSemaphores = &S.transferDone;
+			submitInfo.pWaitDstStageMask = &waitStage;
+		}
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &S.commandBuffer;
+		result = vkQueueSubmit(BP->graphicsQueue, 1, &submitInfo, S.fence);
+		if (result != VK_SUCCESS) {
+		 	PrintVkError(result);
+			throw std::runtime_error("failed to submit upload command buffer!");
+		}
+	}
+	
+	pending.push_back(std::move(S));
 }
 
-void Texture::cleanup() {
-   	vkDestroySampler(BP->device, textureSampler, nullptr);
-   	vkDestroyImageView(BP->device, textureImageView, nullptr);
-	vkDestroyImage(BP->device, textureImage, nullptr);
-	vkFreeMemory(BP->device, textureImageMemory, nullptr);
+void UploadBatch::collect(bool wait) {
+	size_t kept = 0;
+	for (size_t i = 0; i < pending.size(); i++) {
+		Submission &S = pending[i];
+		if (wait) {
+			vkWaitForFences(BP->device, 1, &S.fence, VK_TRUE, UINT64_MAX);
+		} else if (vkGetFenceStatus(BP->device, S.fence) != VK_SUCCESS) {
+			if (kept != i) {
+				pending[kept] = std::move(S);
+			}
+			kept++;
+			continue;
+		}
+		
+		for (size_t j = 0; j < S.stagingBuffers.size(); j++) {
+			vkDestroyBuffer(BP->device, S.stagingBuffers[j], nullptr);
+			vkFreeMemory(BP->device, S.stagingBuffersMemory[j], nullptr);
+		}
+		if (S.commandBuffer != VK_NULL_HANDLE) {
+			vkFreeCommandBuffers(BP->device, BP->commandPool, 1, &S.commandBuffer);
+		}
+		if (S.transferCommandBuffer != VK_NULL_HANDLE) {
+			vkFreeCommandBuffers(BP->device, BP->transferCommandPool, 1,
+								 &S.transferCommandBuffer);
+		}
+		if (S.transferDone != VK_NULL_HANDLE) {
+			vkDestroySemaphore(BP->device, S.transferDone, nullptr);
+		}
+		vkDestroyFence(BP->device, S.fence, nullptr);
+	}
+	pending.resize(kept);
 }
 
+void UploadBatch::cleanup() {
+	// Work recorded but never submitted is flushed, so that the
+	// resources it references are in a defined state when destroyed
+	submit();
+	collect(true);
+}
 
 
 
 
 void Pipeline::init(BaseProject *bp, const std::string& VertShader, const std::string& FragShader,
-					std::vector<DescriptorSetLayout *> D) {
+					std::vector<DescriptorSetLayout *> D, VertexFormat format) {
 	BP = bp;
 	
-	auto vertShaderCode = readFile(VertShader);
-	auto fragShaderCode = readFile(FragShader);
+	auto vertShaderCode = readFile(VertShader, &BP->bundle);
+	auto fragShaderCode = readFile(FragShader, &BP->bundle);
 	
 	std::cout << "Vertex shader len: " <<
 				vertShaderCode.size() << "\n";
@@ -1695,13 +6697,27 @@ void Pipeline::init(BaseProject *bp, const std::string& VertShader, const std::s
 	VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
 	vertexInputInfo.sType =
 			VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-	auto bindingDescription = Vertex::getBindingDescription();
-	auto attributeDescriptions = Vertex::getAttributeDescriptions();
+	auto bindingDescription = format == VERTEX_QUANTIZED ?
+			QuantizedVertex::getBindingDescription() :
+			Vertex::getBindingDescription();
+	auto vertexAttributes = format == VERTEX_QUANTIZED ?
+			QuantizedVertex::getAttributeDescriptions() :
+			Vertex::getAttributeDescriptions();
+	std::vector<VkVertexInputBindingDescription> bindingDescriptions = {bindingDescription};
+	std::vector<VkVertexInputAttributeDescription> attributeDescriptions(
+			vertexAttributes.begin(), vertexAttributes.end());
+	if (instanced) {
+		bindingDescriptions.push_back(InstanceData::getBindingDescription());
+		auto instanceAttributes = InstanceData::getAttributeDescriptions();
+		attributeDescriptions.insert(attributeDescriptions.end(),
+									 instanceAttributes.begin(), instanceAttributes.end());
+	}
 			
-	vertexInputInfo.vertexBindingDescriptionCount = 1;
+	vertexInputInfo.vertexBindingDescriptionCount =
+			static_cast<uint32_t>(bindingDescriptions.size());
 	vertexInputInfo.vertexAttributeDescriptionCount =
 			static_cast<uint32_t>(attributeDescriptions.size());
-	vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
+	vertexInputInfo.pVertexBindingDescriptions = bindingDescriptions.data();
 	vertexInputInfo.pVertexAttributeDescriptions =
 			attributeDescriptions.data();		
 
@@ -1799,8 +6815,9 @@ void Pipeline::init(BaseProject *bp, const std::string& VertShader, const std::s
 		VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
 	pipelineLayoutInfo.setLayoutCount = DSL.size();
 	pipelineLayoutInfo.pSetLayouts = DSL.data();
-	pipelineLayoutInfo.pushConstantRangeCount = 0; // Optional
-	pipelineLayoutInfo.pPushConstantRanges = nullptr; // Optional
+	pipelineLayoutInfo.pushConstantRangeCount =
+		static_cast<uint32_t>(pushConstantRanges.size());
+	pipelineLayoutInfo.pPushConstantRanges = pushConstantRanges.data();
 	
 	VkResult result = vkCreatePipelineLayout(BP->device, &pipelineLayoutInfo, nullptr,
 				&pipelineLayout);
@@ -1848,55 +6865,287 @@ void Pipeline::init(BaseProject *bp, const std::string& VertShader, const std::s
 	 	PrintVkError(result);
 		throw std::runtime_error("failed to create graphics pipeline!");
 	}
-	
-	vkDestroyShaderModule(BP->device, fragShaderModule, nullptr);
-	vkDestroyShaderModule(BP->device, vertShaderModule, nullptr);
+	
+	vkDestroyShaderModule(BP->device, fragShaderModule, nullptr);
+	vkDestroyShaderModule(BP->device, vertShaderModule, nullptr);
+}
+
+// Lesson 18
+std::vector<char> Pipeline::readFile(const std::string& filename,
+									  const AssetBundle *bundle) {
+	const char *data;
+	size_t size;
+	std::vector<char> storage;
+	if (bundle != nullptr && bundle->read(filename, data, size, storage)) {
+		return storage.empty() ? std::vector<char>(data, data + size) : storage;
+	}
+	
+	std::ifstream file(filename, std::ios::ate | std::ios::binary);
+	if (!file.is_open()) {
+		throw std::runtime_error("failed to open file!");
+	}
+	
+	size_t fileSize = (size_t) file.tellg();
+	std::vector<char> buffer(fileSize);
+	 
+	file.seekg(0);
+	file.read(buffer.data(), fileSize);
+	 
+	file.close();
+	 
+	return buffer;
+}
+
+// Lesson 18
+VkShaderModule Pipeline::createShaderModule(const std::vector<char>& code) {
+	VkShaderModuleCreateInfo createInfo{};
+	createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+	createInfo.codeSize = code.size();
+	createInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
+	
+	VkShaderModule shaderModule;
+
+	VkResult result = vkCreateShaderModule(BP->device, &createInfo, nullptr,
+					&shaderModule);
+	if (result != VK_SUCCESS) {
+	 	PrintVkError(result);
+		throw std::runtime_error("failed to create shader module!");
+	}
+	
+	return shaderModule;
+}
+
+void Pipeline::push(VkCommandBuffer commandBuffer, const void *data, uint32_t size,
+					uint32_t offset) {
+	// The stages of every overlapping range must be named together
+	VkShaderStageFlags stages = 0;
+	for (const auto& range : pushConstantRanges) {
+		if (range.offset < offset + size && offset < range.offset + range.size) {
+			stages |= range.stageFlags;
+		}
+	}
+	if (stages == 0) {
+		throw std::runtime_error("no push constant range for the pushed data!");
+	}
+	vkCmdPushConstants(commandBuffer, pipelineLayout, stages, offset, size, data);
+}
+
+void Pipeline::cleanup() {
+		vkDestroyPipeline(BP->device, graphicsPipeline, nullptr);
+		vkDestroyPipelineLayout(BP->device, pipelineLayout, nullptr);
+}
+
+void UniformRing::init(BaseProject *bp, VkDeviceSize capacity) {
+	BP = bp;
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(BP->physicalDevice, &properties);
+	alignment = std::max<VkDeviceSize>(properties.limits.minUniformBufferOffsetAlignment, 1);
+	regionSize = (capacity + alignment - 1) / alignment * alignment;
+	used = 0;
+	freeSlots.clear();
+	
+	VkDeviceSize size = regionSize * BP->swapChainImages.size();
+	BP->createBuffer(size, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+					 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+					 VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+					 buffer, bufferMemory);
+	void *data;
+	VkResult result = vkMapMemory(BP->device, bufferMemory, 0, size, 0, &data);
+	if (result != VK_SUCCESS) {
+		PrintVkError(result);
+		throw std::runtime_error("failed to map uniform ring!");
+	}
+	mapped = static_cast<char *>(data);
+}
+
+uint32_t UniformRing::allocate(VkDeviceSize size) {
+	size = (size + alignment - 1) / alignment * alignment;
+	for (size_t i = 0; i < freeSlots.size(); i++) {
+		if (freeSlots[i].first == size) {
+			uint32_t offset = freeSlots[i].second;
+			freeSlots.erase(freeSlots.begin() + i);
+			return offset;
+		}
+	}
+	if (used + size > regionSize) {
+		throw std::runtime_error("uniform ring is full, raise uniformRingSize!");
+	}
+	uint32_t offset = static_cast<uint32_t>(used);
+	used += size;
+	return offset;
+}
+
+void UniformRing::release(uint32_t offset, VkDeviceSize size) {
+	size = (size + alignment - 1) / alignment * alignment;
+	freeSlots.push_back({size, offset});
+}
+
+void UniformRing::cleanup() {
+	if (buffer == VK_NULL_HANDLE) {
+		return;
+	}
+	vkUnmapMemory(BP->device, bufferMemory);
+	vkDestroyBuffer(BP->device, buffer, nullptr);
+	vkFreeMemory(BP->device, bufferMemory, nullptr);
+	buffer = VK_NULL_HANDLE;
+	mapped = nullptr;
+}
+
+void RangeAllocator::init(VkDeviceSize size) {
+	capacity = size;
+	freeRanges.clear();
+	if (size > 0) {
+		freeRanges.push_back({0, size});
+	}
+}
+
+bool RangeAllocator::allocate(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset) {
+	for (size_t i = 0; i < freeRanges.size(); i++) {
+		auto [start, length] = freeRanges[i];
+		VkDeviceSize aligned = (start + alignment - 1) / alignment * alignment;
+		if (aligned + size > start + length) {
+			continue;
+		}
+		offset = aligned;
+		// The bytes skipped for the alignment stay free
+		VkDeviceSize end = start + length;
+		freeRanges.erase(freeRanges.begin() + i);
+		if (aligned + size < end) {
+			freeRanges.insert(freeRanges.begin() + i, {aligned + size, end - aligned - size});
+		}
+		if (aligned > start) {
+			freeRanges.insert(freeRanges.begin() + i, {start, aligned - start});
+		}
+		return true;
+	}
+	return false;
 }
 
-// Lesson 18
-std::vector<char> Pipeline::readFile(const std::string& filename) {
-		std::ifstream file(filename, std::ios::ate | std::ios::binary);
-	if (!file.is_open()) {
-		throw std::runtime_error("failed to open file!");
+void RangeAllocator::release(VkDeviceSize offset, VkDeviceSize size) {
+	auto next = std::lower_bound(freeRanges.begin(), freeRanges.end(),
+								 std::make_pair(offset, VkDeviceSize(0)));
+	next = freeRanges.insert(next, {offset, size});
+	// Merged with the free ranges it touches
+	if (next + 1 != freeRanges.end() && offset + size == (next + 1)->first) {
+		next->second += (next + 1)->second;
+		freeRanges.erase(next + 1);
+	}
+	if (next != freeRanges.begin() && (next - 1)->first + (next - 1)->second == offset) {
+		(next - 1)->second += next->second;
+		freeRanges.erase(next);
 	}
-	
-	size_t fileSize = (size_t) file.tellg();
-	std::vector<char> buffer(fileSize);
-	 
-	file.seekg(0);
-	file.read(buffer.data(), fileSize);
-	 
-	file.close();
-	 
-	return buffer;
 }
 
-// Lesson 18
-VkShaderModule Pipeline::createShaderModule(const std::vector<char>& code) {
-	VkShaderModuleCreateInfo createInfo{};
-	createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-	createInfo.codeSize = code.size();
-	createInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
-	
-	VkShaderModule shaderModule;
+void GeometryPool::init(BaseProject *bp, VkDeviceSize vertexBytes, VkDeviceSize indexBytes) {
+	BP = bp;
+	vertexRanges.init(0);
+	indexRanges.init(0);
+	if (vertexBytes == 0 || indexBytes == 0) {
+		return;
+	}
+	BP->createBuffer(vertexBytes,
+					 VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+					 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+					 vertexBuffer, vertexBufferMemory);
+	BP->createBuffer(indexBytes,
+					 VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+					 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+					 indexBuffer, indexBufferMemory);
+	vertexRanges.init(vertexBytes);
+	indexRanges.init(indexBytes);
+}
 
-	VkResult result = vkCreateShaderModule(BP->device, &createInfo, nullptr,
-					&shaderModule);
-	if (result != VK_SUCCESS) {
-	 	PrintVkError(result);
-		throw std::runtime_error("failed to create shader module!");
+VkDeviceSize GeometryPool::stride(const Model *M) {
+	return M->format == VERTEX_QUANTIZED ? sizeof(QuantizedVertex) : sizeof(Vertex);
+}
+
+VkDeviceSize GeometryPool::indexSize(const Model *M) {
+	return M->indexType == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t);
+}
+
+bool GeometryPool::add(Model *M) {
+	VkDeviceSize vertexBytes = stride(M) * M->vertices.size();
+	VkDeviceSize indexBytes = indexSize(M) * (M->indices.size() + M->lodIndices.size());
+	VkDeviceSize vertexOffset, indexOffset;
+	if (!vertexRanges.allocate(vertexBytes, stride(M), vertexOffset)) {
+		return false;
 	}
-	
-	return shaderModule;
+	if (!indexRanges.allocate(indexBytes, indexSize(M), indexOffset)) {
+		vertexRanges.release(vertexOffset, vertexBytes);
+		return false;
+	}
+
+	if (M->format == VERTEX_QUANTIZED) {
+		std::vector<QuantizedVertex> quantized = M->quantizeVertices();
+		upload(vertexBuffer, vertexOffset, quantized.data(), vertexBytes,
+			   VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT);
+	} else {
+		upload(vertexBuffer, vertexOffset, M->vertices.data(), vertexBytes,
+			   VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT);
+	}
+	if (M->indexType == VK_INDEX_TYPE_UINT16) {
+		std::vector<uint16_t> shorts = M->shortIndices();
+		upload(indexBuffer, indexOffset, shorts.data(), indexBytes, VK_ACCESS_INDEX_READ_BIT);
+	} else {
+		std::vector<uint32_t> all = M->bufferIndices();
+		upload(indexBuffer, indexOffset, all.data(), indexBytes, VK_ACCESS_INDEX_READ_BIT);
+	}
+
+	M->pooled = true;
+	M->vertexBuffer = vertexBuffer;
+	M->indexBuffer = indexBuffer;
+	M->baseVertex = static_cast<int32_t>(vertexOffset / stride(M));
+	M->baseIndex = static_cast<uint32_t>(indexOffset / indexSize(M));
+	return true;
 }
 
-void Pipeline::cleanup() {
-		vkDestroyPipeline(BP->device, graphicsPipeline, nullptr);
-		vkDestroyPipelineLayout(BP->device, pipelineLayout, nullptr);
+void GeometryPool::remove(Model *M) {
+	vertexRanges.release(M->baseVertex * stride(M), stride(M) * M->vertices.size());
+	indexRanges.release(M->baseIndex * indexSize(M),
+						indexSize(M) * (M->indices.size() + M->lodIndices.size()));
+	M->pooled = false;
+}
+
+// Copied on the graphics queue, unlike the buffers of single models: the
+// pool is in use there, its ownership cannot move to the transfer queue
+void GeometryPool::upload(VkBuffer buffer, VkDeviceSize offset, const void *data,
+						  VkDeviceSize size, VkAccessFlags access) {
+	VkBuffer stagingBuffer = BP->uploads.stage(data, size);
+	VkCommandBuffer commandBuffer = BP->uploads.begin();
+	VkBufferCopy copyRegion{};
+	copyRegion.srcOffset = 0;
+	copyRegion.dstOffset = offset;
+	copyRegion.size = size;
+	vkCmdCopyBuffer(commandBuffer, stagingBuffer, buffer, 1, &copyRegion);
+
+	VkBufferMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = access;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.buffer = buffer;
+	barrier.offset = offset;
+	barrier.size = size;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+						 VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0,
+						 0, nullptr, 1, &barrier, 0, nullptr);
+}
+
+void GeometryPool::cleanup() {
+	if (vertexBuffer == VK_NULL_HANDLE) {
+		return;
+	}
+	vkDestroyBuffer(BP->device, indexBuffer, nullptr);
+	vkFreeMemory(BP->device, indexBufferMemory, nullptr);
+	vkDestroyBuffer(BP->device, vertexBuffer, nullptr);
+	vkFreeMemory(BP->device, vertexBufferMemory, nullptr);
+	vertexBuffer = indexBuffer = VK_NULL_HANDLE;
 }
 
 void DescriptorSetLayout::init(BaseProject *bp, std::vector<DescriptorSetLayoutBinding> B) {
 	BP = bp;
+	layoutBindings = B;
 	
 	std::vector<VkDescriptorSetLayoutBinding> bindings;
 	bindings.resize(B.size());
@@ -1928,15 +7177,24 @@ void DescriptorSetLayout::cleanup() {
 void DescriptorSet::init(BaseProject *bp, DescriptorSetLayout *DSL,
 						 std::vector<DescriptorSetElement> E) {
 	BP = bp;
+	elements = E;
+	for (const auto& e : E) {
+		if (e.type == TEXTURE) {
+			e.tex->sets.push_back(this);
+		}
+	}
 	
 	// Create uniform buffer
 	uniformBuffers.resize(E.size());
 	uniformBuffersMemory.resize(E.size());
+	uniformBuffersMapped.resize(E.size());
+	ringOffsets.assign(E.size(), 0);
 	toFree.resize(E.size());
 
 	for (int j = 0; j < E.size(); j++) {
 		uniformBuffers[j].resize(BP->swapChainImages.size());
 		uniformBuffersMemory[j].resize(BP->swapChainImages.size());
+		uniformBuffersMapped[j].resize(BP->swapChainImages.size(), nullptr);
 		if(E[j].type == UNIFORM) {
 			for (size_t i = 0; i < BP->swapChainImages.size(); i++) {
 				VkDeviceSize bufferSize = E[j].size;
@@ -1944,12 +7202,36 @@ void DescriptorSet::init(BaseProject *bp, DescriptorSetLayout *DSL,
 									 	 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
 									 	 VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
 									 	 uniformBuffers[j][i], uniformBuffersMemory[j][i]);
+				VkResult result = vkMapMemory(BP->device, uniformBuffersMemory[j][i], 0,
+											  bufferSize, 0, &uniformBuffersMapped[j][i]);
+				if (result != VK_SUCCESS) {
+					PrintVkError(result);
+					throw std::runtime_error("failed to map uniform buffer!");
+				}
 			}
 			toFree[j] = true;
+		} else if (E[j].type == DYNAMIC_UNIFORM) {
+			ringOffsets[j] = BP->uniformRing.allocate(E[j].size);
+			for (size_t i = 0; i < BP->swapChainImages.size(); i++) {
+				uniformBuffersMapped[j][i] = BP->uniformRing.slot(static_cast<int>(i),
+																  ringOffsets[j]);
+			}
+			toFree[j] = false;
 		} else {
 			toFree[j] = false;
 		}
 	}
+	std::vector<std::pair<int, uint32_t>> dynamicBindings;
+	for (size_t j = 0; j < E.size(); j++) {
+		if (E[j].type == DYNAMIC_UNIFORM) {
+			dynamicBindings.push_back({E[j].binding, ringOffsets[j]});
+		}
+	}
+	std::sort(dynamicBindings.begin(), dynamicBindings.end());
+	dynamicOffsets.clear();
+	for (const auto& b : dynamicBindings) {
+		dynamicOffsets.push_back(b.second);
+	}
 	
 	// Create Descriptor set
 	std::vector<VkDescriptorSetLayout> layouts(BP->swapChainImages.size(),
@@ -1975,6 +7257,9 @@ void DescriptorSet::init(BaseProject *bp, DescriptorSetLayout *DSL,
 		std::vector<VkWriteDescriptorSet> descriptorWrites(E.size());
 		std::vector<VkDescriptorBufferInfo> bufferInfoVector;
 		std::vector<VkDescriptorImageInfo> imageInfoVector;
+		// The writes point into these vectors: they must not reallocate
+		bufferInfoVector.reserve(E.size());
+		imageInfoVector.reserve(E.size());
 
 		for (int j = 0; j < E.size(); j++) {
 			if(E[j].type == UNIFORM) {
@@ -1991,6 +7276,21 @@ void DescriptorSet::init(BaseProject *bp, DescriptorSetLayout *DSL,
 				descriptorWrites[j].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
 				descriptorWrites[j].descriptorCount = 1;
 				descriptorWrites[j].pBufferInfo = &(bufferInfoVector.back());
+			} else if(E[j].type == DYNAMIC_UNIFORM) {
+				// The region of image i; the slot is the dynamic offset
+				VkDescriptorBufferInfo bufferInfo{};
+				bufferInfo.buffer = BP->uniformRing.buffer;
+				bufferInfo.offset = BP->uniformRing.regionSize * i;
+				bufferInfo.range = E[j].size;
+				bufferInfoVector.push_back(bufferInfo);
+				
+				descriptorWrites[j].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+				descriptorWrites[j].dstSet = descriptorSets[i];
+				descriptorWrites[j].dstBinding = E[j].binding;
+				descriptorWrites[j].dstArrayElement = 0;
+				descriptorWrites[j].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+				descriptorWrites[j].descriptorCount = 1;
+				descriptorWrites[j].pBufferInfo = &(bufferInfoVector.back());
 			} else if(E[j].type == TEXTURE) {
 
 				VkDescriptorImageInfo imageInfo{};
@@ -2016,13 +7316,664 @@ void DescriptorSet::init(BaseProject *bp, DescriptorSetLayout *DSL,
 
 }
 
+int DescriptorSet::uniformElement(int binding, size_t size) {
+	for (size_t j = 0; j < elements.size(); j++) {
+		if (elements[j].binding == binding && elements[j].type != TEXTURE &&
+			static_cast<size_t>(elements[j].size) >= size) {
+			return static_cast<int>(j);
+		}
+	}
+	return -1;
+}
+
+void DescriptorSet::update(Texture *T, int currentImage) {
+	for (const auto& e : elements) {
+		if (e.type != TEXTURE || e.tex != T) {
+			continue;
+		}
+		VkDescriptorImageInfo imageInfo{};
+		imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		imageInfo.imageView = T->textureImageView;
+		imageInfo.sampler = T->textureSampler;
+		
+		VkWriteDescriptorSet descriptorWrite{};
+		descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrite.dstSet = descriptorSets[currentImage];
+		descriptorWrite.dstBinding = e.binding;
+		descriptorWrite.dstArrayElement = 0;
+		descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		descriptorWrite.descriptorCount = 1;
+		descriptorWrite.pImageInfo = &imageInfo;
+		vkUpdateDescriptorSets(BP->device, 1, &descriptorWrite, 0, nullptr);
+	}
+}
+
 void DescriptorSet::cleanup() {
+	for (const auto& e : elements) {
+		if (e.type == TEXTURE) {
+			auto& sets = e.tex->sets;
+			sets.erase(std::remove(sets.begin(), sets.end(), this), sets.end());
+		}
+	}
 	for(int j = 0; j < uniformBuffers.size(); j++) {
 		if(toFree[j]) {
 			for (size_t i = 0; i < BP->swapChainImages.size(); i++) {
+				vkUnmapMemory(BP->device, uniformBuffersMemory[j][i]);
 				vkDestroyBuffer(BP->device, uniformBuffers[j][i], nullptr);
 				vkFreeMemory(BP->device, uniformBuffersMemory[j][i], nullptr);
 			}
+		} else if (elements[j].type == DYNAMIC_UNIFORM) {
+			BP->uniformRing.release(ringOffsets[j], elements[j].size);
+		}
+	}
+}
+
+
+
+void LodDraw::init(BaseProject *bp, Model *m, bool visible) {
+	BP = bp;
+	M = m;
+	
+	drawBuffers.resize(BP->swapChainImages.size());
+	drawBuffersMemory.resize(BP->swapChainImages.size());
+	drawCommands.resize(BP->swapChainImages.size());
+	for (size_t i = 0; i < BP->swapChainImages.size(); i++) {
+		BP->createBuffer(sizeof(VkDrawIndexedIndirectCommand),
+						 VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+						 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+						 VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+						 drawBuffers[i], drawBuffersMemory[i]);
+		void *mapped;
+		VkResult result = vkMapMemory(BP->device, drawBuffersMemory[i], 0,
+									  sizeof(VkDrawIndexedIndirectCommand), 0, &mapped);
+		if (result != VK_SUCCESS) {
+			PrintVkError(result);
+			throw std::runtime_error("failed to map draw buffer!");
+		}
+		drawCommands[i] = static_cast<VkDrawIndexedIndirectCommand *>(mapped);
+		setLevel(static_cast<int>(i), 0, visible);
+	}
+}
+
+void LodDraw::draw(VkCommandBuffer commandBuffer, int currentImage) {
+	vkCmdDrawIndexedIndirect(commandBuffer, drawBuffers[currentImage], 0, 1,
+							 sizeof(VkDrawIndexedIndirectCommand));
+}
+
+uint32_t LodDraw::update(int currentImage, const glm::mat4& model,
+						 const glm::mat4& view, const glm::mat4& proj,
+						 bool visible) {
+	float viewportHeight = static_cast<float>(BP->swapChainExtent.height);
+	uint32_t level = M->selectLod(model, view, proj, viewportHeight);
+	setLevel(currentImage, level, visible);
+	if (visible && !textures.empty()) {
+		float size = M->screenSize(model, view, proj, viewportHeight);
+		for (Texture *T : textures) {
+			T->request(size);
+		}
+	}
+	return level;
+}
+
+void LodDraw::setLevel(int currentImage, uint32_t level, bool visible) {
+	VkDrawIndexedIndirectCommand command{};
+	command.indexCount = M->lods[level].indexCount;
+	command.instanceCount = visible ? 1 : 0;
+	command.firstIndex = M->lods[level].firstIndex + M->baseIndex;
+	command.vertexOffset = M->baseVertex;
+	command.firstInstance = 0;
+	*drawCommands[currentImage] = command;
+}
+
+void LodDraw::cleanup() {
+	for (size_t i = 0; i < drawBuffers.size(); i++) {
+		vkUnmapMemory(BP->device, drawBuffersMemory[i]);
+		vkDestroyBuffer(BP->device, drawBuffers[i], nullptr);
+		vkFreeMemory(BP->device, drawBuffersMemory[i], nullptr);
+	}
+}
+
+void InstancedDraw::init(BaseProject *bp, Model *m, uint32_t maxInstances) {
+	BP = bp;
+	M = m;
+	capacity = maxInstances;
+	pending.reserve(capacity);
+	pendingLevels.reserve(capacity);
+	
+	size_t images = BP->swapChainImages.size();
+	instanceBuffers.resize(images);
+	instanceBuffersMemory.resize(images);
+	instanceData.resize(images);
+	drawBuffers.resize(images);
+	drawBuffersMemory.resize(images);
+	drawCommands.resize(images);
+	VkDeviceSize instanceBytes = sizeof(InstanceData) * std::max(capacity, 1u) * M->lods.size();
+	VkDeviceSize drawBytes = sizeof(VkDrawIndexedIndirectCommand) * M->lods.size();
+	for (size_t i = 0; i < images; i++) {
+		BP->createBuffer(instanceBytes, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+						 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+						 VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+						 instanceBuffers[i], instanceBuffersMemory[i]);
+		BP->createBuffer(drawBytes, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+						 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+						 VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+						 drawBuffers[i], drawBuffersMemory[i]);
+		void *mapped[2];
+		VkResult result = vkMapMemory(BP->device, instanceBuffersMemory[i], 0,
+									  instanceBytes, 0, &mapped[0]);
+		if (result == VK_SUCCESS) {
+			result = vkMapMemory(BP->device, drawBuffersMemory[i], 0,
+								 drawBytes, 0, &mapped[1]);
+		}
+		if (result != VK_SUCCESS) {
+			PrintVkError(result);
+			throw std::runtime_error("failed to map instance buffers!");
+		}
+		instanceData[i] = static_cast<InstanceData *>(mapped[0]);
+		drawCommands[i] = static_cast<VkDrawIndexedIndirectCommand *>(mapped[1]);
+		begin();
+		end(static_cast<int>(i));
+	}
+}
+
+void InstancedDraw::begin() {
+	pending.clear();
+	pendingLevels.clear();
+}
+
+void InstancedDraw::add(const glm::mat4& model, const glm::mat4& view,
+						const glm::mat4& proj, float fadeOut) {
+	if (pending.size() >= capacity) {
+		return;
+	}
+	float viewportHeight = static_cast<float>(BP->swapChainExtent.height);
+	pending.push_back({model, glm::vec4(fadeOut, 0.0f, 0.0f, 0.0f)});
+	pendingLevels.push_back(M->selectLod(model, view, proj, viewportHeight));
+	if (!textures.empty()) {
+		float size = M->screenSize(model, view, proj, viewportHeight);
+		for (Texture *T : textures) {
+			T->request(size);
+		}
+	}
+}
+
+uint32_t InstancedDraw::end(int currentImage) {
+	// Each instance goes to the region of its level
+	std::vector<uint32_t> count(M->lods.size(), 0);
+	InstanceData *data = instanceData[currentImage];
+	for (size_t i = 0; i < pending.size(); i++) {
+		uint32_t level = pendingLevels[i];
+		data[static_cast<size_t>(level) * capacity + count[level]++] = pending[i];
+	}
+	for (size_t l = 0; l < M->lods.size(); l++) {
+		VkDrawIndexedIndirectCommand& command = drawCommands[currentImage][l];
+		command.indexCount = M->lods[l].indexCount;
+		command.instanceCount = count[l];
+		command.firstIndex = M->lods[l].firstIndex + M->baseIndex;
+		command.vertexOffset = M->baseVertex;
+		command.firstInstance = 0;
+	}
+	return static_cast<uint32_t>(pending.size());
+}
+
+void InstancedDraw::draw(VkCommandBuffer commandBuffer, int currentImage) {
+	for (size_t l = 0; l < M->lods.size(); l++) {
+		VkDeviceSize offset = sizeof(InstanceData) * capacity * l;
+		vkCmdBindVertexBuffers(commandBuffer, 1, 1, &instanceBuffers[currentImage], &offset);
+		vkCmdDrawIndexedIndirect(commandBuffer, drawBuffers[currentImage],
+								 sizeof(VkDrawIndexedIndirectCommand) * l, 1,
+								 sizeof(VkDrawIndexedIndirectCommand));
+	}
+}
+
+void InstancedDraw::cleanup() {
+	for (size_t i = 0; i < instanceBuffers.size(); i++) {
+		vkUnmapMemory(BP->device, instanceBuffersMemory[i]);
+		vkDestroyBuffer(BP->device, instanceBuffers[i], nullptr);
+		vkFreeMemory(BP->device, instanceBuffersMemory[i], nullptr);
+		vkUnmapMemory(BP->device, drawBuffersMemory[i]);
+		vkDestroyBuffer(BP->device, drawBuffers[i], nullptr);
+		vkFreeMemory(BP->device, drawBuffersMemory[i], nullptr);
+	}
+}
+
+
+
+void SceneObject::write(int currentImage, const void *data, size_t size) {
+	if (!ready) {
+		return;
+	}
+	for (size_t j = 0; j < elements.size(); j++) {
+		if (elements[j].type != TEXTURE) {
+			memcpy(set.uniformBuffersMapped[j][currentImage], data, size);
+			return;
+		}
+	}
+}
+
+void SceneObject::show(int currentImage, bool visible) {
+	// Instanced objects are shown by adding instances
+	if (ready && model != nullptr && instanceCapacity == 0) {
+		lodDraw.setLevel(currentImage, 0, visible);
+		// Without a transform, shown objects get all the detail
+		if (visible) {
+			for (Texture *T : lodDraw.textures) {
+				T->request(std::numeric_limits<float>::max());
+			}
+		}
+	}
+}
+
+VkShaderStageFlags Scene::stage(const std::string& name) {
+	if (name == "vertex") return VK_SHADER_STAGE_VERTEX_BIT;
+	if (name == "fragment") return VK_SHADER_STAGE_FRAGMENT_BIT;
+	if (name == "all") return VK_SHADER_STAGE_ALL_GRAPHICS;
+	throw std::runtime_error("scene: unknown shader stage " + name + "!");
+}
+
+void Scene::configure(Texture *T, const nlohmann::json& entry) {
+	T->highQuality = entry.value("quality", "") == "high";
+	T->mipFilter = entry.value("filter", "box") == "kaiser" ? MIP_FILTER_KAISER : MIP_FILTER_BOX;
+	T->wrapMips = entry.value("wrap", false);
+	T->stream = entry.value("stream", false);
+}
+
+void Scene::read(const std::string& file) {
+	std::ifstream in(file);
+	if (!in.is_open()) {
+		throw std::runtime_error("failed to open scene " + file + "!");
+	}
+	try {
+		manifest = nlohmann::json::parse(in);
+	} catch (const nlohmann::json::exception& e) {
+		throw std::runtime_error("failed to parse scene " + file + ": " + e.what());
+	}
+}
+
+void Scene::poolSizes(int& uniformBlocks, int& textures, int& sets) {
+	uniformBlocks = textures = sets = 0;
+	for (const char *list : {"globals", "objects"}) {
+		for (const auto& o : manifest.value(list, nlohmann::json::array())) {
+			for (const auto& b : o.at("bindings")) {
+				if (b.contains("uniform")) {
+					uniformBlocks++;
+				} else {
+					textures++;
+				}
+			}
+			sets++;
+		}
+	}
+}
+
+void Scene::init(BaseProject *bp, std::unordered_map<std::string, size_t> sizes) {
+	BP = bp;
+	uniformSizes = sizes;
+	
+	for (const auto& [name, bindings] : manifest.at("layouts").items()) {
+		std::vector<DescriptorSetLayoutBinding> B;
+		for (const auto& b : bindings) {
+			std::string type = b.at("type").get<std::string>();
+			B.push_back({b.at("binding").get<uint32_t>(),
+						 type == "uniform" ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER :
+						 type == "dynamic" ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC :
+							VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+						 stage(b.value("stage", "all"))});
+		}
+		layouts[name] = std::make_unique<DescriptorSetLayout>();
+		layouts[name]->init(BP, B);
+	}
+	auto layout = [this](const std::string& name) {
+		auto found = layouts.find(name);
+		if (found == layouts.end()) {
+			throw std::runtime_error("scene: unknown layout " + name + "!");
+		}
+		return found->second.get();
+	};
+	
+	for (const auto& p : manifest.at("pipelines")) {
+		std::vector<DescriptorSetLayout *> D;
+		for (const auto& name : p.at("layouts")) {
+			D.push_back(layout(name.get<std::string>()));
+		}
+		std::string name = p.at("name").get<std::string>();
+		pipelines[name] = std::make_unique<Pipeline>();
+		for (const auto& c : p.value("push", nlohmann::json::array())) {
+			pipelines[name]->pushConstantRanges.push_back({stage(c.value("stage", "vertex")),
+														   c.value("offset", 0u),
+														   c.at("size").get<uint32_t>()});
+			// The pushed values change every frame
+			BP->recordEachFrame = true;
+		}
+		pipelines[name]->instanced = p.value("instanced", false);
+		pipelines[name]->init(BP, p.at("vert").get<std::string>(),
+							  p.at("frag").get<std::string>(), D,
+							  p.value("quantized", false) ? VERTEX_QUANTIZED : VERTEX_FLOAT);
+	}
+	
+	// name -> (file, lazy)
+	std::unordered_map<std::string, std::pair<std::string, bool>> files[2];
+	const char *assetLists[2] = {"models", "textures"};
+	for (int k = 0; k < 2; k++) {
+		for (const auto& a : manifest.at(assetLists[k])) {
+			files[k][a.at("name").get<std::string>()] = {
+				a.at("file").get<std::string>(), a.value("load", "eager") == "lazy"};
+			if (k == 1) {
+				textureEntries[a.at("file").get<std::string>()] = a;
+			}
+		}
+	}
+	auto asset = [&](int k, const std::string& name, bool& lazy) {
+		auto found = files[k].find(name);
+		if (found == files[k].end()) {
+			throw std::runtime_error(std::string("scene: unknown ") + assetLists[k] +
+									 " entry " + name + "!");
+		}
+		lazy = lazy || found->second.second;
+		return found->second.first;
+	};
+	
+	std::vector<SceneObject *> eager;
+	for (const char *list : {"globals", "objects"}) {
+		for (const auto& o : manifest.value(list, nlohmann::json::array())) {
+			auto O = std::make_unique<SceneObject>();
+			O->name = o.at("name").get<std::string>();
+			O->layout = layout(o.at("layout").get<std::string>());
+			if (o.contains("pipeline")) {
+				auto found = pipelines.find(o.at("pipeline").get<std::string>());
+				if (found == pipelines.end()) {
+					throw std::runtime_error("scene: unknown pipeline for " + O->name + "!");
+				}
+				O->pipeline = found->second.get();
+			}
+			if (o.contains("model")) {
+				O->modelFile = asset(0, o.at("model").get<std::string>(), O->lazy);
+				O->instanceCapacity = o.value("instances", 0u);
+			}
+			if (o.contains("impostor")) {
+				// Baked from the model and texture of another object
+				const auto& source = o.at("impostor");
+				O->modelFile = asset(0, source.at("model").get<std::string>(), O->lazy);
+				O->textureFiles.push_back(asset(1, source.at("texture").get<std::string>(), O->lazy));
+				impostors.push_back(std::make_unique<Impostor>());
+				O->impostor = impostors.back().get();
+				O->impostor->cacheName = O->modelFile;
+			}
+			for (const auto& b : o.at("bindings")) {
+				DescriptorSetElement element{b.at("binding").get<int>(), UNIFORM, 0, nullptr};
+				if (b.contains("uniform")) {
+					auto size = uniformSizes.find(b.at("uniform").get<std::string>());
+					if (size == uniformSizes.end()) {
+						throw std::runtime_error("scene: unknown uniform block for " + O->name + "!");
+					}
+					element.size = static_cast<int>(size->second);
+					for (const auto& l : O->layout->layoutBindings) {
+						if (static_cast<int>(l.binding) == element.binding &&
+							l.type == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC) {
+							element.type = DYNAMIC_UNIFORM;
+						}
+					}
+				} else {
+					element.type = TEXTURE;
+					if (b.contains("impostor") && O->impostor != nullptr) {
+						// The "albedo" or "normals" atlas of the impostor
+						element.tex = b.at("impostor").get<std::string>() == "normals" ?
+									  &O->impostor->normals : &O->impostor->albedo;
+					} else {
+						O->textureFiles.push_back(asset(1, b.at("texture").get<std::string>(), O->lazy));
+					}
+				}
+				O->elements.push_back(element);
+			}
+			if (O->pipeline == nullptr) {
+				// A global set is bound with the pipelines that name it
+				for (const auto& p : manifest.at("pipelines")) {
+					if (p.value("global", "") == O->name) {
+						pipelineGlobals[pipelines[p.at("name").get<std::string>()].get()] = O.get();
+					}
+				}
+			}
+			if (!O->lazy) {
+				eager.push_back(O.get());
+			}
+			objects.push_back(std::move(O));
+		}
+	}
+	create(eager);
+}
+
+void Scene::create(std::vector<SceneObject *> created) {
+	// The registry may have queued files for the prefetch: wait for them
+	finishPrefetch();
+	// Acquire everything first, so that the registry loads in parallel
+	std::vector<std::vector<Texture *>> textures = acquire(created);
+	BP->assets.loadAll();
+	bake(created);
+	finish(created, textures);
+}
+
+std::vector<std::vector<Texture *>> Scene::acquire(const std::vector<SceneObject *>& created) {
+	std::vector<std::vector<Texture *>> textures(created.size());
+	for (size_t i = 0; i < created.size(); i++) {
+		SceneObject *O = created[i];
+		for (const auto& file : O->textureFiles) {
+			textures[i].push_back(BP->assets.texture(file));
+			configure(textures[i].back(), textureEntries.at(file));
+		}
+		if (O->impostor != nullptr) {
+			O->impostorModel = BP->assets.model(O->modelFile);
+			O->impostorTexture = textures[i][0];
+			textures[i].erase(textures[i].begin());
+		} else if (!O->modelFile.empty()) {
+			O->model = BP->assets.model(O->modelFile);
+		}
+	}
+	return textures;
+}
+
+void Scene::bake(const std::vector<SceneObject *>& created) {
+	AssetLoader baker;
+	for (SceneObject *O : created) {
+		if (O->impostor != nullptr) {
+			if (O->impostorTexture->pixels == nullptr) {
+				throw std::runtime_error("scene: the texture of impostor " + O->name +
+										 " was already uploaded, load them together!");
+			}
+			baker.add(O->impostor, O->impostorModel, O->impostorTexture);
+		}
+	}
+	baker.loadAll();
+}
+
+void Scene::finish(const std::vector<SceneObject *>& created,
+				   const std::vector<std::vector<Texture *>>& textures) {
+	BP->assets.initAll();
+	
+	for (size_t i = 0; i < created.size(); i++) {
+		SceneObject *O = created[i];
+		size_t nextTexture = 0;
+		for (auto& element : O->elements) {
+			if (element.type == TEXTURE && element.tex == nullptr) {
+				element.tex = textures[i][nextTexture++];
+			}
+		}
+		if (O->impostor != nullptr) {
+			O->impostor->init(BP);
+			if (!hasQuad) {
+				Impostor::buildQuad(&impostorQuad);
+				impostorQuad.init(BP);
+				hasQuad = true;
+			}
+			O->model = &impostorQuad;
+		}
+		O->set.init(BP, O->layout, O->elements);
+		if (O->model != nullptr && O->instanceCapacity > 0) {
+			if (!O->pipeline->instanced) {
+				throw std::runtime_error("scene: the pipeline of " + O->name +
+										 " must be instanced!");
+			}
+			O->instances.init(BP, O->model, O->instanceCapacity);
+			for (const auto& element : O->elements) {
+				if (element.type == TEXTURE && element.tex->stream) {
+					O->instances.textures.push_back(element.tex);
+				}
+			}
+		} else if (O->model != nullptr) {
+			O->lodDraw.init(BP, O->model, false);
+			for (const auto& element : O->elements) {
+				if (element.type == TEXTURE && element.tex->stream) {
+					O->lodDraw.textures.push_back(element.tex);
+				}
+			}
+		}
+		O->ready = true;
+	}
+}
+
+SceneObject *Scene::object(const std::string& name) {
+	for (auto& O : objects) {
+		if (O->name == name) {
+			return O.get();
+		}
+	}
+	throw std::runtime_error("scene: unknown object " + name + "!");
+}
+
+void Scene::prefetch(std::vector<SceneObject *> lazy) {
+	finishPrefetch();
+	for (SceneObject *O : lazy) {
+		if (!O->ready) {
+			prefetched.push_back(O);
+		}
+	}
+	prefetchedTextures = acquire(prefetched);
+	AssetLoader loader;
+	BP->assets.queue(loader);
+	prefetching = std::async(std::launch::async, [loader, objects = prefetched]() mutable {
+		loader.loadAll();
+		bake(objects);
+	});
+}
+
+void Scene::finishPrefetch() {
+	if (!prefetching.valid()) {
+		return;
+	}
+	// Rethrows the errors of the worker
+	prefetching.get();
+	finish(prefetched, prefetchedTextures);
+	prefetched.clear();
+	prefetchedTextures.clear();
+}
+
+void Scene::require(SceneObject *O) {
+	if (O->ready) {
+		return;
+	}
+	if (std::find(prefetched.begin(), prefetched.end(), O) == prefetched.end()) {
+		std::cout << "Loading " << O->name << "\n";
+		create({O});
+	} else {
+		finishPrefetch();
+	}
+	BP->uploads.submit();
+	BP->invalidateCommandBuffers();
+}
+
+void Scene::draw(VkCommandBuffer commandBuffer, int currentImage) {
+	Pipeline *bound = nullptr;
+	// Pooled models share their buffers: bound once for all of them
+	VkBuffer boundVertices = VK_NULL_HANDLE;
+	VkBuffer boundIndices = VK_NULL_HANDLE;
+	VkIndexType boundIndexType = VK_INDEX_TYPE_UINT32;
+	for (auto& O : objects) {
+		if (!O->ready || O->model == nullptr) {
+			continue;
+		}
+		if (O->pipeline != bound) {
+			bound = O->pipeline;
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+							  bound->graphicsPipeline);
+			auto global = pipelineGlobals.find(bound);
+			if (global != pipelineGlobals.end()) {
+				const DescriptorSet& set = global->second->set;
+				vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+										bound->pipelineLayout, 0, 1,
+										&set.descriptorSets[currentImage],
+										static_cast<uint32_t>(set.dynamicOffsets.size()),
+										set.dynamicOffsets.data());
+			}
+		}
+		const Model *M = O->model;
+		if (M->vertexBuffer != boundVertices) {
+			boundVertices = M->vertexBuffer;
+			VkBuffer vertexBuffers[] = {boundVertices};
+			VkDeviceSize offsets[] = {0};
+			vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
+		}
+		if (M->indexBuffer != boundIndices || M->indexType != boundIndexType) {
+			boundIndices = M->indexBuffer;
+			boundIndexType = M->indexType;
+			vkCmdBindIndexBuffer(commandBuffer, boundIndices, 0, boundIndexType);
+		}
+		if (!bound->pushConstantRanges.empty()) {
+			bound->push(commandBuffer, O->transform);
+		}
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+								bound->pipelineLayout, 1, 1,
+								&O->set.descriptorSets[currentImage],
+								static_cast<uint32_t>(O->set.dynamicOffsets.size()),
+								O->set.dynamicOffsets.data());
+		if (O->instanceCapacity > 0) {
+			O->instances.draw(commandBuffer, currentImage);
+		} else {
+			O->lodDraw.draw(commandBuffer, currentImage);
+		}
+	}
+}
+
+void Scene::cleanup() {
+	// Prefetched files not created yet are freed with the registry
+	if (prefetching.valid()) {
+		prefetching.wait();
+	}
+	for (auto& O : objects) {
+		if (!O->ready) {
+			continue;
+		}
+		O->set.cleanup();
+		if (O->model != nullptr && O->instanceCapacity > 0) {
+			O->instances.cleanup();
+		} else if (O->model != nullptr) {
+			O->lodDraw.cleanup();
+		}
+		if (O->impostor != nullptr) {
+			O->impostor->cleanup();
+			BP->assets.release(O->impostorModel);
+			BP->assets.release(O->impostorTexture);
+		} else if (O->model != nullptr) {
+			BP->assets.release(O->model);
+		}
+		for (const auto& element : O->elements) {
+			if (element.type == TEXTURE && (O->impostor == nullptr ||
+				(element.tex != &O->impostor->albedo && element.tex != &O->impostor->normals))) {
+				BP->assets.release(element.tex);
+			}
 		}
 	}
-}
\ No newline at end of file
+	objects.clear();
+	impostors.clear();
+	if (hasQuad) {
+		impostorQuad.cleanup();
+		hasQuad = false;
+	}
+	for (auto& [name, P] : pipelines) {
+		P->cleanup();
+	}
+	pipelines.clear();
+	pipelineGlobals.clear();
+	for (auto& [name, L] : layouts) {
+		L->cleanup();
+	}
+	layouts.clear();
+}
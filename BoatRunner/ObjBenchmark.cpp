@@ -0,0 +1,79 @@
+// Compares the ObjReader used by Model::loadModel against the reference
+// tinyobj loader: parse time (best and average of several runs) and the
+// peak resident set size of the process.
+//
+// Build it like main.cpp (same include and library paths), then run it
+// once per loader so that each process reports its own peak memory:
+//   ObjBenchmark objreader models/Boat.obj models/viking_room.obj
+//   ObjBenchmark tinyobj models/Boat.obj models/viking_room.obj
+#include "MyProject.hpp"
+
+#ifdef _WIN32
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#endif
+
+// Peak resident set size of this process, in KB
+size_t peakMemoryKB() {
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters{};
+	GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+	return counters.PeakWorkingSetSize / 1024;
+#else
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return static_cast<size_t>(usage.ru_maxrss);
+#endif
+}
+
+int main(int argc, char **argv) {
+	if (argc < 3 || (strcmp(argv[1], "objreader") != 0 &&
+					 strcmp(argv[1], "tinyobj") != 0)) {
+		std::cerr << "usage: " << argv[0] << " objreader|tinyobj file.obj...\n";
+		return EXIT_FAILURE;
+	}
+	const bool useTinyobj = strcmp(argv[1], "tinyobj") == 0;
+	const int runs = 10;
+
+	std::cout.setstate(std::ios::failbit);	// silence the per-load stats
+	size_t startMemory = peakMemoryKB();
+	std::vector<std::string> report;
+
+	for (int f = 2; f < argc; f++) {
+		double best = 0.0, total = 0.0;
+		size_t vertexCount = 0;
+		for (int r = 0; r < runs; r++) {
+			Model M;
+			auto start = std::chrono::high_resolution_clock::now();
+			if (useTinyobj) {
+				M.loadObjTinyobj(argv[f]);
+			} else {
+				MappedFile source;
+				if (!source.open(argv[f])) {
+					std::cerr << "cannot open " << argv[f] << "\n";
+					return EXIT_FAILURE;
+				}
+				ObjReader::read(source.data, source.size, M.vertices, M.indices);
+			}
+			double ms = std::chrono::duration<double, std::milli>(
+							std::chrono::high_resolution_clock::now() - start).count();
+			best = (r == 0) ? ms : std::min(best, ms);
+			total += ms;
+			vertexCount = M.vertices.size();
+		}
+		report.push_back(std::string(argv[f]) + ": best " + std::to_string(best) +
+						 " ms, average " + std::to_string(total / runs) + " ms, " +
+						 std::to_string(vertexCount) + " vertices");
+	}
+
+	std::cout.clear();
+	std::cout << argv[1] << "\n";
+	for (const auto& line : report) {
+		std::cout << "  " << line << "\n";
+	}
+	std::cout << "  peak RSS " << peakMemoryKB() << " KB (" <<
+				 (peakMemoryKB() - startMemory) << " KB above start)\n";
+	return EXIT_SUCCESS;
+}
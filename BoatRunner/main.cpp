@@ -19,6 +19,18 @@ struct globalUniformBufferObject {
 // Set 1, binding 1 is the texture
 struct UniformBufferObject {
 	alignas(16) glm::mat4 model;
+	alignas(4) float fadeOut; // how much the object is replaced by its impostor (Impostor::fade)
+};
+
+// The impostor ubo places the quad of an Impostor, drawn with the "impostor"
+// pipeline of scene.json
+// Set 1, binding 0 is this object
+// Set 1, binding 1 and 2 are the albedo and normal atlases
+struct ImpostorUniformBufferObject {
+	alignas(16) glm::mat4 model;
+	alignas(4) float fadeIn;
+	alignas(16) glm::vec4 centerRadius;
+	alignas(4) float frames;
 };
 
 
@@ -49,54 +61,20 @@ protected:
 	bool gameOver = false; //boolean variable to detect the gameover 
 	bool gameStarted = false; //boolean variable to handle the beginning of the game
 
-	// Here you list all the Vulkan objects you need:
-
-	// Descriptor Layouts [what will be passed to the shaders]
-	//Those will be used in P1 to handle the game's main scene
-	DescriptorSetLayout DSLglobal;
-	DescriptorSetLayout DSLobj;
-	//Those will be used in P2 to handle the game's screens of gameover and newgame
-	DescriptorSetLayout DSL_globalText; 
-	DescriptorSetLayout DSL_objText;
-
-
-	// Pipelines [Shader couples]
-	Pipeline P1; // this pipeline is for the game main scene
-	Pipeline P2; // this pipeline is for the gameover/newgame plane
-	
-
-	// Models, textures and Descriptors (values assigned to the uniforms)
-	
-	// Little rock
-	Model M_Rock1;
-	Texture T_Rock1;
-	DescriptorSet DS_R1; // instance of DSLobj
-
-	// Big rock 
-	Model M_Rock2;
-	Texture T_Rock2;
-	DescriptorSet DS_R2; // instance of DSLobj
-
-	// Boat
-	Model M_Boat;
-	Texture T_Boat;
-	DescriptorSet DS_Boat;
-
-	//Sea
-	Model M_Sea;
-	Texture T_Sea;
-	DescriptorSet DS_Sea;
-
-	// Gameover screen
-	Model M_GameOver;
-	Texture T_GameOver;
-	DescriptorSet DS_GameOver;
-
-	// New game screen (we can use the same model of the gameover screen)
-	Texture T_NewGame;
-	DescriptorSet DS_NewGame;
-
-	DescriptorSet DS_global;
+	// The Vulkan objects (layouts, pipelines, models, textures and their
+	// descriptor sets) are declared in scene.json and owned by the scene
+	Scene scene;
+
+	// Objects of the scene updated in updateUniformBuffer
+	SceneObject *O_global; // view and proj, set 0 of every pipeline
+	SceneObject *O_Rock1; // little rocks, drawn as instances
+	SceneObject *O_Rock2; // big rocks, drawn as instances
+	SceneObject *O_I1; // drawn instead of the little rock when it is far away
+	SceneObject *O_I2;
+	SceneObject *O_Boat;
+	SceneObject *O_Sea;
+	SceneObject *O_GameOver; // loaded in the background, created when the game is over
+	SceneObject *O_NewGame;
 
 	// Here you set the main application parameters
 	void setWindowParameters() {
@@ -106,241 +84,52 @@ protected:
 		windowTitle = "Boat Runner";
 		initialBackgroundColor = { 1.0f, 1.0f, 1.0f, 1.0f };
 
-		// Descriptor pool sizes
-		uniformBlocksInPool = 5;
-		texturesInPool = 6;
-		setsInPool = 7;
+		// Descriptor pool sizes, enough for all the objects of the scene
+		scene.read("scene.json");
+		scene.poolSizes(uniformBlocksInPool, texturesInPool, setsInPool);
+
+		// Device memory for the mip levels of the streamed textures
+		textureBudget = 128ull * 1024 * 1024;
+
+		// Cooked assets, packed with: AssetPacker scene.json assets.pak
+		bundleFile = "assets.pak";
 	}
 
 	// Here you load and setup all your Vulkan objects
 	void localInit() {
-
-		// Descriptor Layouts [what will be passed to the shaders]
-		DSLobj.init(this, {
-			// this array contains the binding:
-			// first  element : the binding number
-			// second element : the time of element (buffer or texture)
-			// third  element : the pipeline stage where it will be used
-			{0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_VERTEX_BIT},
-			{1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT}
-			});
-
-		DSLglobal.init(this, {
-			{0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_ALL_GRAPHICS}
-			});
-
-		DSL_objText.init(this, {
-			// this array contains the binding:
-			// first  element : the binding number
-			// second element : the time of element (buffer or texture)
-			// third  element : the pipeline stage where it will be used
-			{0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_VERTEX_BIT},
-			{1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT}
-			});
-
-		DSL_globalText.init(this, {
-			{0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_ALL_GRAPHICS}
-			});
-
-		// Pipelines [Shader couples]
-		// The last array, is a vector of pointer to the layouts of the sets that will
-		// be used in this pipeline. The first element will be set 0, and so on..
-		P1.init(this, "shaders/vert.spv", "shaders/frag.spv", { &DSLglobal , &DSLobj });
-
-		// Models, textures and Descriptors (values assigned to the uniforms)
-		M_Rock1.init(this, "models/Rock_1.obj");
-		T_Rock1.init(this, "textures/Rock_1_Base_Color.jpg");
-		DS_R1.init(this, &DSLobj, {
-			// the second parameter, is a pointer to the Uniform Set Layout of this set
-			// the last parameter is an array, with one element per binding of the set.
-			// first  elmenet : the binding number
-			// second element : UNIFORM or TEXTURE (an enum) depending on the type
-			// third  element : only for UNIFORMs, the size of the corresponding C++ object
-			// fourth element : only for TEXTUREs, the pointer to the corresponding texture object
-						{0, UNIFORM, sizeof(UniformBufferObject), nullptr},
-						{1, TEXTURE, 0, &T_Rock1}
-			});
-
-		M_Rock2.init(this, "models/rock1.obj");
-		T_Rock2.init(this, "textures/rock_low_Base_Color.png");
-		DS_R2.init(this, &DSLobj, {
-						{0, UNIFORM, sizeof(UniformBufferObject), nullptr},
-						{1, TEXTURE, 0, &T_Rock2}
-			});
-
-		M_Boat.init(this, "models/Boat.obj");
-		T_Boat.init(this, "textures/boat_diffuse.bmp");
-		DS_Boat.init(this, &DSLobj, {
-						{0, UNIFORM, sizeof(UniformBufferObject), nullptr},
-						{1, TEXTURE, 0, &T_Boat}
-			});
-
-		M_Sea.init(this, "models/LargePlane.obj");
-		T_Sea.init(this, "textures/sea.jpeg");
-		DS_Sea.init(this, &DSLobj, {
-						{0, UNIFORM, sizeof(UniformBufferObject), nullptr},
-						{1, TEXTURE, 0, &T_Sea}
-			});
-
-		DS_global.init(this, &DSLglobal, {
-						{0, UNIFORM, sizeof(globalUniformBufferObject), nullptr}
+		// Models and textures are shared by file through the asset registry,
+		// and read in parallel. The uniform blocks named in scene.json are
+		// the C++ objects below.
+		scene.init(this, {
+			{"global", sizeof(globalUniformBufferObject)},
+			{"object", sizeof(UniformBufferObject)},
+			{"impostor", sizeof(ImpostorUniformBufferObject)}
 			});
 
-		P2.init(this, "shaders/vert.spv", "shaders/menu_frag.spv", { &DSL_globalText , &DSL_objText });
-
-		M_GameOver.init(this, "models/LargePlane.obj");
-		T_GameOver.init(this, "textures/youdied3.png"); 
-		DS_GameOver.init(this, &DSL_objText, {
-						{0, UNIFORM, sizeof(UniformBufferObject), nullptr},
-						{1, TEXTURE, 0, &T_GameOver}
-			});
-
-		T_NewGame.init(this, "textures/new_game.png"); 
-		DS_NewGame.init(this, &DSL_objText, {
-						{0, UNIFORM, sizeof(UniformBufferObject), nullptr},
-						{1, TEXTURE, 0, &T_NewGame}
-			});
+		O_global = scene.object("global");
+		O_Rock1 = scene.object("littleRock");
+		O_Rock2 = scene.object("bigRock");
+		O_I1 = scene.object("littleRockImpostor");
+		O_I2 = scene.object("bigRockImpostor");
+		O_Boat = scene.object("boat");
+		O_Sea = scene.object("sea");
+		O_GameOver = scene.object("gameOver");
+		O_NewGame = scene.object("newGame");
+		scene.prefetch({O_GameOver});
 	}
 
 	// Here you destroy all the objects you created!		
 	void localCleanup() {
-		DS_R1.cleanup();
-		T_Rock1.cleanup();
-		M_Rock1.cleanup(); 
-
-		DS_R2.cleanup();
-		T_Rock2.cleanup();
-		M_Rock2.cleanup();
-
-		DS_Boat.cleanup();
-		T_Boat.cleanup();
-		M_Boat.cleanup();
-
-		DS_Sea.cleanup();
-		T_Sea.cleanup();
-		M_Sea.cleanup();
-
-		DS_GameOver.cleanup();
-		T_GameOver.cleanup();
-		M_GameOver.cleanup();
-
-		DS_NewGame.cleanup();
-		T_NewGame.cleanup();
-
-		DS_global.cleanup();
-
-		P1.cleanup();
-		P2.cleanup();
-		DSLglobal.cleanup();
-		DSLobj.cleanup();
-		DSL_globalText.cleanup();
-		DSL_objText.cleanup();
+		scene.cleanup();
 	}
 
 	// Here it is the creation of the command buffer:
 	// You send to the GPU all the objects you want to draw,
 	// with their buffers and textures
 	void populateCommandBuffer(VkCommandBuffer commandBuffer, int currentImage) {
-
-		//pipeline P1
-		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-			P1.graphicsPipeline);
-		vkCmdBindDescriptorSets(commandBuffer,
-			VK_PIPELINE_BIND_POINT_GRAPHICS,
-			P1.pipelineLayout, 0, 1, &DS_global.descriptorSets[currentImage],
-			0, nullptr);
-
-		//Little rock
-		VkBuffer vertexBuffers[] = { M_Rock1.vertexBuffer };
-		// property .vertexBuffer of models, contains the VkBuffer handle to its vertex buffer
-		VkDeviceSize offsets[] = { 0 };
-		vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
-		// property .indexBuffer of models, contains the VkBuffer handle to its index buffer
-		vkCmdBindIndexBuffer(commandBuffer, M_Rock1.indexBuffer, 0,
-			VK_INDEX_TYPE_UINT32);
-		// property .pipelineLayout of a pipeline contains its layout.
-		// property .descriptorSets of a descriptor set contains its elements.
-		vkCmdBindDescriptorSets(commandBuffer,
-			VK_PIPELINE_BIND_POINT_GRAPHICS,
-			P1.pipelineLayout, 1, 1, &DS_R1.descriptorSets[currentImage],
-			0, nullptr);
-		// property .indices.size() of models, contains the number of triangles * 3 of the mesh.
-		vkCmdDrawIndexed(commandBuffer,
-			static_cast<uint32_t>(M_Rock1.indices.size()), 1, 0, 0, 0);
-	
-		//Big rock
-		VkBuffer vertexBuffers2[] = { M_Rock2.vertexBuffer };
-		VkDeviceSize offsets2[] = { 0 };
-		vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers2, offsets2);
-		vkCmdBindIndexBuffer(commandBuffer, M_Rock2.indexBuffer, 0,
-			VK_INDEX_TYPE_UINT32);
-		vkCmdBindDescriptorSets(commandBuffer,
-			VK_PIPELINE_BIND_POINT_GRAPHICS,
-			P1.pipelineLayout, 1, 1, &DS_R2.descriptorSets[currentImage],
-			0, nullptr);
-		vkCmdDrawIndexed(commandBuffer,
-			static_cast<uint32_t>(M_Rock2.indices.size()), 1, 0, 0, 0);
-	
-		//Boat
-		VkBuffer vertexBuffers3[] = { M_Boat.vertexBuffer };
-		VkDeviceSize offsets3[] = { 0 };
-		vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers3, offsets3);
-		vkCmdBindIndexBuffer(commandBuffer, M_Boat.indexBuffer, 0,
-			VK_INDEX_TYPE_UINT32);
-		vkCmdBindDescriptorSets(commandBuffer,
-			VK_PIPELINE_BIND_POINT_GRAPHICS,
-			P1.pipelineLayout, 1, 1, &DS_Boat.descriptorSets[currentImage],
-			0, nullptr);
-		vkCmdDrawIndexed(commandBuffer,
-			static_cast<uint32_t>(M_Boat.indices.size()), 1, 0, 0, 0);
-
-		//Sea
-		VkBuffer vertexBuffers4[] = { M_Sea.vertexBuffer };
-		VkDeviceSize offsets4[] = { 0 };
-		vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers4, offsets4);
-		vkCmdBindIndexBuffer(commandBuffer, M_Sea.indexBuffer, 0,
-			VK_INDEX_TYPE_UINT32);
-		vkCmdBindDescriptorSets(commandBuffer,
-			VK_PIPELINE_BIND_POINT_GRAPHICS,
-			P1.pipelineLayout, 1, 1, &DS_Sea.descriptorSets[currentImage],
-			0, nullptr);
-		vkCmdDrawIndexed(commandBuffer,
-			static_cast<uint32_t>(M_Sea.indices.size()), 1, 0, 0, 0);
-
-
-		//pipeline P2
-		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-			P2.graphicsPipeline);
-		vkCmdBindDescriptorSets(commandBuffer,
-			VK_PIPELINE_BIND_POINT_GRAPHICS,
-			P2.pipelineLayout, 0, 1, &DS_global.descriptorSets[currentImage],
-			0, nullptr);
-
-		//gameover
-		VkBuffer vertexBuffers5[] = { M_GameOver.vertexBuffer };
-		VkDeviceSize offsets5[] = { 0 };
-		vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers5, offsets5);
-		vkCmdBindIndexBuffer(commandBuffer, M_GameOver.indexBuffer, 0,
-			VK_INDEX_TYPE_UINT32);
-		vkCmdBindDescriptorSets(commandBuffer,
-			VK_PIPELINE_BIND_POINT_GRAPHICS,
-			P2.pipelineLayout, 1, 1, &DS_GameOver.descriptorSets[currentImage],
-			0, nullptr);
-		vkCmdDrawIndexed(commandBuffer,
-			static_cast<uint32_t>(M_GameOver.indices.size()), 1, 0, 0, 0);
-
-		//new game
-		VkBuffer vertexBuffers6[] = { M_GameOver.vertexBuffer };
-		VkDeviceSize offsets6[] = { 0 };
-		vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers6, offsets6);
-		vkCmdBindIndexBuffer(commandBuffer, M_GameOver.indexBuffer, 0,
-			VK_INDEX_TYPE_UINT32);
-		vkCmdBindDescriptorSets(commandBuffer,
-			VK_PIPELINE_BIND_POINT_GRAPHICS,
-			P2.pipelineLayout, 1, 1, &DS_NewGame.descriptorSets[currentImage],
-			0, nullptr);
-		vkCmdDrawIndexed(commandBuffer,
-			static_cast<uint32_t>(M_GameOver.indices.size()), 1, 0, 0, 0);
+		// the objects are drawn in the order of scene.json; the rocks and the
+		// boat with the level of detail selected in updateUniformBuffer
+		scene.draw(commandBuffer, currentImage);
 	}
 
 	// Here is where you update the uniforms.
@@ -353,6 +142,9 @@ protected:
 
 		globalUniformBufferObject gubo{};
 		UniformBufferObject ubo{};
+		ImpostorUniformBufferObject iubo{};
+		iubo.frames = static_cast<float>(Impostor::frames);
+		float viewportHeight = static_cast<float>(swapChainExtent.height);
 
 		gubo.lightColor = glm::vec3(0.8f, 0.8f, 0.8f);
 		gubo.lightDir = glm::vec3(0.0f, 1.0f - light_pos, -2.0f + light_pos);
@@ -365,7 +157,6 @@ protected:
 			light_pos += time * speederIncrement * 100;
 		}
 
-		void* data;
 
 		//if the game is over, move the camera to another direction that displays the "GAME OVER" sign
 		// we use the lookAt method as the game is in 3rd person
@@ -384,15 +175,16 @@ protected:
 			0.1f, 1000.0f);
 		gubo.proj[1][1] *= -1;
 
-		vkMapMemory(device, DS_global.uniformBuffersMemory[0][currentImage], 0,
-			sizeof(gubo), 0, &data);
-		memcpy(data, &gubo, sizeof(gubo));
-		vkUnmapMemory(device, DS_global.uniformBuffersMemory[0][currentImage]);
+		*O_global->uniform<globalUniformBufferObject>(currentImage) = gubo;
 
 		if (glfwGetKey(window, GLFW_KEY_SPACE)) {
 			gameStarted = true;
 		}
 
+		// the rocks on the sea this frame are added to their instanced draws
+		O_Rock1->instances.begin();
+		O_Rock2->instances.begin();
+
 		if (gameStarted == true) {
 			// Here is where you actually update your uniforms
 			// For little rock
@@ -412,10 +204,17 @@ protected:
 			ubo.model = glm::translate(glm::mat4(1.0f), glm::vec3(random_pos, randomTranslationYLittleRock, 40.0f + rock_pos * 4.0f));
 			ubo.model = glm::rotate(ubo.model, glm::radians(randomRotYLittleRock),
 				glm::vec3(0.0f, 1.0f, 0.0f));
-			vkMapMemory(device, DS_R1.uniformBuffersMemory[0][currentImage], 0,
-				sizeof(ubo), 0, &data);
-			memcpy(data, &ubo, sizeof(ubo));
-			vkUnmapMemory(device, DS_R1.uniformBuffersMemory[0][currentImage]);
+			// far away, the rock crossfades to its impostor
+			ubo.fadeOut = O_I1->impostor->fade(ubo.model, gubo.view, gubo.proj, viewportHeight);
+			if (ubo.fadeOut < 1.0f) {
+				O_Rock1->instances.add(ubo.model, gubo.view, gubo.proj, ubo.fadeOut);
+			}
+
+			iubo.model = ubo.model;
+			iubo.fadeIn = ubo.fadeOut;
+			iubo.centerRadius = glm::vec4(O_I1->impostor->center, O_I1->impostor->radius);
+			O_I1->show(currentImage, iubo.fadeIn > 0.0f);
+			*O_I1->uniform<ImpostorUniformBufferObject>(currentImage) = iubo;
 
 			// For big rock
 			if (30.0f + rock_pos2 * 4.0f > -20.0f) {
@@ -439,10 +238,19 @@ protected:
 			ubo.model = glm::translate(glm::mat4(1.0f), glm::vec3(random_pos2, randomTranslationYBigRock, 30.0f + rock_pos2 * 4.0f));
 			ubo.model = glm::rotate(ubo.model, glm::radians(randomRotYBigRock),
 				glm::vec3(0.0f, 1.0f, 0.0f));
-			vkMapMemory(device, DS_R2.uniformBuffersMemory[0][currentImage], 0,
-				sizeof(ubo), 0, &data);
-			memcpy(data, &ubo, sizeof(ubo));
-			vkUnmapMemory(device, DS_R2.uniformBuffersMemory[0][currentImage]);
+			ubo.fadeOut = O_I2->impostor->fade(ubo.model, gubo.view, gubo.proj, viewportHeight);
+			if (ubo.fadeOut < 1.0f) {
+				O_Rock2->instances.add(ubo.model, gubo.view, gubo.proj, ubo.fadeOut);
+			}
+
+			iubo.model = ubo.model;
+			iubo.fadeIn = ubo.fadeOut;
+			iubo.centerRadius = glm::vec4(O_I2->impostor->center, O_I2->impostor->radius);
+			O_I2->show(currentImage, iubo.fadeIn > 0.0f);
+			*O_I2->uniform<ImpostorUniformBufferObject>(currentImage) = iubo;
+
+			// the boat and the sea are never replaced
+			ubo.fadeOut = 0.0f;
 
 			// For the boat
 			//move the boat to the right
@@ -508,10 +316,9 @@ protected:
 			rotx = 0.0f;
 			roty = 90.0f;
 
-			vkMapMemory(device, DS_Boat.uniformBuffersMemory[0][currentImage], 0,
-				sizeof(ubo), 0, &data);
-			memcpy(data, &ubo, sizeof(ubo));
-			vkUnmapMemory(device, DS_Boat.uniformBuffersMemory[0][currentImage]);
+			O_Boat->lodDraw.update(currentImage, ubo.model, gubo.view, gubo.proj);
+			O_Boat->transform = ubo.model;
+			*O_Boat->uniform<UniformBufferObject>(currentImage) = ubo;
 
 			// For the sea
 			if (sea_pos * 4.0f > 0.0f) {
@@ -523,10 +330,9 @@ protected:
 			}
 			ubo.model = glm::scale(glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.5f, sea_pos * 6.0f)),
 				glm::vec3(7.0f, 1.0f, 6.0f));
-			vkMapMemory(device, DS_Sea.uniformBuffersMemory[0][currentImage], 0,
-				sizeof(ubo), 0, &data);
-			memcpy(data, &ubo, sizeof(ubo));
-			vkUnmapMemory(device, DS_Sea.uniformBuffersMemory[0][currentImage]);
+			O_Sea->show(currentImage, true);
+			O_Sea->transform = ubo.model;
+			*O_Sea->uniform<UniformBufferObject>(currentImage) = ubo;
 
 			// GAME RESET: all parameters restored
 			if (glfwGetKey(window, GLFW_KEY_ENTER) && gameOver == true) {
@@ -545,6 +351,8 @@ protected:
 				gameOver = false;
 			}
 		}
+		O_Rock1->instances.end(currentImage);
+		O_Rock2->instances.end(currentImage);
 
 		//For the GameOver
 		ubo.model = glm::translate(glm::mat4(1.0f), glm::vec3(-27.5f, 48.1f, -30.0f));
@@ -553,18 +361,18 @@ protected:
 		ubo.model = glm::rotate(ubo.model, glm::radians(180.0f),
 			glm::vec3(0.0f, 1.0f, 0.0f));
 		ubo.model = glm::scale(ubo.model, glm::vec3(5.0f, 1.0f, 5.0f));
+		// the game over screen is lazy: created when first shown
 		if (gameOver == true) {
-			vkMapMemory(device, DS_GameOver.uniformBuffersMemory[0][currentImage], 0,
-				sizeof(ubo), 0, &data);
-			memcpy(data, &ubo, sizeof(ubo));
-			vkUnmapMemory(device, DS_GameOver.uniformBuffersMemory[0][currentImage]);
+			scene.require(O_GameOver);
+			O_GameOver->transform = ubo.model;
+			*O_GameOver->uniform<UniformBufferObject>(currentImage) = ubo;
 		}
 		else {
-			vkMapMemory(device, DS_NewGame.uniformBuffersMemory[0][currentImage], 0,
-				sizeof(ubo), 0, &data);
-			memcpy(data, &ubo, sizeof(ubo));
-			vkUnmapMemory(device, DS_NewGame.uniformBuffersMemory[0][currentImage]);
+			O_NewGame->transform = ubo.model;
+			*O_NewGame->uniform<UniformBufferObject>(currentImage) = ubo;
 		}
+		O_GameOver->show(currentImage, gameOver);
+		O_NewGame->show(currentImage, !gameOver);
 	}
 };
 
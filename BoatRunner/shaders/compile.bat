@@ -1,4 +1,11 @@
 @ECHO OFF
 C:\VulkanSDK\1.3.204.1\Bin\glslc.exe shader.frag -o frag.spv
 C:\VulkanSDK\1.3.204.1\Bin\glslc.exe shader.vert -o vert.spv
+C:\VulkanSDK\1.3.204.1\Bin\glslc.exe -DQUANTIZED shader.vert -o vert_quantized.spv
+C:\VulkanSDK\1.3.204.1\Bin\glslc.exe -DPUSH_MODEL shader.vert -o vert_push.spv
+C:\VulkanSDK\1.3.204.1\Bin\glslc.exe -DINSTANCED shader.vert -o vert_instanced.spv
+C:\VulkanSDK\1.3.204.1\Bin\glslc.exe impostor.vert -o impostor_vert.spv
+C:\VulkanSDK\1.3.204.1\Bin\glslc.exe impostor.frag -o impostor_frag.spv
+C:\VulkanSDK\1.3.204.1\Bin\glslc.exe menu2.frag -o menu_frag.spv
+for %%f in (*.spv) do C:\VulkanSDK\1.3.204.1\Bin\spirv-val.exe --target-env vulkan1.0 %%f || echo %%f failed validation
 pause
\ No newline at end of file
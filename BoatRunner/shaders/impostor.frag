@@ -0,0 +1,66 @@
+#version 450
+
+layout(set= 0, binding = 0) uniform globalUniformBufferObject {
+	mat4 view;
+	mat4 proj;
+	vec3 lightDir; 
+	vec3 lightColor; 
+
+	vec3 AmbColor;	
+	vec3 TopColor;	
+
+	vec3 eyePos;
+} gubo;
+
+layout(set= 1, binding = 1) uniform sampler2D albedoSampler;
+layout(set= 1, binding = 2) uniform sampler2D normalSampler;
+
+layout(location = 0) in vec3 fragViewDir;
+layout(location = 1) in vec2 fragTexCoord;
+layout(location = 2) in float fragFadeIn;
+layout(location = 3) in mat3 fragFrame;
+
+layout(location = 0) out vec4 outColor;
+
+// Same lighting as shader.frag
+vec3 Lambert_Hemispheric_Color(vec3 N, vec3 V, vec3 Cd, vec3 Ca, float gamma) {
+	vec3 HemiDir = vec3(0.0f, 1.0f, 0.0f);
+	
+	vec3 lambert = Cd * max(dot(gubo.lightDir, N), 0.0f);
+	vec3 first_term = lambert * gubo.lightColor;
+	
+	vec3 x = ((dot(N, HemiDir) + 1)* gubo.TopColor)/2;
+	vec3 y = ((1 - dot(N, HemiDir))* gubo.AmbColor)/2; 
+	vec3 second_term = (x + y) * Ca;
+
+	vec3 H1 = normalize(gubo.lightDir + V);
+	float clamped = clamp(dot(N, H1), 0, 1);
+	float powered = pow(clamped, gamma);
+	vec3 blinn = Cd * powered;
+
+	return (first_term + blinn + second_term);
+}
+
+float Bayer4(ivec2 p) {
+	const float m[16] = float[](0.0, 8.0, 2.0, 10.0, 12.0, 4.0, 14.0, 6.0,
+								3.0, 11.0, 1.0, 9.0, 15.0, 7.0, 13.0, 5.0);
+	return (m[(p.y & 3) * 4 + (p.x & 3)] + 0.5) / 16.0;
+}
+
+void main() {
+	// Draws exactly the pixels shader.frag discards
+	if(Bayer4(ivec2(gl_FragCoord.xy)) >= fragFadeIn) {
+		discard;
+	}
+	vec4 albedo = texture(albedoSampler, fragTexCoord);
+	if(albedo.a < 0.5) {
+		discard;
+	}
+	
+	vec3 Norm = normalize(fragFrame * (texture(normalSampler, fragTexCoord).rgb * 2.0 - 1.0));
+	vec3 EyeDir = normalize(gubo.eyePos.xyz - fragViewDir);
+
+	vec3 CompColor = Lambert_Hemispheric_Color(Norm, EyeDir, albedo.rgb, albedo.rgb, 200.0f);
+
+	outColor = vec4(CompColor, 1.0f);
+}
@@ -0,0 +1,63 @@
+#version 450
+// Quad of an octahedral impostor (see Impostor in MyProject.hpp), facing
+// the baked direction closest to the one the object is seen from
+layout(set= 0, binding = 0) uniform globalUniformBufferObject {
+	mat4 view;
+	mat4 proj;
+} gubo;
+
+layout(set= 1, binding = 0) uniform ImpostorUniformBufferObject {
+	mat4 model;
+	float fadeIn;		// Impostor::fade()
+	vec4 centerRadius;	// Impostor::center, Impostor::radius
+	float frames;		// Impostor::frames
+} ubo;
+
+layout(location = 0) in vec3 pos;
+layout(location = 1) in vec3 norm;
+layout(location = 2) in vec2 texCoord;
+
+layout(location = 0) out vec3 fragViewDir;
+layout(location = 1) out vec2 fragTexCoord;
+layout(location = 2) out float fragFadeIn;
+layout(location = 3) out mat3 fragFrame;
+
+vec2 octEncode(vec3 n) {
+	n /= abs(n.x) + abs(n.y) + abs(n.z);
+	vec2 e = n.xy;
+	if(n.z < 0.0) {
+		e = (1.0 - abs(e.yx)) * vec2(e.x >= 0.0 ? 1.0 : -1.0, e.y >= 0.0 ? 1.0 : -1.0);
+	}
+	return e;
+}
+
+vec3 octDecode(vec2 e) {
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	float t = max(-n.z, 0.0);
+	n.x += n.x >= 0.0 ? -t : t;
+	n.y += n.y >= 0.0 ? -t : t;
+	return normalize(n);
+}
+
+void main() {
+	// Camera position in object space
+	mat4 invModel = inverse(ubo.model);
+	vec3 eye = (invModel * vec4(inverse(gubo.view)[3].xyz, 1.0)).xyz;
+	vec3 dir = normalize(eye - ubo.centerRadius.xyz);
+	
+	// Closest frame, same basis as Impostor::frameBasis()
+	vec2 cell = clamp(floor((octEncode(dir) * 0.5 + 0.5) * ubo.frames), 0.0, ubo.frames - 1.0);
+	vec3 frameDir = octDecode((cell + 0.5) / ubo.frames * 2.0 - 1.0);
+	vec3 reference = abs(frameDir.y) > 0.999 ? vec3(0.0, 0.0, 1.0) : vec3(0.0, 1.0, 0.0);
+	vec3 right = normalize(cross(reference, frameDir));
+	vec3 up = cross(frameDir, right);
+	
+	vec3 objPos = ubo.centerRadius.xyz + ubo.centerRadius.w * (pos.x * right + pos.y * up);
+	vec4 worldPos = ubo.model * vec4(objPos, 1.0);
+	gl_Position = gubo.proj * gubo.view * worldPos;
+	
+	fragViewDir  = worldPos.xyz;
+	fragTexCoord = (cell + texCoord) / ubo.frames;
+	fragFadeIn   = ubo.fadeIn;
+	fragFrame    = mat3(ubo.model);
+}
@@ -17,6 +17,7 @@ layout(set= 1, binding = 1) uniform sampler2D texSampler;
 layout(location = 0) in vec3 fragViewDir;
 layout(location = 1) in vec3 fragNorm;
 layout(location = 2) in vec2 fragTexCoord;
+layout(location = 3) in float fragFadeOut;
 
 layout(location = 0) out vec4 outColor;
 
@@ -110,7 +111,19 @@ vec3 OrenNayar_Ambient_Color(vec3 N, vec3 V, vec3 Cd, vec3 Ca, float sigma) {
 	return ((f * gubo.lightColor) + (gubo.AmbColor * Ca));
 }
 
+// Ordered dithering threshold in (0, 1), see also impostor.frag
+float Bayer4(ivec2 p) {
+	const float m[16] = float[](0.0, 8.0, 2.0, 10.0, 12.0, 4.0, 14.0, 6.0,
+								3.0, 11.0, 1.0, 9.0, 15.0, 7.0, 13.0, 5.0);
+	return (m[(p.y & 3) * 4 + (p.x & 3)] + 0.5) / 16.0;
+}
+
 void main() {
+	// Crossfade with the impostor: each pixel is drawn by one of the two
+	if(Bayer4(ivec2(gl_FragCoord.xy)) < fragFadeOut) {
+		discard;
+	}
+	
 	vec3 Norm = normalize(fragNorm);
 	vec3 EyeDir = normalize(gubo.eyePos.xyz - fragViewDir);
 	
@@ -1,22 +1,75 @@
 #version 450
-layout(set= 0, binding = 0) uniform globalUniformBufferObject {
+// Compiled as is for float vertices, with -DQUANTIZED for
+// QuantizedVertex meshes (see Model::format), and with -DPUSH_MODEL for
+// pipelines declaring a 64 byte vertex push constant range: the model
+// matrix is then SceneObject::transform, and ubo.model is ignored. With
+// -DINSTANCED, for instanced pipelines, the model matrix and fadeOut come
+// from the InstanceData of each instance instead.
+layout(set= 0, binding = 0) uniform globalUniformBufferObject {
 	mat4 view;
 	mat4 proj;
 } gubo;
 
 layout(set= 1, binding = 0) uniform UniformBufferObject {
 	mat4 model;
+	float fadeOut;		// Impostor::fade(), 1 when the impostor replaced the mesh
+#ifdef QUANTIZED
+	vec4 posOffset;		// Model::quantizationOffset()
+	vec4 posScale;		// Model::quantizationScale()
+#endif
 } ubo;
 
-layout(location = 0) in vec3 pos;
+#ifdef PUSH_MODEL
+layout(push_constant) uniform PushConstants {
+	mat4 model;
+} push;
+#endif
+
+#if defined(INSTANCED)
+layout(location = 3) in mat4 instanceModel;		// InstanceData::model
+layout(location = 7) in vec4 instanceParams;	// InstanceData::params
+#define MODEL instanceModel
+#define FADE_OUT instanceParams.x
+#elif defined(PUSH_MODEL)
+#define MODEL push.model
+#define FADE_OUT ubo.fadeOut
+#else
+#define MODEL ubo.model
+#define FADE_OUT ubo.fadeOut
+#endif
+
+#ifdef QUANTIZED
+layout(location = 0) in vec4 qPos;
+layout(location = 1) in vec2 qNorm;
+#else
+layout(location = 0) in vec3 pos;
 layout(location = 1) in vec3 norm;
+#endif
 layout(location = 2) in vec2 texCoord;
 
 layout(location = 0) out vec3 fragViewDir;
 layout(location = 1) out vec3 fragNorm;
-layout(location = 2) out vec2 fragTexCoord;void main() {
-	gl_Position = gubo.proj * gubo.view * ubo.model * vec4(pos, 1.0);
-	fragViewDir  = (gubo.view[3]).xyz - (ubo.model * vec4(pos,  1.0)).xyz;
-	fragNorm     = (ubo.model * vec4(norm, 0.0)).xyz;
+layout(location = 2) out vec2 fragTexCoord;
+layout(location = 3) out float fragFadeOut;
+
+#ifdef QUANTIZED
+vec3 octDecode(vec2 e) {
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	float t = max(-n.z, 0.0);
+	n.x += n.x >= 0.0 ? -t : t;
+	n.y += n.y >= 0.0 ? -t : t;
+	return normalize(n);
+}
+#endif
+
+void main() {
+#ifdef QUANTIZED
+	vec3 pos = ubo.posOffset.xyz + ubo.posScale.xyz * qPos.xyz;
+	vec3 norm = octDecode(qNorm);
+#endif
+	gl_Position = gubo.proj * gubo.view * MODEL * vec4(pos, 1.0);
+	fragViewDir  = (gubo.view[3]).xyz - (MODEL * vec4(pos,  1.0)).xyz;
+	fragNorm     = (MODEL * vec4(norm, 0.0)).xyz;
 	fragTexCoord = texCoord;
-}
\ No newline at end of file
+	fragFadeOut  = FADE_OUT;
+}